@@ -0,0 +1,209 @@
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string_view>
+
+#include "city_generator.h"
+#include "requests.h"
+#include "responses.h"
+#include "data_manager.h"
+#include "trace.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+    struct BenchmarkSettings {
+        Generator::CitySettings city;
+        Generator::RequestsMix mix;
+        string base_file = "transport_guide_benchmark.bin";
+        string output_dir;
+    };
+
+    void Usage() {
+        cerr << "Usage: transport_guide_benchmark [generate <dir>] [key=value ...]\n"
+             << "  keys: stops, buses, companies, min_route, max_route, seed, requests, base_file,\n"
+             << "        mix.<RequestType> (Bus, Stop, Route, Routes, RouteMatrix, Map, FindCompanies,\n"
+             << "        RouteToCompany)\n";
+    }
+
+    BenchmarkSettings ParseSettings(int argc, const char *argv[], int first_arg) {
+        BenchmarkSettings settings;
+        for (int i = first_arg; i < argc; i++) {
+            const string_view arg(argv[i]);
+            const auto eq = arg.find('=');
+            if (eq == string_view::npos)
+                throw invalid_argument("expected key=value, got " + string(arg));
+            const string key(arg.substr(0, eq));
+            const string value(arg.substr(eq + 1));
+
+            if (key == "stops") {
+                settings.city.stop_count = stoul(value);
+            } else if (key == "buses") {
+                settings.city.bus_count = stoul(value);
+            } else if (key == "companies") {
+                settings.city.company_count = stoul(value);
+            } else if (key == "min_route") {
+                settings.city.min_route_length = stoul(value);
+            } else if (key == "max_route") {
+                settings.city.max_route_length = stoul(value);
+            } else if (key == "seed") {
+                settings.city.seed = stoul(value);
+            } else if (key == "requests") {
+                settings.mix.request_count = stoul(value);
+            } else if (key == "base_file") {
+                settings.base_file = value;
+            } else if (key.rfind("mix.", 0) == 0 && settings.mix.type_weights.count(key.substr(4))) {
+                settings.mix.type_weights[key.substr(4)] = stod(value);
+            } else {
+                throw invalid_argument("unknown key " + key);
+            }
+        }
+        if (settings.city.stop_count < 2)
+            throw invalid_argument("at least two stops are required");
+        return settings;
+    }
+
+    double MillisecondsSince(steady_clock::time_point start) {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+
+    void Generate(BenchmarkSettings const &settings) {
+        const string prefix = settings.output_dir + "/";
+        ofstream make_base(prefix + "make_base.json");
+        Generator::Print(Generator::GenerateMakeBase(settings.city, settings.base_file), make_base);
+        ofstream process_requests(prefix + "process_requests.json");
+        Generator::Print(Generator::GenerateProcessRequests(settings.city, settings.mix, settings.base_file),
+                         process_requests);
+    }
+
+    // returns false if a check of the answered requests fails
+    bool Run(BenchmarkSettings const &settings) {
+        stringstream make_base_input;
+        Generator::Print(Generator::GenerateMakeBase(settings.city, settings.base_file), make_base_input);
+        stringstream process_requests_input;
+        Generator::Print(Generator::GenerateProcessRequests(settings.city, settings.mix, settings.base_file),
+                         process_requests_input);
+
+        cout << fixed << setprecision(3);
+        cout << "city: stops=" << settings.city.stop_count << " buses=" << settings.city.bus_count
+             << " companies=" << settings.city.company_count << " route_length=" << settings.city.min_route_length
+             << ".." << settings.city.max_route_length << " requests=" << settings.mix.request_count << "\n";
+
+        {
+            const auto start = steady_clock::now();
+            const auto doc = Json::Load(make_base_input);
+            const auto &input_map = doc.GetRoot();
+
+            DbItemIdNameMap db_item_id_name_map;
+            const DS::DataBase db{
+                    ReadBaseRequests(input_map["base_requests"], db_item_id_name_map),
+                    ReadYellowPagesData(input_map["yellow_pages"], db_item_id_name_map),
+                    ReadRoutingSettings(input_map["routing_settings"]),
+                    ReadRenderSettings(input_map["render_settings"]),
+                    std::move(db_item_id_name_map)
+            };
+            ofstream out(settings.base_file, ios::out | ios::binary);
+            if (!out.is_open())
+                throw logic_error("can't open file " + settings.base_file);
+            db.Serialize(out);
+            out.close();
+            cout << "make_base: " << MillisecondsSince(start) << " ms\n";
+        }
+
+        {
+            ifstream base(settings.base_file, ios::in | ios::binary | ios::ate);
+            cout << "base file size: " << static_cast<long long>(base.tellg()) << " bytes\n";
+        }
+
+        const auto start = steady_clock::now();
+        const auto doc = Json::Load(process_requests_input);
+        const auto &input_map = doc.GetRoot();
+        ifstream inp(settings.base_file, ios::in | ios::binary);
+        const DS::DataBase db(inp);
+        inp.close();
+        cout << "process_requests startup: " << MillisecondsSince(start) << " ms\n";
+
+        // the whole batch goes through the planner, as in process_requests
+        auto const &stat_requests = input_map["stat_requests"];
+        ResponseCache cache(numeric_limits<size_t>::max());
+        const auto requests_start = steady_clock::now();
+        auto responses = ReadStatRequests(db, stat_requests, *db.db_item_id_name_map, cache);
+        cout << "process_requests handling: " << MillisecondsSince(requests_start) << " ms\n";
+
+        ostringstream first_batch;
+        const auto print_start = steady_clock::now();
+        PrintResponses(responses, first_batch);
+        cout << "process_requests output: " << MillisecondsSince(print_start) << " ms, "
+             << first_batch.str().size() << " bytes\n";
+
+#ifdef TRANSPORT_GUIDE_TRACE
+        // recorded by ReadStatRequests around each processed request, repeats within the batch
+        // are answered by their first occurrence and have no latency of their own
+        const string_view latency_prefix = "request ";
+        cout << "latency, ms" << setw(12) << "count" << setw(10) << "p50" << setw(10) << "p90"
+             << setw(10) << "p99" << setw(10) << "max\n";
+        for (auto const &[name, histogram]: Trace::Registry::Instance().GetLatencies()) {
+            if (name.compare(0, latency_prefix.size(), latency_prefix) != 0)
+                continue;
+            cout << setw(15) << left << name.substr(latency_prefix.size()) << right << setw(8) << histogram.count
+                 << setw(10) << histogram.Percentile(0.5) << setw(10) << histogram.Percentile(0.9)
+                 << setw(10) << histogram.Percentile(0.99) << setw(10) << histogram.max_ms << "\n";
+        }
+#else
+        cout << "latency per request type: build with -DTRANSPORT_GUIDE_TRACE=ON\n";
+#endif
+
+        // once the batch is cached, and the cache is large enough to hold it, every request of the
+        // repeated batch is a hit, so none of them is parsed or processed, and the output must not change
+        const auto cache_start = steady_clock::now();
+        CacheStatResponses(stat_requests, std::move(responses), cache);
+        cout << "caching the batch: " << MillisecondsSince(cache_start) << " ms\n";
+        const size_t hits = cache.GetHits();
+        const auto repeat_start = steady_clock::now();
+        const auto repeated = ReadStatRequests(db, stat_requests, *db.db_item_id_name_map, cache);
+        const double repeat_ms = MillisecondsSince(repeat_start);
+        ostringstream repeated_batch;
+        PrintResponses(repeated, repeated_batch);
+        const size_t repeat_hits = cache.GetHits() - hits;
+        cout << "repeated batch: " << repeat_ms << " ms, " << repeat_hits << " cache hits of "
+             << stat_requests.AsArray().size() << " requests, " << cache.GetSizeBytes() << " bytes cached\n";
+        if (repeat_hits != stat_requests.AsArray().size()) {
+            cerr << "repeated batch: expected every request to be a cache hit\n";
+            return false;
+        }
+        if (repeated_batch.str() != first_batch.str()) {
+            cerr << "repeated batch: cached responses differ from processed ones\n";
+            return false;
+        }
+        return true;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    ios::sync_with_stdio(false);
+
+    try {
+        if (argc >= 2 && string_view(argv[1]) == "generate") {
+            if (argc < 3) {
+                Usage();
+                return 5;
+            }
+            auto settings = ParseSettings(argc, argv, 3);
+            settings.output_dir = argv[2];
+            Generate(settings);
+        } else {
+            if (!Run(ParseSettings(argc, argv, 1)))
+                return 1;
+        }
+    } catch (const exception &e) {
+        cerr << e.what() << "\n";
+        Usage();
+        return 5;
+    }
+
+    return 0;
+}
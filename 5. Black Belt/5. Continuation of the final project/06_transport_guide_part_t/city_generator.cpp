@@ -0,0 +1,276 @@
+#include "city_generator.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <vector>
+
+namespace {
+    using Dict = std::map<std::string, Json::Node>;
+
+    const std::vector<std::string> RubricKeywords{
+            "park", "cafe", "shop", "museum", "cinema", "gym", "pharmacy", "bank", "library", "theatre"
+    };
+
+    // RouteMatrix requests have 1..MaxMatrixSide sources and 1..MaxMatrixSide targets
+    const size_t MaxMatrixSide = 20;
+
+    std::string StopName(size_t i) {
+        return "Stop " + std::to_string(i);
+    }
+
+    std::string BusName(size_t i) {
+        return "Bus " + std::to_string(i);
+    }
+
+    std::string RingBusName() {
+        return "Ring";
+    }
+
+    std::string CompanyName(size_t i) {
+        return "Company " + std::to_string(i);
+    }
+
+    std::vector<size_t> SampleStops(size_t count, size_t stop_count, std::mt19937 &rnd) {
+        std::vector<size_t> ids(stop_count);
+        std::iota(ids.begin(), ids.end(), 0);
+        count = std::min(count, stop_count);
+        for (size_t i = 0; i < count; i++) {
+            std::swap(ids[i], ids[std::uniform_int_distribution<size_t>(i, stop_count - 1)(rnd)]);
+        }
+        ids.resize(count);
+        return ids;
+    }
+
+    Json::Node MakeColor(std::mt19937 &rnd) {
+        std::uniform_int_distribution<int> channel(0, 255);
+        return std::vector<Json::Node>{channel(rnd), channel(rnd), channel(rnd)};
+    }
+
+    Dict MakeRenderSettings(std::mt19937 &rnd) {
+        std::vector<Json::Node> palette{std::string("green"), std::string("red"), std::string("orange")};
+        for (size_t i = 0; i < 5; i++) {
+            palette.emplace_back(MakeColor(rnd));
+        }
+        return Dict{
+                {"width",                1500},
+                {"height",               950},
+                {"padding",              50},
+                {"outer_margin",         150},
+                {"stop_radius",          3},
+                {"line_width",           10},
+                {"company_radius",       5},
+                {"company_line_width",   2},
+                {"stop_label_font_size", 13},
+                {"stop_label_offset",    std::vector<Json::Node>{7, -3}},
+                {"underlayer_color",     std::vector<Json::Node>{255, 255, 255, 0.85}},
+                {"underlayer_width",     3},
+                {"color_palette",        std::move(palette)},
+                {"bus_label_font_size",  18},
+                {"bus_label_offset",     std::vector<Json::Node>{7, 15}},
+                {"layers",               std::vector<Json::Node>{
+                        std::string("bus_lines"), std::string("bus_labels"), std::string("stop_points"),
+                        std::string("stop_labels"), std::string("company_lines"), std::string("company_points"),
+                        std::string("company_labels")}}
+        };
+    }
+
+    Dict MakeYellowPages(Generator::CitySettings const &city, std::mt19937 &rnd) {
+        Dict rubrics;
+        for (size_t i = 0; i < RubricKeywords.size(); i++) {
+            rubrics.emplace(std::to_string(i + 1), Dict{{"name", RubricKeywords[i]}});
+        }
+
+        static const std::vector<std::string> days{
+                "MONDAY", "TUESDAY", "WEDNESDAY", "THURSDAY", "FRIDAY", "SATURDAY", "SUNDAY"
+        };
+        std::uniform_real_distribution<double> lat(55.5, 55.9);
+        std::uniform_real_distribution<double> lon(37.3, 37.9);
+        std::uniform_int_distribution<int> rubric_id(1, static_cast<int>(RubricKeywords.size()));
+        std::uniform_int_distribution<int> meters(50, 1500);
+        std::uniform_int_distribution<size_t> nearby_count(1, 3);
+
+        std::vector<Json::Node> companies;
+        companies.reserve(city.company_count);
+        for (size_t i = 0; i < city.company_count; i++) {
+            Dict company;
+            company.emplace("names", std::vector<Json::Node>{
+                    Dict{{"value", CompanyName(i)}, {"type", std::string("MAIN")}},
+                    Dict{{"value", "Alias " + std::to_string(i % 17)}, {"type", std::string("SYNONYM")}}
+            });
+            company.emplace("rubrics", std::vector<Json::Node>{rubric_id(rnd)});
+            company.emplace("address", Dict{{"coords", Dict{
+                    {"lat", std::to_string(lat(rnd))},
+                    {"lon", std::to_string(lon(rnd))}
+            }}});
+
+            std::vector<Json::Node> nearby_stops;
+            for (size_t stop_id: SampleStops(nearby_count(rnd), city.stop_count, rnd)) {
+                nearby_stops.emplace_back(Dict{{"name", StopName(stop_id)}, {"meters", meters(rnd)}});
+            }
+            company.emplace("nearby_stops", std::move(nearby_stops));
+
+            company.emplace("phones", std::vector<Json::Node>{Dict{
+                    {"type",         std::string("PHONE")},
+                    {"country_code", std::string("7")},
+                    {"local_code",   std::string("495")},
+                    {"number",       std::to_string(1000000 + i % 97)}
+            }});
+            company.emplace("urls", std::vector<Json::Node>{Dict{{"value", "company" + std::to_string(i % 31) + ".ru"}}});
+
+            if (i % 2 == 0) {
+                std::vector<Json::Node> intervals;
+                for (size_t day = 0; day < days.size(); day++) {
+                    if ((i + day) % 3 == 0)
+                        continue;
+                    intervals.emplace_back(Dict{
+                            {"day",          days[day]},
+                            {"minutes_from", static_cast<int>(480 + (i % 4) * 60)},
+                            {"minutes_to",   static_cast<int>(1080 + (i % 5) * 60)}
+                    });
+                }
+                company.emplace("working_time", Dict{{"intervals", std::move(intervals)}});
+            }
+            companies.emplace_back(std::move(company));
+        }
+
+        return Dict{{"rubrics", std::move(rubrics)}, {"companies", std::move(companies)}};
+    }
+}
+
+Json::Node Generator::GenerateMakeBase(CitySettings const &city, std::string const &base_file) {
+    std::mt19937 rnd(city.seed);
+    std::uniform_real_distribution<double> lat(55.5, 55.9);
+    std::uniform_real_distribution<double> lon(37.3, 37.9);
+    std::uniform_int_distribution<int> road_distance(300, 5000);
+    std::uniform_int_distribution<size_t> route_length(std::max<size_t>(city.min_route_length, 2),
+                                                       std::max(city.min_route_length, city.max_route_length));
+
+    std::vector<std::pair<std::string, std::vector<size_t>>> routes;
+    std::vector<bool> is_roundtrip;
+
+    std::vector<size_t> ring = SampleStops(city.stop_count, city.stop_count, rnd);
+    ring.push_back(ring.front());
+    routes.emplace_back(RingBusName(), std::move(ring));
+    is_roundtrip.push_back(true);
+
+    for (size_t i = 0; i < city.bus_count; i++) {
+        auto stops = SampleStops(route_length(rnd), city.stop_count, rnd);
+        bool roundtrip = rnd() % 2;
+        if (roundtrip)
+            stops.push_back(stops.front());
+        routes.emplace_back(BusName(i), std::move(stops));
+        is_roundtrip.push_back(roundtrip);
+    }
+
+    std::vector<Dict> road_distances(city.stop_count);
+    for (auto const &[_, stops]: routes) {
+        for (size_t i = 1; i < stops.size(); i++) {
+            auto const &from = stops[i - 1];
+            auto const &to = stops[i];
+            if (!road_distances[from].count(StopName(to)) && !road_distances[to].count(StopName(from)))
+                road_distances[from].emplace(StopName(to), road_distance(rnd));
+        }
+    }
+
+    std::vector<Json::Node> base_requests;
+    base_requests.reserve(city.stop_count + routes.size());
+    for (size_t i = 0; i < city.stop_count; i++) {
+        base_requests.emplace_back(Dict{
+                {"type",           std::string("Stop")},
+                {"name",           StopName(i)},
+                {"latitude",       lat(rnd)},
+                {"longitude",      lon(rnd)},
+                {"road_distances", std::move(road_distances[i])}
+        });
+    }
+    for (size_t i = 0; i < routes.size(); i++) {
+        std::vector<Json::Node> stops;
+        stops.reserve(routes[i].second.size());
+        for (size_t stop_id: routes[i].second) {
+            stops.emplace_back(StopName(stop_id));
+        }
+        base_requests.emplace_back(Dict{
+                {"type",         std::string("Bus")},
+                {"name",         routes[i].first},
+                {"stops",        std::move(stops)},
+                {"is_roundtrip", static_cast<bool>(is_roundtrip[i])}
+        });
+    }
+    std::shuffle(base_requests.begin(), base_requests.end(), rnd);
+
+    return Dict{
+            {"serialization_settings", Dict{{"file", base_file}}},
+            {"routing_settings",       Dict{{"bus_wait_time", 6}, {"bus_velocity", 40}, {"pedestrian_velocity", 4}}},
+            {"render_settings",        MakeRenderSettings(rnd)},
+            {"base_requests",          std::move(base_requests)},
+            {"yellow_pages",           MakeYellowPages(city, rnd)}
+    };
+}
+
+Json::Node Generator::GenerateProcessRequests(CitySettings const &city, RequestsMix const &mix,
+                                              std::string const &base_file) {
+    std::mt19937 rnd(city.seed + 1);
+    std::vector<std::string> types;
+    std::vector<double> weights;
+    for (auto const &[type, weight]: mix.type_weights) {
+        types.push_back(type);
+        weights.push_back(weight);
+    }
+    std::discrete_distribution<size_t> type_dist(weights.begin(), weights.end());
+    std::uniform_int_distribution<size_t> stop_dist(0, city.stop_count - 1);
+    std::uniform_int_distribution<size_t> bus_dist(0, city.bus_count);
+    std::uniform_int_distribution<size_t> keyword_dist(0, RubricKeywords.size() - 1);
+
+    auto random_bus = [&]() {
+        size_t id = bus_dist(rnd);
+        return id == city.bus_count ? RingBusName() : BusName(id);
+    };
+
+    std::vector<Json::Node> stat_requests;
+    stat_requests.reserve(mix.request_count);
+    for (size_t id = 1; id <= mix.request_count; id++) {
+        const auto &type = types[type_dist(rnd)];
+        Dict request{{"id", static_cast<int>(id)}, {"type", type}};
+        if (type == "Bus") {
+            request.emplace("name", random_bus());
+        } else if (type == "Stop") {
+            request.emplace("name", StopName(stop_dist(rnd)));
+        } else if (type == "Route" || type == "Routes") {
+            request.emplace("from", StopName(stop_dist(rnd)));
+            request.emplace("to", StopName(stop_dist(rnd)));
+            if (type == "Routes")
+                request.emplace("k", 3);
+        } else if (type == "RouteMatrix") {
+            auto random_stops = [&]() {
+                std::vector<Json::Node> stops(1 + rnd() % MaxMatrixSide);
+                for (auto &stop: stops)
+                    stop = StopName(stop_dist(rnd));
+                return stops;
+            };
+            request.emplace("from", random_stops());
+            request.emplace("to", random_stops());
+        } else if (type == "FindCompanies") {
+            request.emplace("rubrics", std::vector<Json::Node>{RubricKeywords[keyword_dist(rnd)]});
+            if (rnd() % 4 == 0)
+                request.emplace("urls", std::vector<Json::Node>{"company" + std::to_string(rnd() % 31) + ".ru"});
+        } else if (type == "RouteToCompany") {
+            request.emplace("from", StopName(stop_dist(rnd)));
+            request.emplace("datetime", std::vector<Json::Node>{
+                    static_cast<int>(rnd() % 7), static_cast<int>(rnd() % 24), static_cast<int>(rnd() % 60)});
+            request.emplace("companies", Dict{{"rubrics", std::vector<Json::Node>{RubricKeywords[keyword_dist(rnd)]}}});
+        }
+        stat_requests.emplace_back(std::move(request));
+    }
+
+    return Dict{
+            {"serialization_settings", Dict{{"file", base_file}}},
+            {"stat_requests",          std::move(stat_requests)}
+    };
+}
+
+void Generator::Print(Json::Node const &doc, std::ostream &os) {
+    const auto precision = os.precision(12);
+    Json::Serializer::Serialize(doc.AsMap(), os);
+    os.precision(precision);
+}
@@ -0,0 +1,43 @@
+#ifndef CITY_GENERATOR_H
+#define CITY_GENERATOR_H
+
+#include <map>
+#include <string>
+#include <cstdint>
+
+#include "json.h"
+
+namespace Generator {
+    struct CitySettings {
+        size_t stop_count = 500;
+        size_t bus_count = 100;
+        size_t company_count = 300;
+        size_t min_route_length = 5;
+        size_t max_route_length = 20;
+        uint32_t seed = 42;
+    };
+
+    struct RequestsMix {
+        size_t request_count = 2000;
+        std::map<std::string, double> type_weights{
+                {"Bus",            15},
+                {"Stop",           15},
+                {"Route",          40},
+                {"Routes",         0},
+                {"RouteMatrix",    1},
+                {"Map",            1},
+                {"FindCompanies",  15},
+                {"RouteToCompany", 14}
+        };
+    };
+
+    // Every stop lies on a roundtrip "ring" bus, so any two stops are connected
+    // and every generated Route/RouteToCompany request has an answer.
+    Json::Node GenerateMakeBase(CitySettings const &city, std::string const &base_file);
+
+    Json::Node GenerateProcessRequests(CitySettings const &city, RequestsMix const &mix, std::string const &base_file);
+
+    void Print(Json::Node const &doc, std::ostream &os);
+}
+
+#endif //CITY_GENERATOR_H
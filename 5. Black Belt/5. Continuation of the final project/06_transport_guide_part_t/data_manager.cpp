@@ -2,9 +2,42 @@
 
 #include "transport_catalog.pb.h"
 #include "db_item_name_id_map.h"
+#include "trace.h"
 
 #include <algorithm>
 #include <cmath>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+    std::unordered_map<int, Data_Structure::Stop> MakeStops(Data_Structure::TransportNetwork const &network) {
+        std::unordered_map<int, Data_Structure::Stop> stops;
+        for (Data_Structure::TransportNetwork::Index stop = 0; stop < network.GetStopCount(); stop++) {
+            std::map<int, int> adjacent_stops;
+            size_t i = 0;
+            for (auto adjacent_stop: network.GetAdjacentStops(stop)) {
+                adjacent_stops.emplace(network.GetStopId(adjacent_stop), network.GetAdjacentDistance(stop, i++));
+            }
+            stops.emplace(network.GetStopId(stop),
+                          Data_Structure::Stop(network.GetStopId(stop), network.GetCoordinates(stop),
+                                               std::move(adjacent_stops)));
+        }
+        return stops;
+    }
+
+    std::unordered_map<int, Data_Structure::Bus> MakeBuses(Data_Structure::TransportNetwork const &network) {
+        std::unordered_map<int, Data_Structure::Bus> buses;
+        for (Data_Structure::TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+            std::vector<int> bus_stops;
+            for (auto stop: network.GetBusStops(bus)) {
+                bus_stops.push_back(network.GetStopId(stop));
+            }
+            buses.emplace(network.GetBusId(bus),
+                          Data_Structure::Bus(network.GetBusId(bus), std::move(bus_stops), network.IsRoundtrip(bus)));
+        }
+        return buses;
+    }
+}
 
 Data_Structure::DataBase::DataBase(std::istream &is) {
     Deserialize(is);
@@ -16,8 +49,7 @@ Data_Structure::DataBase::DataBase(const std::vector<DBItem> &elems,
     Init(elems, db_item_id_name_map);
 
     router = std::make_unique<DataBaseRouter>(
-            pure_stops,
-            pure_buses,
+            network,
             routing_settings_,
             db_item_id_name_map
     );
@@ -30,8 +62,7 @@ Data_Structure::DataBase::DataBase(const std::vector<DBItem> &items,
     Init(items, db_item_id_name_map);
 
     router = std::make_unique<DataBaseRouter>(
-            pure_stops,
-            pure_buses,
+            network,
             routing_settings_,
             db_item_id_name_map
     );
@@ -51,8 +82,7 @@ Data_Structure::DataBase::DataBase(const std::vector<DBItem> &items,
     yellow_pages_db = std::make_unique<DataBaseYellowPages>(std::move(yellow_pages));
 
     router = std::make_unique<DataBaseRouter>(
-            pure_stops,
-            pure_buses,
+            network,
             routing_settings_,
             db_item_id_name_map_new
     );
@@ -66,88 +96,133 @@ Data_Structure::DataBase::DataBase(const std::vector<DBItem> &items,
 
 void Data_Structure::DataBase::Init(std::vector<DBItem> const &elems,
                                     DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("DataBase::Init");
+    // buses of each stop sorted by name once, requests only read them
+    std::unordered_map<int, std::vector<std::pair<std::string, int>>> stop_buses;
     for (auto &el: elems) {
         if (std::holds_alternative<Bus>(el)) {
             const auto &bus = std::get<Bus>(el);
-            pure_buses.emplace(bus.bus_id, bus);
-        } else {
+            auto bus_stops = Ranges::AsRange(bus.stops);
+            const auto bus_name = db_item_id_name_map.GetNameById(bus.bus_id);
+            for (auto stop_id: !bus.is_roundtrip ? Ranges::ToMiddle(bus_stops) : bus_stops) {
+                stop_buses[stop_id].emplace_back(bus_name, bus.bus_id);
+            }
+        }
+    }
+    for (auto &el: elems) {
+        if (std::holds_alternative<Stop>(el)) {
             const auto &stop = std::get<Stop>(el);
-            pure_stops.emplace(stop.stop_id, stop);
-            stops.emplace(stop.stop_id, std::make_shared<StopResponse>());
+            network.AddStop(stop.stop_id, stop.dist);
+            for (auto [to_stop_id, meters]: stop.adjacent_stops) {
+                network.AddRoadDistance(to_stop_id, meters);
+            }
+            auto &buses = stop_buses[stop.stop_id];
+            std::sort(buses.begin(), buses.end());
+            buses.erase(std::unique(buses.begin(), buses.end()), buses.end());
+            for (auto &[_, bus_id]: buses) {
+                network.AddStopBus(bus_id);
+            }
         }
     }
-    try {
-        for (auto [bus_id, bus]: pure_buses) {
-            BusRespType bus_resp = std::make_shared<BusResponse>();
-            bus_resp->stop_count = bus.stops.size();
-            bus_resp->unique_stop_count = Ranges::GetUniqueItems(Ranges::AsRange(bus.stops));
-            bus_resp->length = ComputeRouteDistance(bus.stops, pure_stops, db_item_id_name_map);
-            bus_resp->curvature = bus_resp->length / ComputeGeoDistance(bus.stops, pure_stops, db_item_id_name_map);
-            buses.emplace(bus_id, std::move(bus_resp));
-
-            for (auto &el: !bus.is_roundtrip
-                           ? Ranges::ToMiddle(Ranges::AsRange(bus.stops))
-                           : Ranges::AsRange(bus.stops)) {
-                stops[el]->buses.emplace(
-                        db_item_id_name_map.GetNameById(bus.bus_id));
+    for (auto &el: elems) {
+        if (std::holds_alternative<Bus>(el)) {
+            const auto &bus = std::get<Bus>(el);
+            network.AddBus(bus.bus_id, bus.is_roundtrip);
+            for (auto stop_id: bus.stops) {
+                network.AddBusStop(stop_id);
             }
         }
+    }
+    try {
+        network.Finalize();
+
+        bus_names.resize(network.GetBusCount());
+        for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+            bus_names[bus] = db_item_id_name_map.GetNameById(network.GetBusId(bus));
+        }
     } catch (...) {
         std::cout << "The DB condition is violated\n";
     }
+    TRACE_COUNTER("stops", network.GetStopCount());
+    TRACE_COUNTER("buses", network.GetBusCount());
 }
 
 ResponseType Data_Structure::DataBase::FindBus(const std::string &title) const {
-    auto ret = buses.find(db_item_id_name_map->GetIdByName(title));
-    if (ret != buses.end()) {
-        return ret->second;
-    } else return GenerateBad();
+    auto bus = network.GetBusIndex(db_item_id_name_map->GetIdByName(title));
+    if (bus == TransportNetwork::NO_INDEX)
+        return GenerateBad();
+
+    auto ret = std::make_shared<BusResponse>();
+    ret->stop_count = network.GetBusStops(bus).end() - network.GetBusStops(bus).begin();
+    ret->unique_stop_count = network.GetUniqueStopCount(bus);
+    ret->length = network.GetRouteLength(bus);
+    ret->curvature = network.GetCurvature(bus);
+    return ret;
 }
 
 ResponseType Data_Structure::DataBase::FindStop(const std::string &title) const {
-    auto ret = stops.find(db_item_id_name_map->GetIdByName(title));
-    if (ret != stops.end()) {
-        return ret->second;
-    } else return GenerateBad();
+    auto stop = network.GetStopIndex(db_item_id_name_map->GetIdByName(title));
+    if (stop == TransportNetwork::NO_INDEX)
+        return GenerateBad();
+    return std::make_shared<StopResponse>(network.GetStopBuses(stop), bus_names);
 }
 
 ResponseType Data_Structure::DataBase::FindRoute(const std::string &from,
-                                                 const std::string &to) const {
-    auto ret = router->CreateRoute(from, to, *db_item_id_name_map);
+                                                 const std::string &to,
+                                                 std::pmr::memory_resource *resource) const {
+    auto ret = router->CreateRoute(from, to, *db_item_id_name_map, resource);
     if (ret) {
-        auto render_items = ret->items;
-        if (!render_items.empty()) {
-            auto finish = render_items.insert(render_items.end(), std::make_shared<RouteResponse::Wait>());
-            (*finish)->name = to;
-        }
-        ret->route_render = std::move(svg_builder->RenderRoute(render_items, *db_item_id_name_map)->svg_xml_answer);
+        ret->route_render = std::move(svg_builder->RenderRoute(ret->items, to, *db_item_id_name_map)->svg_xml_answer);
 
         return ret;
     } else return GenerateBad();
 }
 
+ResponseType Data_Structure::DataBase::FindRoutes(const std::string &from,
+                                                  const std::string &to,
+                                                  size_t k,
+                                                  std::pmr::memory_resource *resource) const {
+    auto routes = router->CreateRoutes(from, to, k, *db_item_id_name_map, resource);
+    if (routes.empty())
+        return GenerateBad();
+
+    return std::allocate_shared<RoutesResponse>(std::pmr::polymorphic_allocator<RoutesResponse>(resource),
+                                                std::move(routes));
+}
+
+ResponseType Data_Structure::DataBase::FindRouteMatrix(const std::vector<std::string> &from,
+                                                       const std::vector<std::string> &to) const {
+    auto ret = router->CreateRouteMatrix(from, to, *db_item_id_name_map);
+    if (!ret)
+        return GenerateBad();
+    return ret;
+}
+
 ResponseType Data_Structure::DataBase::BuildMap() const {
     if (!svg_builder)
         return GenerateBad();
     return svg_builder->RenderMap();
 }
 
-ResponseType Data_Structure::DataBase::FindCompanies(const std::vector<std::shared_ptr<Query>> &queries) const {
+std::shared_ptr<const Data_Structure::Companies>
+Data_Structure::DataBase::FilterCompanies(const std::vector<std::shared_ptr<Query>> &queries) const {
     if (!yellow_pages_db)
-        return GenerateBad();
-    auto ret = yellow_pages_db->FindCompanies(queries);
-    if (!ret)
+        return nullptr;
+    auto resp = yellow_pages_db->FindCompanies(queries);
+    return std::make_shared<const Companies>(std::move(reinterpret_cast<CompaniesResponse *>(resp.get())->companies));
+}
+
+ResponseType Data_Structure::DataBase::FindCompanies(const std::shared_ptr<const Companies> &companies) const {
+    if (!companies)
         return GenerateBad();
 
-    return ret;
+    return std::make_shared<CompaniesResponse>(*companies);
 }
 
 ResponseType Data_Structure::DataBase::FindRouteToCompanies(const std::string &from, const Datetime &cur_time,
-                                                            const std::vector<std::shared_ptr<Query>> &queries) const {
-    if (!yellow_pages_db)
-        return GenerateBad();
-    auto resp = yellow_pages_db->FindCompanies(queries);
-    if (reinterpret_cast<CompaniesResponse *>(resp.get())->companies.empty())
+                                                            const std::shared_ptr<const Companies> &companies,
+                                                            std::pmr::memory_resource *resource) const {
+    if (!companies || companies->empty())
         return GenerateBad();
 
     double route_time = 0;
@@ -155,7 +230,7 @@ ResponseType Data_Structure::DataBase::FindRouteToCompanies(const std::string &f
     double time_to_wait = 0;
     YellowPages::Company const *company = nullptr;
     std::string nearby_stop;
-    for (auto company_ptr: reinterpret_cast<CompaniesResponse const *>(resp.get())->companies) {
+    for (auto company_ptr: *companies) {
         for (auto &stop: company_ptr->nearby_stops()) {
             auto cur_route_time = router->GetRouteWeight(from, db_item_id_name_map->GetNameById(stop.nearby_stop_id()),
                                                          *db_item_id_name_map);
@@ -183,8 +258,9 @@ ResponseType Data_Structure::DataBase::FindRouteToCompanies(const std::string &f
     if (!company)
         return GenerateBad();
 
-    auto result_resp = std::make_shared<RouteToCompaniesResponse>();
-    auto router_resp = router->CreateRoute(from, nearby_stop, *db_item_id_name_map);
+    auto result_resp = std::allocate_shared<RouteToCompaniesResponse>(
+            std::pmr::polymorphic_allocator<RouteToCompaniesResponse>(resource), resource);
+    auto router_resp = router->CreateRoute(from, nearby_stop, *db_item_id_name_map, resource);
 
     result_resp->total_time = router_resp->total_time + time_from_stop + time_to_wait;
     result_resp->time_to_walk = time_from_stop;
@@ -202,16 +278,10 @@ ResponseType Data_Structure::DataBase::FindRouteToCompanies(const std::string &f
         }
     }
 
-    result_resp->items = router_resp->items;
-    {
-        auto render_items = result_resp->items;
-
-        auto finish = render_items.insert(render_items.end(), std::make_shared<RouteResponse::Wait>());
-        (*finish)->name = nearby_stop;
-
-        result_resp->route_render = std::move(
-                svg_builder->RenderPathToCompany(render_items, full_name, *db_item_id_name_map)->svg_xml_answer);
-    }
+    result_resp->items = std::move(router_resp->items);
+    result_resp->route_render = std::move(
+            svg_builder->RenderPathToCompany(result_resp->items, nearby_stop, full_name,
+                                             *db_item_id_name_map)->svg_xml_answer);
     if (time_to_wait > 0)
         result_resp->time_to_wait.emplace(time_to_wait);
 
@@ -300,40 +370,6 @@ ResponseType Data_Structure::DataBase::GenerateBad() {
     return ret;
 }
 
-int Data_Structure::ComputeStopsDistance(const Data_Structure::Stop &lhs,
-                                         const Data_Structure::Stop &rhs,
-                                         DbItemIdNameMap &db_item_id_name_map) {
-    if (auto it = lhs.adjacent_stops.find(rhs.stop_id); it !=
-                                                        lhs.adjacent_stops.end()) {
-        return it->second;
-    } else {
-        return rhs.adjacent_stops.at(lhs.stop_id);
-    }
-}
-
-int Data_Structure::ComputeRouteDistance(const std::vector<int> &stops,
-                                         const std::unordered_map<int, Stop> &db_stops,
-                                         DbItemIdNameMap &db_item_id_name_map) {
-    int result = 0;
-    for (size_t i = 1; i < stops.size(); i++) {
-        result += ComputeStopsDistance(db_stops.at(stops[i - 1]),
-                                       db_stops.at(stops[i]),
-                                       db_item_id_name_map);
-    }
-    return result;
-}
-
-double Data_Structure::ComputeGeoDistance(const std::vector<int> &stops,
-                                          const std::unordered_map<int, Stop> &db_stops,
-                                          DbItemIdNameMap &db_item_id_name_map) {
-    double result = 0.;
-    for (size_t i = 1; i < stops.size(); i++) {
-        result += ComputeDistance(db_stops.at(stops.at(i - 1)).dist,
-                                  db_stops.at(stops.at(i)).dist);
-    }
-    return result;
-}
-
 std::set<std::string>
 Data_Structure::GetBearingPoints(const std::unordered_map<std::string, stop_n_companies> &stops,
                                  const std::unordered_map<int, Bus> &buses,
@@ -394,40 +430,42 @@ Data_Structure::Datetime Data_Structure::ToDatetime(double minutes, size_t day)
 }
 
 void Data_Structure::DataBase::Serialize(std::ostream &os) const {
+    TRACE_DURATION("DataBase::Serialize");
     TCProto::TransportCatalog tc;
 
-    for (auto &stop: stops) {
+    for (TransportNetwork::Index stop = 0; stop < network.GetStopCount(); stop++) {
         TCProto::Stop dummy_stop;
-        dummy_stop.set_stop_id(stop.first);
-        for (auto &bus_name: stop.second->buses) {
-            dummy_stop.add_buses_id(db_item_id_name_map->GetIdByName(bus_name));
+        dummy_stop.set_stop_id(network.GetStopId(stop));
+        for (auto bus: network.GetStopBuses(stop)) {
+            dummy_stop.add_buses_id(network.GetBusId(bus));
         }
 
-        auto &pure_stop = pure_stops.at(stop.first);
-        dummy_stop.set_latitude(pure_stop.dist.GetLatitude());
-        dummy_stop.set_longitude(pure_stop.dist.GetLongitude());
-        for (auto &el: pure_stop.adjacent_stops) {
+        auto coordinates = network.GetCoordinates(stop);
+        dummy_stop.set_latitude(coordinates.GetLatitude());
+        dummy_stop.set_longitude(coordinates.GetLongitude());
+        size_t i = 0;
+        for (auto adjacent_stop: network.GetAdjacentStops(stop)) {
             TCProto::AdjacentStops as;
-            as.set_stop_id(el.first);
-            as.set_dist(el.second);
+            as.set_stop_id(network.GetStopId(adjacent_stop));
+            as.set_dist(network.GetAdjacentDistance(stop, i++));
             *dummy_stop.add_adjacent_stops() = std::move(as);
         }
 
         *tc.add_stops() = std::move(dummy_stop);
     }
 
-    for (auto &[bus_id, bus]: buses) {
+    for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
         TCProto::Bus dummy_bus;
-        dummy_bus.set_bus_id(bus_id);
-        dummy_bus.set_length(bus->length);
-        dummy_bus.set_curvature(bus->curvature);
-        dummy_bus.set_stop_count(bus->stop_count);
-        dummy_bus.set_unique_stop_count(bus->unique_stop_count);
-
-        auto &pure_bus = pure_buses.at(bus_id);
-        dummy_bus.set_is_roundtrip(pure_bus.is_roundtrip);
-        for (auto &el: pure_bus.stops) {
-            dummy_bus.add_stops_id(el);
+        auto bus_stops = network.GetBusStops(bus);
+        dummy_bus.set_bus_id(network.GetBusId(bus));
+        dummy_bus.set_length(network.GetRouteLength(bus));
+        dummy_bus.set_curvature(network.GetCurvature(bus));
+        dummy_bus.set_stop_count(bus_stops.end() - bus_stops.begin());
+        dummy_bus.set_unique_stop_count(network.GetUniqueStopCount(bus));
+
+        dummy_bus.set_is_roundtrip(network.IsRoundtrip(bus));
+        for (auto stop: bus_stops) {
+            dummy_bus.add_stops_id(network.GetStopId(stop));
         }
 
         *tc.add_buses() = std::move(dummy_bus);
@@ -438,77 +476,88 @@ void Data_Structure::DataBase::Serialize(std::ostream &os) const {
     svg_builder->Serialize(tc);
     db_item_id_name_map->Serialize(tc);
 
+    TRACE_DURATION("DataBase::Serialize protobuf write");
     tc.SerializePartialToOstream(&os);
 }
 
 void Data_Structure::DataBase::Deserialize(std::istream &is) {
-    TCProto::TransportCatalog tc;
-    tc.ParseFromIstream(&is);
+    TRACE_DURATION("DataBase::Deserialize");
+    // The catalog is parsed into an arena that the yellow pages keep alive afterwards:
+    // companies are used in place instead of being copied out of the message.
+    google::protobuf::ArenaOptions arena_options;
+    arena_options.start_block_size = ARENA_START_BLOCK_SIZE;
+    arena_options.max_block_size = ARENA_MAX_BLOCK_SIZE;
+    auto arena = std::make_shared<google::protobuf::Arena>(arena_options);
+    auto &tc = *google::protobuf::Arena::CreateMessage<TCProto::TransportCatalog>(arena.get());
+    {
+        TRACE_DURATION("DataBase::Deserialize protobuf parse");
+        tc.ParseFromIstream(&is);
+    }
 
     db_item_id_name_map = std::make_unique<DbItemIdNameMap>(tc.id_to_name_map());
 
     for (auto &stop: tc.stops()) {
-        std::set<std::string> s_buses;
-        for (auto &bus_id: stop.buses_id()) {
-            s_buses.insert(db_item_id_name_map->GetNameById(bus_id));
-        }
-        StopResponse sr;
-        sr.buses = std::move(s_buses);
-        this->stops.emplace(stop.stop_id(),
-                            std::make_shared<StopResponse>(std::move(sr)));
-
-        Stop pure_stop(stop.stop_id(),
-                       Distance{stop.longitude(), stop.latitude()},
-                       {});
+        network.AddStop(stop.stop_id(), Distance{stop.longitude(), stop.latitude()});
         for (auto &as: stop.adjacent_stops()) {
-            pure_stop.adjacent_stops.emplace(as.stop_id(), as.dist());
+            network.AddRoadDistance(as.stop_id(), as.dist());
+        }
+        // stored sorted by name
+        for (auto bus_id: stop.buses_id()) {
+            network.AddStopBus(bus_id);
         }
-        pure_stops.emplace(stop.stop_id(), pure_stop);
     }
 
+    // bus stats were computed by make_base, they are not recomputed here
     for (auto &bus: tc.buses()) {
-        BusResponse br;
-        br.length = bus.length();
-        br.curvature = bus.curvature();
-        br.stop_count = bus.stop_count();
-        br.unique_stop_count = bus.unique_stop_count();
-        this->buses.emplace(bus.bus_id(),
-                            std::make_shared<BusResponse>(std::move(br)));
-
-        Bus pure_bus(bus.bus_id(),
-                     {},
-                     bus.is_roundtrip());
+        network.AddBus(bus.bus_id(), bus.is_roundtrip());
         for (auto &stop_id: bus.stops_id()) {
-            pure_bus.stops.emplace_back(stop_id);
+            network.AddBusStop(stop_id);
         }
-        pure_buses.emplace(bus.bus_id(), pure_bus);
+        network.SetBusStats(bus.length(), bus.curvature(), bus.unique_stop_count());
+    }
+    try {
+        network.Finalize();
+    } catch (std::out_of_range const &e) {
+        // a base that refers to unknown stops or buses answers no Bus and Stop requests
+        std::cerr << "The serialized DB is inconsistent: " << e.what() << "\n";
+        network = TransportNetwork{};
     }
 
-    yellow_pages_db = std::make_unique<DataBaseYellowPages>(tc.yellow_pages());
+    bus_names.resize(network.GetBusCount());
+    for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+        bus_names[bus] = db_item_id_name_map->GetNameById(network.GetBusId(bus));
+    }
 
     router = std::make_unique<DataBaseRouter>(tc.router(), *db_item_id_name_map);
 
     std::unordered_map<std::string, const YellowPages::Company *> companies_map;
-    for (auto &company: yellow_pages_db->GetOrigin().companies()) {
-        std::string company_name;
-        for (auto &name: company.names()) {
-            if (name.type() == YellowPages::Name_Type_MAIN) {
-                company_name = name.value();
-                break;
+    {
+        TRACE_DURATION("DataBase::Deserialize yellow pages");
+        yellow_pages_db = std::make_unique<DataBaseYellowPages>(tc.yellow_pages(), std::move(arena));
+
+        for (auto &company: yellow_pages_db->GetOrigin().companies()) {
+            std::string company_name;
+            for (auto &name: company.names()) {
+                if (name.type() == YellowPages::Name_Type_MAIN) {
+                    company_name = name.value();
+                    break;
+                }
             }
-        }
-        if (company.has_working_time()) {
-            for (auto &interval: company.working_time().intervals()) {
-                time_database[company_name][static_cast<int>(interval.day()) - 1].add(interval.minutes_from(),
-                                                                                      interval.minutes_to(), &interval);
+            if (company.has_working_time()) {
+                for (auto &interval: company.working_time().intervals()) {
+                    time_database[company_name][static_cast<int>(interval.day()) - 1].add(
+                            interval.minutes_from(), interval.minutes_to(), &interval);
+                }
             }
+            if (!company.rubrics().empty()) {
+                std::string new_name =
+                        yellow_pages_db->GetRubric(company.rubrics(0)).keywords(0) + " " + company_name;
+                company_name = new_name;
+            }
+            companies_map.emplace(company_name, &company);
         }
-        if (!company.rubrics().empty()) {
-            std::string new_name = yellow_pages_db->GetRubric(company.rubrics(0)).keywords(0) + " " + company_name;
-            company_name = new_name;
-        }
-        companies_map.emplace(company_name, &company);
     }
-    svg_builder = std::make_unique<DataBaseSvgBuilder>(tc.render(), pure_stops, pure_buses, companies_map,
-                                                       *db_item_id_name_map);
+
+    svg_builder = std::make_unique<DataBaseSvgBuilder>(tc.render(), MakeStops(network), MakeBuses(network),
+                                                       companies_map, *db_item_id_name_map);
 }
\ No newline at end of file
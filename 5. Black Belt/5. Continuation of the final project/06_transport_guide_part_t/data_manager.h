@@ -2,8 +2,10 @@
 #define DATA_STRUCTURE_H
 
 #include <memory>
+#include <memory_resource>
 #include <string>
 #include <map>
+#include <set>
 #include <vector>
 #include <string>
 #include <variant>
@@ -16,6 +18,7 @@
 #include "db_item_name_id_map.h"
 
 #include "distance.h"
+#include "transport_network.h"
 #include "responses.h"
 
 namespace Data_Structure {
@@ -58,38 +61,28 @@ namespace Data_Structure {
 
     Datetime ToDatetime(double minutes, size_t day);
 
-    int ComputeStopsDistance(const Stop &lhs,
-                             const Stop &rhs,
-                             DbItemIdNameMap &);
-
-    int ComputeRouteDistance(std::vector<int> const &stops,
-                             const std::unordered_map<int, Stop> &,
-                             DbItemIdNameMap &);
-
     double ComputeTimeToWalking(double meters, double walk_speed);
 
-    double ComputeGeoDistance(std::vector<int> const &stops,
-                              const std::unordered_map<int, Stop> &,
-                              DbItemIdNameMap &);
-
     std::set<std::string> GetBearingPoints(const std::unordered_map<std::string, stop_n_companies> &,
                                            const std::unordered_map<int, Bus> &,
                                            DbItemIdNameMap &);
 
     using DBItem = std::variant<Stop, Bus>;
-    using StopRespType = std::shared_ptr<StopResponse>;
     using BusRespType = std::shared_ptr<BusResponse>;
     using MapRespType = std::shared_ptr<MapResponse>;
+    using Companies = std::vector<YellowPages::Company const *>;
 
     using stop_n_companies = std::variant<Stop, YellowPages::Company>;
 
     struct DataBase {
     private:
-        std::unordered_map<int, Bus> pure_buses;
-        std::unordered_map<int, Stop> pure_stops;
+        static constexpr size_t ARENA_START_BLOCK_SIZE = 64 * 1024;
+        static constexpr size_t ARENA_MAX_BLOCK_SIZE = 4 * 1024 * 1024;
+
+        TransportNetwork network;
 
-        std::unordered_map<int, StopRespType> stops;
-        std::unordered_map<int, BusRespType> buses;
+        // by bus index in network
+        std::vector<std::string> bus_names;
 
         std::unique_ptr<DataBaseRouter> router;
         std::unique_ptr<DataBaseSvgBuilder> svg_builder;
@@ -120,14 +113,26 @@ namespace Data_Structure {
 
         [[nodiscard]] ResponseType FindStop(const std::string &title) const;
 
-        [[nodiscard]] ResponseType FindRoute(const std::string &from, const std::string &to) const;
+        [[nodiscard]] ResponseType FindRoute(const std::string &from, const std::string &to,
+                                             std::pmr::memory_resource *resource) const;
+
+        [[nodiscard]] ResponseType FindRoutes(const std::string &from, const std::string &to, size_t k,
+                                              std::pmr::memory_resource *resource) const;
+
+        [[nodiscard]] ResponseType FindRouteMatrix(const std::vector<std::string> &from,
+                                                   const std::vector<std::string> &to) const;
 
         [[nodiscard]] ResponseType BuildMap() const;
 
-        [[nodiscard]] ResponseType FindCompanies(const std::vector<std::shared_ptr<Query>> &queries) const;
+        // nullptr without yellow pages; the result can be shared by requests with the same filter
+        [[nodiscard]] std::shared_ptr<const Companies>
+        FilterCompanies(const std::vector<std::shared_ptr<Query>> &queries) const;
+
+        [[nodiscard]] ResponseType FindCompanies(const std::shared_ptr<const Companies> &companies) const;
 
         [[nodiscard]] ResponseType FindRouteToCompanies(const std::string &from, const Datetime &cur_time,
-                                                        const std::vector<std::shared_ptr<Query>> &queries) const;
+                                                        const std::shared_ptr<const Companies> &companies,
+                                                        std::pmr::memory_resource *resource) const;
 
         RoutingSettings GetSettings() const {
             return router->GetSettings();
@@ -1,7 +1,13 @@
 #include "distance.h"
 
+#include <algorithm>
 #include <cmath>
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define DISTANCE_HAS_AVX2
+#endif
+
 const double EarthRadius = 6'371'000;
 
 double ComputeDistance(const Distance &lhs, const Distance &rhs) {
@@ -10,4 +16,108 @@ double ComputeDistance(const Distance &lhs, const Distance &rhs) {
     return (std::acos(std::sin(lhs_.GetLatitude()) * std::sin(rhs_.GetLatitude()) +
                       std::cos(lhs_.GetLatitude()) * cos(rhs_.GetLatitude()) *
                       cos(std::abs(lhs_.GetLongitude() - rhs_.GetLongitude()))) * EarthRadius);
-}
\ No newline at end of file
+}
+
+void GeoPoints::Add(const Distance &point) {
+    auto radians = point.FromDegrees();
+    sin_latitudes.push_back(std::sin(radians.GetLatitude()));
+    cos_latitudes.push_back(std::cos(radians.GetLatitude()));
+    longitudes.push_back(radians.GetLongitude());
+}
+
+namespace {
+    double ComputeDistance(GeoPoints const &points, uint32_t lhs, uint32_t rhs) {
+        return std::acos(points.sin_latitudes[lhs] * points.sin_latitudes[rhs] +
+                         points.cos_latitudes[lhs] * points.cos_latitudes[rhs] *
+                         std::cos(std::abs(points.longitudes[lhs] - points.longitudes[rhs]))) * EarthRadius;
+    }
+
+#ifdef DISTANCE_HAS_AVX2
+    constexpr size_t BlockPairs = 256;
+
+    // longitude deltas and latitude products of a block of pairs,
+    // the deltas are replaced by their cosines and the sine products by the acos arguments
+    struct PairTerms {
+        alignas(32) double longitude_deltas[BlockPairs];
+        alignas(32) double sin_products[BlockPairs];
+        alignas(32) double cos_products[BlockPairs];
+    };
+
+    // the masked form with a zeroed source: GCC warns about the undefined source of _mm256_i32gather_pd
+    __attribute__((target("avx2")))
+    inline __m256d Gather(double const *values, __m128i ids) {
+        return _mm256_mask_i32gather_pd(_mm256_setzero_pd(), values, ids,
+                                        _mm256_castsi256_pd(_mm256_set1_epi64x(-1)), 8);
+    }
+
+    __attribute__((target("avx2")))
+    void ComputePairTermsAvx2(GeoPoints const &points, uint32_t const *ids, size_t pairs, PairTerms &terms) {
+        const __m256d sign_mask = _mm256_set1_pd(-0.0);
+        for (size_t i = 0; i < pairs; i += 4) {
+            const __m128i lhs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ids + i));
+            const __m128i rhs = _mm_loadu_si128(reinterpret_cast<const __m128i *>(ids + i + 1));
+            const __m256d longitude_delta = _mm256_sub_pd(Gather(points.longitudes.data(), lhs),
+                                                          Gather(points.longitudes.data(), rhs));
+            _mm256_store_pd(terms.longitude_deltas + i, _mm256_andnot_pd(sign_mask, longitude_delta));
+            _mm256_store_pd(terms.sin_products + i,
+                            _mm256_mul_pd(Gather(points.sin_latitudes.data(), lhs),
+                                          Gather(points.sin_latitudes.data(), rhs)));
+            _mm256_store_pd(terms.cos_products + i,
+                            _mm256_mul_pd(Gather(points.cos_latitudes.data(), lhs),
+                                          Gather(points.cos_latitudes.data(), rhs)));
+        }
+    }
+
+    // separate multiply and add, as the scalar expression compiles without FMA
+    __attribute__((target("avx2")))
+    void ComputeAcosArgumentsAvx2(size_t pairs, PairTerms &terms) {
+        for (size_t i = 0; i < pairs; i += 4) {
+            const __m256d product = _mm256_mul_pd(_mm256_load_pd(terms.cos_products + i),
+                                                  _mm256_load_pd(terms.longitude_deltas + i));
+            _mm256_store_pd(terms.sin_products + i, _mm256_add_pd(_mm256_load_pd(terms.sin_products + i), product));
+        }
+    }
+
+    // everything but cos and acos runs four pairs at a time in ComputeDistance's order;
+    // those two stay std:: per pair, a vector approximation would not reproduce ComputeDistance bit for bit.
+    // The libm calls run between the AVX2 passes, not inside them, to avoid AVX-SSE transitions
+    size_t ComputeDistancesAvx2(GeoPoints const &points, uint32_t const *ids, size_t pairs, double *distances) {
+        PairTerms terms;
+        size_t done = 0;
+        while (pairs - done >= 4) {
+            const size_t block = std::min(BlockPairs, (pairs - done) / 4 * 4);
+            ComputePairTermsAvx2(points, ids + done, block, terms);
+            for (size_t i = 0; i < block; i++)
+                terms.longitude_deltas[i] = std::cos(terms.longitude_deltas[i]);
+            ComputeAcosArgumentsAvx2(block, terms);
+            for (size_t i = 0; i < block; i++)
+                distances[done + i] = std::acos(terms.sin_products[i]) * EarthRadius;
+            done += block;
+        }
+        return done;
+    }
+
+    bool HasAvx2() {
+        static const bool has_avx2 = __builtin_cpu_supports("avx2");
+        return has_avx2;
+    }
+#endif
+}
+
+void ComputeDistancesScalar(const GeoPoints &points, const uint32_t *ids, size_t count, double *distances) {
+    for (size_t i = 0; i + 1 < count; i++) {
+        distances[i] = ComputeDistance(points, ids[i], ids[i + 1]);
+    }
+}
+
+void ComputeDistances(const GeoPoints &points, const uint32_t *ids, size_t count, double *distances) {
+    const size_t pairs = count > 0 ? count - 1 : 0;
+    size_t i = 0;
+#ifdef DISTANCE_HAS_AVX2
+    if (HasAvx2())
+        i = ComputeDistancesAvx2(points, ids, pairs, distances);
+#endif
+    for (; i < pairs; i++) {
+        distances[i] = ComputeDistance(points, ids[i], ids[i + 1]);
+    }
+}
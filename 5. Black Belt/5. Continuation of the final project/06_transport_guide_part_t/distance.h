@@ -1,6 +1,10 @@
 #ifndef DISTANCE_H
 #define DISTANCE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 struct Distance {
     static inline const double PI = 3.1415926535;
 
@@ -36,4 +40,22 @@ private:
 
 double ComputeDistance(const Distance &lhs, const Distance &rhs);
 
+// Points converted from degrees once per point, with the sine and cosine of the latitude
+// that ComputeDistance would otherwise recompute for every pair.
+struct GeoPoints {
+    void Add(Distance const &point);
+
+    [[nodiscard]] size_t Size() const { return longitudes.size(); }
+
+    std::vector<double> sin_latitudes, cos_latitudes, longitudes;
+};
+
+// distances[i] = ComputeDistance(points[ids[i]], points[ids[i + 1]]) for i + 1 < count,
+// bit for bit: the same formula runs on the same operands, only the per-point terms are shared.
+// Uses AVX2 for four pairs at a time when the CPU supports it.
+void ComputeDistances(GeoPoints const &points, uint32_t const *ids, size_t count, double *distances);
+
+// the same without SIMD
+void ComputeDistancesScalar(GeoPoints const &points, uint32_t const *ids, size_t count, double *distances);
+
 #endif //DISTANCE_H
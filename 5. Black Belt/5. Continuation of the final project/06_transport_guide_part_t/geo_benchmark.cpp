@@ -0,0 +1,103 @@
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <vector>
+
+#include "distance.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+    double MillisecondsSince(steady_clock::time_point start) {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+
+    size_t CountMismatches(vector<double> const &expected, vector<double> const &actual) {
+        size_t mismatches = 0;
+        for (size_t i = 0; i < expected.size(); i++) {
+            mismatches += memcmp(&expected[i], &actual[i], sizeof(double)) != 0;
+        }
+        return mismatches;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    size_t stop_count = 10000;
+    size_t route_length = 1000000;
+    size_t iterations = 20;
+    for (int i = 1; i < argc; i++) {
+        const string_view arg(argv[i]);
+        const auto eq = arg.find('=');
+        const string key(arg.substr(0, eq));
+        const string value(eq == string_view::npos ? "" : arg.substr(eq + 1));
+        if (key == "stops") {
+            stop_count = stoul(value);
+        } else if (key == "route_length") {
+            route_length = stoul(value);
+        } else if (key == "iterations") {
+            iterations = stoul(value);
+        } else {
+            cerr << "Usage: transport_guide_geo_benchmark [stops=N] [route_length=N] [iterations=N]\n";
+            return 5;
+        }
+    }
+
+    mt19937 rnd(42);
+    uniform_real_distribution<double> latitude(55.5, 55.9);
+    uniform_real_distribution<double> longitude(37.3, 37.9);
+    vector<Distance> stops;
+    GeoPoints points;
+    for (size_t i = 0; i < stop_count; i++) {
+        stops.emplace_back(longitude(rnd), latitude(rnd));
+        points.Add(stops.back());
+    }
+    uniform_int_distribution<uint32_t> stop_id(0, stop_count - 1);
+    // ComputeDistance of a stop to itself is rounding noise, so a route never stays at a stop
+    vector<uint32_t> route(route_length);
+    for (size_t i = 0; i < route.size(); i++) {
+        do {
+            route[i] = stop_id(rnd);
+        } while (i > 0 && route[i] == route[i - 1]);
+    }
+
+    vector<double> expected(route_length - 1);
+    vector<double> scalar(route_length - 1);
+    vector<double> batch(route_length - 1);
+
+    auto start = steady_clock::now();
+    for (size_t it = 0; it < iterations; it++) {
+        for (size_t i = 0; i + 1 < route_length; i++) {
+            expected[i] = ComputeDistance(stops[route[i]], stops[route[i + 1]]);
+        }
+    }
+    const double pairwise_ms = MillisecondsSince(start) / iterations;
+
+    start = steady_clock::now();
+    for (size_t it = 0; it < iterations; it++) {
+        ComputeDistancesScalar(points, route.data(), route.size(), scalar.data());
+    }
+    const double scalar_ms = MillisecondsSince(start) / iterations;
+
+    start = steady_clock::now();
+    for (size_t it = 0; it < iterations; it++) {
+        ComputeDistances(points, route.data(), route.size(), batch.data());
+    }
+    const double batch_ms = MillisecondsSince(start) / iterations;
+
+    cout << "stops=" << stop_count << " pairs=" << route_length - 1 << "\n";
+    cout << fixed << setprecision(3);
+    cout << "ComputeDistance pairwise: " << pairwise_ms << " ms\n";
+    cout << "ComputeDistancesScalar:   " << scalar_ms << " ms\n";
+    cout << "ComputeDistances:         " << batch_ms << " ms\n";
+    // curvature is printed from these distances, so the batch has to match ComputeDistance exactly
+    const size_t scalar_mismatches = CountMismatches(expected, scalar);
+    const size_t batch_mismatches = CountMismatches(expected, batch);
+    cout << "distances differing from ComputeDistance: scalar " << scalar_mismatches
+         << ", batch " << batch_mismatches << "\n";
+
+    return scalar_mismatches != 0 || batch_mismatches != 0;
+}
@@ -76,7 +76,7 @@ namespace Graph {
 
     template<typename Weight>
     DirectedWeightedGraph<Weight>::DirectedWeightedGraph(const RouterProto::Router &router_mes) : incidence_lists(
-            router_mes.vertexes().size() * 2) {
+            router_mes.vertex_count() ? router_mes.vertex_count() : router_mes.vertexes().size() * 2) {
         for (auto &edge: router_mes.edges()) {
             this->edges.emplace_back(Edge<Weight>{edge.vert_id_from(), edge.vert_id_to(), edge.weight()});
             this->incidence_lists[edge.vert_id_from()].push_back(edge.id());
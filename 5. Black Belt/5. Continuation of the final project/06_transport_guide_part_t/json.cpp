@@ -1,7 +1,7 @@
 #include "json.h"
 
 Json::Node Json::Deserializer::LoadNode(std::istream &input) {
-    char c;
+    char c{};
     input >> c;
     if (c == '{') {
         return Json::Deserializer::LoadMap(input);
@@ -10,6 +10,7 @@
 #include <iomanip>
 
 #include "xml.h"
+#include "trace.h"
 
 namespace Json {
     template<typename T>
@@ -104,6 +105,7 @@ namespace Json {
     }
 
     inline Document Load(std::istream &input) {
+        TRACE_DURATION("Json::Load");
         return std::move(Document{Deserializer::LoadNode(input)});
     }
 
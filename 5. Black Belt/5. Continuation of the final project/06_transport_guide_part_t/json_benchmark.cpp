@@ -0,0 +1,186 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string_view>
+
+#include "json.h"
+#include "svg.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+    struct DocumentSettings {
+        size_t stop_count = 5000;
+        size_t depth = 1000;
+        size_t string_count = 200;
+        size_t string_length = 50000;
+        size_t svg_shapes = 20000;
+    };
+
+    double MillisecondsSince(steady_clock::time_point start) {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+
+    double MegabytesPerSecond(size_t bytes, double ms) {
+        return static_cast<double>(bytes) / 1000 / ms;
+    }
+
+    string Serialize(Json::Node const &node) {
+        ostringstream out;
+        visit([&out](auto const &arg) {
+            Json::Serializer::Serialize<decay_t<decltype(arg)>>(arg, out);
+        }, node.GetOrigin());
+        return out.str();
+    }
+
+    // base_requests of a city: a long array of stop dicts with nested road_distances
+    Json::Node MakeRequests(DocumentSettings const &settings, mt19937 &rnd) {
+        uniform_int_distribution<int> coord(0, 9999);
+        uniform_int_distribution<size_t> stop_id(0, settings.stop_count - 1);
+        uniform_int_distribution<int> meters(100, 5000);
+
+        vector<Json::Node> stops;
+        for (size_t i = 0; i < settings.stop_count; i++) {
+            map<string, Json::Node> road_distances;
+            for (size_t j = 0; j < 4; j++) {
+                road_distances.emplace("Stop " + to_string(stop_id(rnd)), meters(rnd));
+            }
+            map<string, Json::Node> stop;
+            stop.emplace("type", string("Stop"));
+            stop.emplace("name", "Stop " + to_string(i));
+            stop.emplace("latitude", 55.5 + coord(rnd) / 25000.);
+            stop.emplace("longitude", 37.3 + coord(rnd) / 25000.);
+            stop.emplace("road_distances", std::move(road_distances));
+            stops.emplace_back(std::move(stop));
+        }
+        return map<string, Json::Node>{{"base_requests", std::move(stops)}};
+    }
+
+    Json::Node MakeNested(DocumentSettings const &settings) {
+        Json::Node node = 1;
+        for (size_t i = 0; i < settings.depth; i++) {
+            if (i % 2) {
+                vector<Json::Node> array;
+                array.push_back(std::move(node));
+                array.emplace_back(2.5);
+                node = std::move(array);
+            } else {
+                map<string, Json::Node> dict;
+                dict.emplace("id", static_cast<int>(i));
+                dict.emplace("next", std::move(node));
+                node = std::move(dict);
+            }
+        }
+        return node;
+    }
+
+    // the loader doesn't unescape, so strings stay free of quotes and backslashes
+    Json::Node MakeLongStrings(DocumentSettings const &settings, mt19937 &rnd) {
+        uniform_int_distribution<int> letter('a', 'z');
+        vector<Json::Node> strings;
+        for (size_t i = 0; i < settings.string_count; i++) {
+            string str(settings.string_length, ' ');
+            for (auto &c: str) {
+                c = static_cast<char>(letter(rnd));
+            }
+            strings.emplace_back(std::move(str));
+        }
+        return strings;
+    }
+
+    // a Map response, the svg goes through XML::Serializer inside the json string
+    Json::Node MakeMapResponse(DocumentSettings const &settings, mt19937 &rnd) {
+        uniform_real_distribution<double> coord(50, 1450);
+        Svg::Document doc;
+        for (size_t i = 0; i < settings.svg_shapes; i++) {
+            const Svg::Point point{coord(rnd), coord(rnd)};
+            if (i % 4 == 0) {
+                doc.Add(Svg::Polyline{}.SetStrokeColor("green").SetStrokeWidth(14).AddPoint(point)
+                                .AddPoint({coord(rnd), coord(rnd)}).AddPoint({coord(rnd), coord(rnd)}));
+            } else if (i % 4 == 1) {
+                doc.Add(Svg::Circle{}.SetFillColor("white").SetRadius(3).SetCenter(point));
+            } else {
+                doc.Add(Svg::Text{}.SetPoint(point).SetOffset({7, -3}).SetFontSize(13)
+                                .SetFontFamily("Verdana").SetFillColor("black").SetData("Stop " + to_string(i)));
+            }
+        }
+        return map<string, Json::Node>{{"request_id", 1}, {"map", doc.MakeXml()}};
+    }
+
+    // returns false if the document doesn't survive a load/serialize round trip
+    bool Run(string const &name, Json::Node const &node, bool parse, size_t iterations) {
+        const auto text = Serialize(node);
+
+        size_t total_size = 0;
+        auto start = steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            total_size += Serialize(node).size();
+        }
+        const double serialize_ms = MillisecondsSince(start) / iterations;
+
+        cout << left << setw(14) << name << right << setw(12) << text.size() << setw(16)
+             << MegabytesPerSecond(text.size(), serialize_ms);
+        if (!parse) {
+            cout << setw(16) << "-" << "\n";
+            return total_size != 0;
+        }
+
+        start = steady_clock::now();
+        for (size_t i = 0; i < iterations; i++) {
+            istringstream in(text);
+            total_size += Json::Load(in).GetRoot().index();
+        }
+        const double parse_ms = MillisecondsSince(start) / iterations;
+        cout << setw(16) << MegabytesPerSecond(text.size(), parse_ms) << "\n";
+
+        istringstream in(text);
+        if (Serialize(Json::Load(in).GetRoot()) != text) {
+            cerr << name << ": serialized document differs after Json::Load\n";
+            return false;
+        }
+        return total_size != 0;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    DocumentSettings settings;
+    size_t iterations = 10;
+    for (int i = 1; i < argc; i++) {
+        const string_view arg(argv[i]);
+        const auto eq = arg.find('=');
+        const string key(arg.substr(0, eq));
+        const string value(eq == string_view::npos ? "" : arg.substr(eq + 1));
+        if (key == "stops") {
+            settings.stop_count = stoul(value);
+        } else if (key == "depth") {
+            settings.depth = stoul(value);
+        } else if (key == "strings") {
+            settings.string_count = stoul(value);
+        } else if (key == "string_length") {
+            settings.string_length = stoul(value);
+        } else if (key == "svg_shapes") {
+            settings.svg_shapes = stoul(value);
+        } else if (key == "iterations") {
+            iterations = stoul(value);
+        } else {
+            cerr << "Usage: transport_guide_json_benchmark [stops=N] [depth=N] [strings=N] [string_length=N]\n"
+                 << "                                      [svg_shapes=N] [iterations=N]\n";
+            return 5;
+        }
+    }
+
+    mt19937 rnd(42);
+    cout << fixed << setprecision(1);
+    cout << left << setw(14) << "document" << right << setw(12) << "bytes" << setw(16) << "serialize, MB/s"
+         << setw(16) << "parse, MB/s" << "\n";
+
+    bool ok = Run("requests", MakeRequests(settings, rnd), true, iterations);
+    ok = Run("nested", MakeNested(settings), true, iterations) && ok;
+    ok = Run("long_strings", MakeLongStrings(settings, rnd), true, iterations) && ok;
+    ok = Run("svg_map", MakeMapResponse(settings, rnd), false, iterations) && ok;
+
+    return !ok;
+}
@@ -0,0 +1,37 @@
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+#include "json.h"
+
+namespace {
+    std::string Serialize(Json::Node const &node) {
+        std::ostringstream out;
+        std::visit([&out](auto const &arg) {
+            Json::Serializer::Serialize<std::decay_t<decltype(arg)>>(arg, out);
+        }, node.GetOrigin());
+        return out.str();
+    }
+}
+
+// any input must load and serialize back without crashes or sanitizer reports
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    std::istringstream in(std::string(reinterpret_cast<const char *>(data), size));
+    Serialize(Json::Load(in).GetRoot());
+    return 0;
+}
+
+#ifndef TRANSPORT_GUIDE_LIBFUZZER
+// without libFuzzer the target replays the given corpus files
+int main(int argc, const char *argv[]) {
+    for (int i = 1; i < argc; i++) {
+        std::ifstream file(argv[i], std::ios::binary);
+        const std::string input{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+        LLVMFuzzerTestOneInput(reinterpret_cast<const uint8_t *>(input.data()), input.size());
+    }
+    return 0;
+}
+#endif
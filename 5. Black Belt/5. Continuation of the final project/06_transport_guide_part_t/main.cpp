@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <optional>
 #include <string_view>
 
 #include "requests.h"
@@ -49,11 +50,24 @@ int main(int argc, const char *argv[]) {
         const DS::DataBase db(inp);
         inp.close();
 
-        PrintResponses(
-                ReadStatRequests(db, input_map["stat_requests"], *db.db_item_id_name_map),
-                std::cout
-        );
+        ResponseCache cache;
+        auto const *stat_requests = &input_map["stat_requests"];
+        auto responses = ReadStatRequests(db, *stat_requests, *db.db_item_id_name_map, cache);
+        PrintResponses(responses, std::cout);
         std::cout << std::endl;
+
+        // further documents in the input are more batches for the same base,
+        // a request repeated from an earlier batch is answered from the cache.
+        // Printed responses are moved into the cache only when another batch follows
+        std::optional<Json::Document> batch;
+        while ((std::cin >> std::ws) && std::cin.peek() != EOF) {
+            CacheStatResponses(*stat_requests, std::move(responses), cache);
+            batch = Json::Load(std::cin);
+            stat_requests = &batch->GetRoot()["stat_requests"];
+            responses = ReadStatRequests(db, *stat_requests, *db.db_item_id_name_map, cache);
+            PrintResponses(responses, std::cout);
+            std::cout << std::endl;
+        }
     }
 
     return 0;
@@ -0,0 +1,51 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace Parallel {
+    // Number of contiguous chunks [0, count) is split into: one per hardware thread,
+    // but no chunk is shorter than min_chunk_size, so small inputs stay on one thread.
+    inline size_t GetChunkCount(size_t count, size_t min_chunk_size) {
+        const size_t threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        return std::max<size_t>(std::min(threads, count / std::max<size_t>(min_chunk_size, 1)), 1);
+    }
+
+    // Runs f(chunk, begin, end) for each of GetChunkCount chunks, chunk 0 on the calling thread.
+    // Chunks are ordered, so per-chunk buffers concatenated by chunk id give the serial order.
+    // The first exception thrown by a chunk is rethrown once all chunks are finished.
+    template<typename F>
+    void ForChunks(size_t count, size_t min_chunk_size, F f) {
+        const size_t chunk_count = GetChunkCount(count, min_chunk_size);
+        const size_t chunk_size = (count + chunk_count - 1) / chunk_count;
+
+        std::vector<std::future<void>> futures;
+        for (size_t chunk = 1; chunk < chunk_count; chunk++) {
+            const size_t begin = std::min(count, chunk * chunk_size);
+            const size_t end = std::min(count, begin + chunk_size);
+            futures.push_back(std::async(std::launch::async, [&f, chunk, begin, end] { f(chunk, begin, end); }));
+        }
+
+        std::exception_ptr error;
+        try {
+            f(size_t{0}, size_t{0}, std::min(count, chunk_size));
+        } catch (...) {
+            error = std::current_exception();
+        }
+        for (auto &future: futures) {
+            try {
+                future.get();
+            } catch (...) {
+                if (!error)
+                    error = std::current_exception();
+            }
+        }
+        if (error)
+            std::rethrow_exception(error);
+    }
+}
+
+#endif //PARALLEL_H
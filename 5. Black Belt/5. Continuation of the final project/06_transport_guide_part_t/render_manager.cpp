@@ -1,5 +1,6 @@
 #include "render_manager.h"
 #include "data_manager.h"
+#include "trace.h"
 
 #include <cmath>
 #include <memory>
@@ -10,7 +11,7 @@ Data_Structure::MapRespType Data_Structure::DataBaseSvgBuilder::RenderMap() cons
     return MapResp;
 }
 
-Svg::Document Data_Structure::DataBaseSvgBuilder::GenerateRouteSVG(std::vector<RouteResponse::ItemPtr> const &items) {
+Svg::Document Data_Structure::DataBaseSvgBuilder::GenerateRouteSVG(RouteResponse::Items const &items) {
     Svg::Document route_doc(doc);
 
     Svg::Rect rect;
@@ -25,21 +26,23 @@ Svg::Document Data_Structure::DataBaseSvgBuilder::GenerateRouteSVG(std::vector<R
 }
 
 Data_Structure::MapRespType
-Data_Structure::DataBaseSvgBuilder::RenderRoute(std::vector<RouteResponse::ItemPtr> const &items,
+Data_Structure::DataBaseSvgBuilder::RenderRoute(RouteResponse::Items const &items,
+                                                std::string const &finish_stop,
                                                 DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("DataBaseSvgBuilder::RenderRoute");
     Svg::Document route_doc = GenerateRouteSVG(items);
 
     if (!items.empty()) {
         std::vector<std::string> route_coords;
         std::vector<std::pair<int, size_t>> used_bus;
         for (auto &item: items) {
-            if (item->type == RouteResponse::Item::ItemType::WAIT)
-                route_coords.push_back(item->name);
+            if (item.type == RouteResponse::Item::ItemType::WAIT)
+                route_coords.emplace_back(item.name);
             else
                 used_bus.emplace_back(
-                        std::pair{db_item_id_name_map.GetIdByName(item->name),
-                                  reinterpret_cast<RouteResponse::Bus *>(item.get())->span_count});
+                        std::pair{db_item_id_name_map.GetIdByName(std::string(item.name)), item.span_count});
         }
+        route_coords.push_back(finish_stop);
         for (const auto &layer: renderSettings.layers) {
             if (layersStrategy.count(layer))
                 (layersStrategy[layer])->DrawPartial(route_coords, used_bus, route_doc, db_item_id_name_map);
@@ -53,30 +56,30 @@ Data_Structure::DataBaseSvgBuilder::RenderRoute(std::vector<RouteResponse::ItemP
 }
 
 Data_Structure::MapRespType
-Data_Structure::DataBaseSvgBuilder::RenderPathToCompany(std::vector<RouteResponse::ItemPtr> const &items,
+Data_Structure::DataBaseSvgBuilder::RenderPathToCompany(RouteResponse::Items const &items,
+                                                        const std::string &finish_stop,
                                                         const std::string &company,
                                                         DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("DataBaseSvgBuilder::RenderPathToCompany");
     Svg::Document route_doc = GenerateRouteSVG(items);
 
-    if (!items.empty()) {
-        std::vector<std::string> route_coords;
-        std::vector<std::pair<int, size_t>> used_bus;
-        for (auto &item: items) {
-            if (item->type == RouteResponse::Item::ItemType::WAIT)
-                route_coords.push_back(item->name);
-            else
-                used_bus.emplace_back(
-                        std::pair{db_item_id_name_map.GetIdByName(item->name),
-                                  reinterpret_cast<RouteResponse::Bus *>(item.get())->span_count});
-        }
-        for (const auto &layer: renderSettings.layers) {
-            if (layer.find("company") != std::string::npos)
-                (CompanyRouteLayersStrategy[layer])->DrawPartial(items.back()->name, company, route_doc,
-                                                                 db_item_id_name_map);
-            else
-                (CompanyRouteLayersStrategy[layer])->DrawPartial(route_coords, used_bus, route_doc,
-                                                                 db_item_id_name_map);
-        }
+    std::vector<std::string> route_coords;
+    std::vector<std::pair<int, size_t>> used_bus;
+    for (auto &item: items) {
+        if (item.type == RouteResponse::Item::ItemType::WAIT)
+            route_coords.emplace_back(item.name);
+        else
+            used_bus.emplace_back(
+                    std::pair{db_item_id_name_map.GetIdByName(std::string(item.name)), item.span_count});
+    }
+    route_coords.push_back(finish_stop);
+    for (const auto &layer: renderSettings.layers) {
+        if (layer.find("company") != std::string::npos)
+            (CompanyRouteLayersStrategy[layer])->DrawPartial(finish_stop, company, route_doc,
+                                                             db_item_id_name_map);
+        else
+            (CompanyRouteLayersStrategy[layer])->DrawPartial(route_coords, used_bus, route_doc,
+                                                             db_item_id_name_map);
     }
 
     route_doc.SimpleRender();
@@ -93,6 +96,7 @@ Data_Structure::DataBaseSvgBuilder::DataBaseSvgBuilder(const RenderProto::Render
                                                        const std::unordered_map<int, Bus> &buses,
                                                        const std::unordered_map<std::string, const YellowPages::Company *> &companies,
                                                        DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("DataBaseSvgBuilder layout");
     std::unordered_map<std::string, stop_n_companies> points;
     for (auto &stop: stops)
         points.emplace(std::piecewise_construct, std::forward_as_tuple(db_item_id_name_map.GetNameById(stop.first)),
@@ -170,11 +170,13 @@ namespace Data_Structure {
 
         [[nodiscard]] MapRespType RenderMap() const;
 
-        [[nodiscard]] MapRespType RenderRoute(std::vector<RouteResponse::ItemPtr> const &,
+        [[nodiscard]] MapRespType RenderRoute(RouteResponse::Items const &,
+                                              std::string const &finish_stop,
                                               DbItemIdNameMap &dbItemIdNameMap);
 
         [[nodiscard]] MapRespType
-        RenderPathToCompany(std::vector<RouteResponse::ItemPtr> const &items,
+        RenderPathToCompany(RouteResponse::Items const &items,
+                            std::string const &finish_stop,
                             std::string const &company,
                             DbItemIdNameMap &db_item_id_name_map);
 
@@ -233,7 +235,7 @@ namespace Data_Structure {
 
         void Deserialize(const RenderProto::RenderSettings &);
 
-        Svg::Document GenerateRouteSVG(std::vector<RouteResponse::ItemPtr> const &);
+        Svg::Document GenerateRouteSVG(RouteResponse::Items const &);
     };
 }
 
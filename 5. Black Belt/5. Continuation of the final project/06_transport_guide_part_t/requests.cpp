@@ -1,8 +1,15 @@
 #include "requests.h"
 #include "db_item_name_id_map.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <unordered_map>
 
 std::vector<DS::DBItem> ReadBaseRequests(const Json::Node &input,
                                          DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("ReadBaseRequests");
     std::vector<DS::DBItem> elements;
     RequestType req_handler;
     for (auto const &el: input.AsArray()) {
@@ -14,25 +21,108 @@ std::vector<DS::DBItem> ReadBaseRequests(const Json::Node &input,
 }
 
 DS::RoutingSettings ReadRoutingSettings(const Json::Node &input) {
-    return {static_cast<double>(input["bus_wait_time"].AsNumber<int>()), input["bus_velocity"].AsNumber<int>(),
-            static_cast<double>(input["pedestrian_velocity"].AsNumber<int>())};
+    DS::RoutingSettings settings{static_cast<double>(input["bus_wait_time"].AsNumber<int>()),
+                                 input["bus_velocity"].AsNumber<int>(),
+                                 static_cast<double>(input["pedestrian_velocity"].AsNumber<int>())};
+    if (input.AsMap().count("on_board_vertices"))
+        settings.on_board_vertices = input["on_board_vertices"].AsBool();
+    return settings;
+}
+
+namespace {
+    struct PlannedRequest {
+        IRequest::Type type;
+        RequestType handler;
+        size_t index;
+
+        [[nodiscard]] ExecuteRequest &Get() const {
+            return *reinterpret_cast<ExecuteRequest *>(handler.get());
+        }
+    };
 }
 
 std::vector<JsonResponse> ReadStatRequests(const DS::DataBase &db,
                                            const Json::Node &input,
-                                           DbItemIdNameMap &db_item_id_name_map) {
-    std::vector<JsonResponse> responses;
-    RequestType req_handler;
-    for (auto const &el: input.AsArray()) {
-        req_handler = CreateRequest(ExecuteRequest::AsType.at(el["type"].AsString()));
-        req_handler->ParseFrom(el);
-        responses.emplace_back(reinterpret_cast<ExecuteRequest *>(req_handler.get())->Process(db, db_item_id_name_map));
+                                           DbItemIdNameMap &db_item_id_name_map,
+                                           ResponseCache &cache) {
+    TRACE_DURATION("ReadStatRequests");
+    // only read by TRACE_COUNTER, which is empty when tracing is off
+    [[maybe_unused]] const size_t hits = cache.GetHits();
+    [[maybe_unused]] const size_t misses = cache.GetMisses();
+
+    auto const &requests = input.AsArray();
+    std::vector<JsonResponse> responses(requests.size());
+    std::vector<std::string> keys(requests.size());
+    // a request repeated within the batch is answered by its first occurrence
+    std::vector<size_t> answered_by(requests.size());
+    std::unordered_map<std::string_view, size_t> first_by_key;
+    std::vector<PlannedRequest> planned;
+    for (size_t i = 0; i < requests.size(); i++) {
+        auto const &el = requests[i];
+        keys[i] = ResponseCache::MakeKey(el);
+        answered_by[i] = i;
+        if (auto it = first_by_key.find(keys[i]); it != first_by_key.end()) {
+            answered_by[i] = it->second;
+            continue;
+        }
+        if (auto cached = cache.Find(keys[i], el["id"].AsNumber<int>())) {
+            responses[i] = std::move(*cached);
+            continue;
+        }
+        first_by_key.emplace(keys[i], i);
+
+        const auto type = ExecuteRequest::AsType.at(el["type"].AsString());
+        planned.push_back({type, CreateRequest(type), i});
+        planned.back().handler->ParseFrom(el);
+    }
+
+    // requests of one type sharing a stop or a company filter run back to back,
+    // each distinct filter is evaluated once and its companies are shared
+    std::stable_sort(planned.begin(), planned.end(), [](PlannedRequest const &lhs, PlannedRequest const &rhs) {
+        return std::make_pair(lhs.type, lhs.Get().GetBatchKey()) < std::make_pair(rhs.type, rhs.Get().GetBatchKey());
+    });
+    std::unordered_map<std::string, std::shared_ptr<const DS::Companies>> companies_by_filter;
+    for (auto &request: planned) {
+        TRACE_LATENCY("request " + requests[request.index]["type"].AsString());
+        if (request.type == IRequest::Type::FIND_COMPANIES || request.type == IRequest::Type::FIND_ROUTE_COMPANY) {
+            auto &companies_request = static_cast<FindCompaniesRequest &>(request.Get());
+            auto &companies = companies_by_filter[companies_request.GetFilterKey()];
+            if (companies)
+                companies_request.SetCompanies(companies);
+            else
+                companies = companies_request.FilterCompanies(db);
+        }
+        responses[request.index] = request.Get().Process(db, db_item_id_name_map);
+        request.handler.reset();
     }
 
-    return std::move(responses);
+    size_t repeated = 0;
+    for (size_t i = 0; i < requests.size(); i++) {
+        if (answered_by[i] != i) {
+            responses[i] = responses[answered_by[i]];
+            std::get<Response::Dict>(responses[i])["request_id"] = requests[i]["id"].AsNumber<int>();
+            ++repeated;
+        }
+    }
+    TRACE_COUNTER("response cache hits", cache.GetHits() - hits);
+    TRACE_COUNTER("response cache misses", cache.GetMisses() - misses);
+    TRACE_COUNTER("response cache bytes", cache.GetSizeBytes());
+    TRACE_COUNTER("repeated requests in batch", repeated);
+    TRACE_COUNTER("distinct company filters", companies_by_filter.size());
+
+    return responses;
+}
+
+void CacheStatResponses(const Json::Node &input, std::vector<JsonResponse> responses, ResponseCache &cache) {
+    TRACE_DURATION("CacheStatResponses");
+    auto const &requests = input.AsArray();
+    for (size_t i = 0; i < requests.size(); i++) {
+        cache.Insert(ResponseCache::MakeKey(requests[i]), std::move(responses[i]));
+    }
 }
 
 YellowPages::Database ReadYellowPagesData(const Json::Node &input, DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("ReadYellowPagesData");
     YellowPages::Database db;
 
     for (auto &rubric: input["rubrics"].AsMap()) {
@@ -279,7 +369,17 @@ JsonResponse FindStopRequest::Process(const DS::DataBase &db,
 
 JsonResponse FindRouteRequest::Process(const DS::DataBase &db,
                                        DbItemIdNameMap &db_item_id_name_map) {
-    return ProcessResponse(&DS::DataBase::FindRoute, std::ref(db), std::ref(from), std::ref(to));
+    return ProcessResponse(&DS::DataBase::FindRoute, std::ref(db), std::ref(from), std::ref(to), &arena);
+}
+
+JsonResponse FindRoutesRequest::Process(const DS::DataBase &db,
+                                        DbItemIdNameMap &db_item_id_name_map) {
+    return ProcessResponse(&DS::DataBase::FindRoutes, std::ref(db), std::ref(from), std::ref(to), k, &arena);
+}
+
+JsonResponse FindRouteMatrixRequest::Process(const DS::DataBase &db,
+                                             DbItemIdNameMap &db_item_id_name_map) {
+    return ProcessResponse(&DS::DataBase::FindRouteMatrix, std::ref(db), std::ref(from), std::ref(to));
 }
 
 JsonResponse MapRouteRequest::Process(const DS::DataBase &db,
@@ -287,15 +387,37 @@ JsonResponse MapRouteRequest::Process(const DS::DataBase &db,
     return ProcessResponse(&DS::DataBase::BuildMap, std::ref(db));
 }
 
+std::string FindCompaniesRequest::MakeFilterKey(const Json::Node &json_node) {
+    std::map<std::string, Json::Node> filter;
+    for (auto key: {"rubrics", "phones", "urls", "names"}) {
+        auto it = json_node.AsMap().find(key);
+        if (it != json_node.AsMap().end())
+            filter.emplace(*it);
+    }
+
+    std::ostringstream key;
+    key.precision(std::numeric_limits<double>::max_digits10);
+    Json::Serializer::Serialize(filter, key);
+    return key.str();
+}
+
+std::shared_ptr<const DS::Companies> const &FindCompaniesRequest::FilterCompanies(const DS::DataBase &db) {
+    if (!companies)
+        companies = db.FilterCompanies(queries);
+    return companies;
+}
+
 JsonResponse FindCompaniesRequest::Process(const DS::DataBase &db,
                                            DbItemIdNameMap &db_item_id_name_map) {
-    return ProcessResponse(&DS::DataBase::FindCompanies, std::ref(db), std::ref(queries));
+    FilterCompanies(db);
+    return ProcessResponse(&DS::DataBase::FindCompanies, std::ref(db), std::cref(companies));
 }
 
 JsonResponse FindRouteToCompaniesRequest::Process(const DS::DataBase &db,
                                                   DbItemIdNameMap &db_item_id_name_map) {
+    FilterCompanies(db);
     return ProcessResponse(&DS::DataBase::FindRouteToCompanies, std::ref(db), std::ref(from), std::ref(datetime),
-                           std::ref(queries));
+                           std::cref(companies), &arena);
 }
 
 RequestType CreateRequest(IRequest::Type type) {
@@ -310,6 +432,10 @@ RequestType CreateRequest(IRequest::Type type) {
             return std::make_unique<FindStopRequest>();
         case IRequest::Type::FIND_ROUTE:
             return std::make_unique<FindRouteRequest>();
+        case IRequest::Type::FIND_ROUTES:
+            return std::make_unique<FindRoutesRequest>();
+        case IRequest::Type::FIND_ROUTE_MATRIX:
+            return std::make_unique<FindRouteMatrixRequest>();
         case IRequest::Type::BUILD_MAP:
             return std::make_unique<MapRouteRequest>();
         case IRequest::Type::FIND_COMPANIES:
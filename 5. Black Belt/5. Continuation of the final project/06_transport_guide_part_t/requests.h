@@ -5,7 +5,9 @@
 
 #include "json.h"
 #include "data_manager.h"
+#include "response_cache.h"
 #include <functional>
+#include <memory_resource>
 
 namespace DS = Data_Structure;
 using RequestType = std::unique_ptr<struct IRequest>;
@@ -18,6 +20,8 @@ public:
         FIND_STOP,
         FIND_BUS,
         FIND_ROUTE,
+        FIND_ROUTES,
+        FIND_ROUTE_MATRIX,
         BUILD_MAP,
         FIND_COMPANIES,
         FIND_ROUTE_COMPANY
@@ -34,6 +38,8 @@ public:
             {"Bus",            Type::FIND_BUS},
             {"Stop",           Type::FIND_STOP},
             {"Route",          Type::FIND_ROUTE},
+            {"Routes",         Type::FIND_ROUTES},
+            {"RouteMatrix",    Type::FIND_ROUTE_MATRIX},
             {"Map",            Type::BUILD_MAP},
             {"FindCompanies",  Type::FIND_COMPANIES},
             {"RouteToCompany", Type::FIND_ROUTE_COMPANY}
@@ -47,6 +53,11 @@ public:
     virtual JsonResponse Process(const DS::DataBase &,
                                  DbItemIdNameMap &) = 0;
 
+    // requests of one type with the same key are processed next to each other in a batch
+    [[nodiscard]] virtual std::string_view GetBatchKey() const {
+        return {};
+    }
+
     virtual ~ExecuteRequest() = default;
 
     template<typename F, typename ... Args>
@@ -58,7 +69,11 @@ public:
     }
 
 protected:
+    static constexpr size_t ARENA_INITIAL_SIZE = 16 * 1024;
+
     int id{};
+    // route responses and their items are allocated here and released together with the request
+    std::pmr::monotonic_buffer_resource arena{ARENA_INITIAL_SIZE};
 };
 
 struct FindBusRequest final : public ExecuteRequest {
@@ -93,6 +108,10 @@ public:
     JsonResponse Process(const DS::DataBase &,
                          DbItemIdNameMap &) override;
 
+    [[nodiscard]] std::string_view GetBatchKey() const override {
+        return from;
+    }
+
     void ParseFrom(Json::Node const &json_node) override {
         ExecuteRequest::ParseFrom(json_node);
         from = json_node["from"].AsString();
@@ -103,6 +122,48 @@ private:
     std::string from, to;
 };
 
+struct FindRoutesRequest final : public ExecuteRequest {
+public:
+    JsonResponse Process(const DS::DataBase &,
+                         DbItemIdNameMap &) override;
+
+    [[nodiscard]] std::string_view GetBatchKey() const override {
+        return from;
+    }
+
+    void ParseFrom(Json::Node const &json_node) override {
+        ExecuteRequest::ParseFrom(json_node);
+        from = json_node["from"].AsString();
+        to = json_node["to"].AsString();
+        k = std::min(static_cast<size_t>(std::max(json_node["k"].AsNumber<int>(), 0)), MAX_ROUTES_COUNT);
+    }
+
+private:
+    static constexpr size_t MAX_ROUTES_COUNT = 5;
+
+    std::string from, to;
+    size_t k{};
+};
+
+struct FindRouteMatrixRequest final : public ExecuteRequest {
+public:
+    JsonResponse Process(const DS::DataBase &,
+                         DbItemIdNameMap &) override;
+
+    void ParseFrom(Json::Node const &json_node) override {
+        ExecuteRequest::ParseFrom(json_node);
+        for (auto &stop: json_node["from"].AsArray()) {
+            from.push_back(stop.AsString());
+        }
+        for (auto &stop: json_node["to"].AsArray()) {
+            to.push_back(stop.AsString());
+        }
+    }
+
+private:
+    std::vector<std::string> from, to;
+};
+
 struct MapRouteRequest final : public ExecuteRequest {
 public:
     JsonResponse Process(const DS::DataBase &,
@@ -148,16 +209,40 @@ struct FindCompaniesRequest : public ExecuteRequest {
         ParseLike(Phone, phones);
         ParseLike(Url, urls);
         ParseLike(Name, names);
+        filter_key = MakeFilterKey(json_node);
+    }
+
+    [[nodiscard]] std::string_view GetBatchKey() const override {
+        return filter_key;
+    }
+
+    [[nodiscard]] std::string const &GetFilterKey() const {
+        return filter_key;
+    }
+
+    // evaluates the filter unless a request with the same filter key has shared its companies
+    std::shared_ptr<const DS::Companies> const &FilterCompanies(const DS::DataBase &db);
+
+    void SetCompanies(std::shared_ptr<const DS::Companies> companies_) {
+        companies = std::move(companies_);
     }
 
 protected:
+    static std::string MakeFilterKey(Json::Node const &json_node);
+
     std::vector<std::shared_ptr<DS::Query>> queries;
+    std::string filter_key;
+    std::shared_ptr<const DS::Companies> companies;
 };
 
 struct FindRouteToCompaniesRequest final : public FindCompaniesRequest {
     JsonResponse Process(const DS::DataBase &,
                          DbItemIdNameMap &) override;
 
+    [[nodiscard]] std::string_view GetBatchKey() const override {
+        return from;
+    }
+
     void ParseFrom(Json::Node const &json_node) override {
         FindCompaniesRequest::ExecuteRequest::ParseFrom(json_node);
         FindCompaniesRequest::ParseQueries(json_node["companies"]);
@@ -253,7 +338,13 @@ std::vector<DS::DBItem> ReadBaseRequests(Json::Node const &input,
 
 DS::RoutingSettings ReadRoutingSettings(Json::Node const &input);
 
-std::vector<JsonResponse> ReadStatRequests(const DS::DataBase &db, Json::Node const &input, DbItemIdNameMap &);
+// requests found in the cache are neither parsed nor processed
+std::vector<JsonResponse> ReadStatRequests(const DS::DataBase &db, Json::Node const &input, DbItemIdNameMap &,
+                                           ResponseCache &cache);
+
+// moves the responses of an answered batch into the cache, so a batch that is never
+// followed by another one doesn't pay for copying its responses
+void CacheStatResponses(Json::Node const &input, std::vector<JsonResponse> responses, ResponseCache &cache);
 
 DS::RenderSettings ReadRenderSettings(Json::Node const &input);
 
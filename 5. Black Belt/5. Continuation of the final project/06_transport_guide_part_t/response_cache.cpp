@@ -0,0 +1,101 @@
+#include "response_cache.h"
+
+#include <limits>
+#include <sstream>
+#include <type_traits>
+
+namespace {
+    size_t ApproximateXmlSize(XML::xml const &node) {
+        size_t bytes = sizeof(XML::xml);
+        std::visit([&bytes](auto const &arg) {
+            using T = std::decay_t<decltype(arg)>;
+            if constexpr (std::is_same_v<T, std::string>) {
+                bytes += arg.capacity();
+            } else if constexpr (std::is_same_v<T, XML::text>) {
+                bytes += arg.raw_str.capacity();
+            } else if constexpr (std::is_same_v<T, std::vector<XML::xml>>) {
+                for (auto const &child: arg)
+                    bytes += ApproximateXmlSize(child);
+            } else if constexpr (std::is_base_of_v<XML::config, T>) {
+                bytes += arg.open.capacity() + arg.close.capacity();
+                for (auto const &[key, value]: arg.data)
+                    bytes += key.capacity() + ApproximateXmlSize(value);
+                if constexpr (std::is_same_v<T, XML::config_with_parameters>)
+                    bytes += ApproximateXmlSize(*arg.parameters);
+            }
+        }, node.GetOrigin());
+        return bytes;
+    }
+}
+
+std::string ResponseCache::MakeKey(const Json::Node &request) {
+    auto params = request.AsMap();
+    params.erase("id");
+
+    std::ostringstream key;
+    key.precision(std::numeric_limits<double>::max_digits10);
+    Json::Serializer::Serialize(params, key);
+    return key.str();
+}
+
+size_t ResponseCache::ApproximateSize(const Json::Node &node) {
+    size_t bytes = sizeof(Json::Node);
+    std::visit([&bytes](auto const &arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+            bytes += arg.capacity();
+        } else if constexpr (std::is_same_v<T, std::vector<Json::Node>>) {
+            for (auto const &child: arg)
+                bytes += ApproximateSize(child);
+        } else if constexpr (std::is_same_v<T, std::map<std::string, Json::Node>>) {
+            for (auto const &[key, value]: arg)
+                bytes += key.capacity() + ApproximateSize(value);
+        } else if constexpr (std::is_same_v<T, XML::xml>) {
+            bytes += ApproximateXmlSize(arg) - sizeof(XML::xml);
+        }
+    }, node.GetOrigin());
+    return bytes;
+}
+
+std::optional<JsonResponse> ResponseCache::Find(const std::string &key, int id) {
+    auto it = index.find(key);
+    if (it == index.end()) {
+        ++misses;
+        return std::nullopt;
+    }
+    ++hits;
+    entries.splice(entries.begin(), entries, it->second);
+
+    JsonResponse response = it->second->response;
+    std::get<Response::Dict>(response)["request_id"] = id;
+    return response;
+}
+
+void ResponseCache::Insert(std::string key, JsonResponse response) {
+    if (capacity_bytes == 0 || index.count(key))
+        return;
+
+    const size_t bytes = key.capacity() + ApproximateSize(response);
+    if (bytes > capacity_bytes)
+        return;
+    while (size_bytes + bytes > capacity_bytes) {
+        size_bytes -= entries.back().bytes;
+        index.erase(entries.back().key);
+        entries.pop_back();
+    }
+    entries.push_front({std::move(key), std::move(response), bytes});
+    index.emplace(entries.front().key, entries.begin());
+    size_bytes += bytes;
+}
+
+size_t ResponseCache::GetHits() const {
+    return hits;
+}
+
+size_t ResponseCache::GetMisses() const {
+    return misses;
+}
+
+size_t ResponseCache::GetSizeBytes() const {
+    return size_bytes;
+}
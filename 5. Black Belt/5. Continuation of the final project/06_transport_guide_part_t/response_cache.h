@@ -0,0 +1,55 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <list>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "json.h"
+#include "responses.h"
+
+// LRU cache of stat responses keyed by the request with its "id" dropped,
+// so requests repeated in later batches are answered without routing or rendering.
+// It lives as long as the base it answers from, not a single batch: repeats within
+// a batch are already answered by their first occurrence.
+// The cache is bounded by the approximate size of the stored keys and responses in bytes.
+class ResponseCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY_BYTES = 64u << 20u;
+
+    explicit ResponseCache(size_t capacity_bytes_ = DEFAULT_CAPACITY_BYTES) : capacity_bytes(capacity_bytes_) {}
+
+    static std::string MakeKey(Json::Node const &request);
+
+    // heap and inline bytes held by the node and everything below it
+    static size_t ApproximateSize(Json::Node const &node);
+
+    std::optional<JsonResponse> Find(std::string const &key, int id);
+
+    void Insert(std::string key, JsonResponse response);
+
+    [[nodiscard]] size_t GetHits() const;
+
+    [[nodiscard]] size_t GetMisses() const;
+
+    [[nodiscard]] size_t GetSizeBytes() const;
+
+private:
+    struct Entry {
+        std::string key;
+        JsonResponse response;
+        size_t bytes;
+    };
+
+    size_t capacity_bytes;
+    size_t size_bytes = 0;
+    std::list<Entry> entries;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index;
+
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+#endif //RESPONSE_CACHE_H
@@ -1,4 +1,5 @@
 #include "responses.h"
+#include "trace.h"
 
 #include "company.pb.h"
 
@@ -9,14 +10,17 @@ Response::Dict const &Response::GetJson() const {
 void StopResponse::MakeJson() {
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("request_id"), std::forward_as_tuple(id));
     std::vector<Json::Node> buses_;
-    for (const auto &el: buses) {
-        buses_.emplace_back(el);
+    buses_.reserve(buses.end() - buses.begin());
+    for (auto bus: buses) {
+        buses_.emplace_back((*bus_names)[bus]);
     }
-    valid_data.emplace("buses", buses_);
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("buses"),
+                       std::forward_as_tuple(std::move(buses_)));
 }
 
 void BusResponse::MakeJson() {
-    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("request_id"), std::forward_as_tuple(id));
+    // the response object is shared by every request for the same item
+    valid_data.insert_or_assign("request_id", id);
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("route_length"), std::forward_as_tuple(length));
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("curvature"), std::forward_as_tuple(curvature));
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("stop_count"),
@@ -29,27 +33,61 @@ void RouteResponse::MakeJson() {
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("request_id"), std::forward_as_tuple(id));
     valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("total_time"),
                        std::forward_as_tuple(total_time));
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("items"),
+                       std::forward_as_tuple(MakeItemsJson(items)));
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("map"),
+                       std::forward_as_tuple(std::move(route_render)));
+}
+
+std::vector<Json::Node> RouteResponse::MakeItemsJson(const Items &items) {
     std::vector<Json::Node> items_;
+    items_.reserve(items.size());
     for (auto &el: items) {
         Dict item;
         item.emplace(std::piecewise_construct, std::forward_as_tuple("time"),
-                     std::forward_as_tuple(static_cast<double>(el->time)));
-        if (el->type == Item::ItemType::BUS) {
-            item.emplace(std::piecewise_construct, std::forward_as_tuple("bus"), std::forward_as_tuple(el->name));
+                     std::forward_as_tuple(static_cast<double>(el.time)));
+        if (el.type == Item::ItemType::BUS) {
+            item.emplace(std::piecewise_construct, std::forward_as_tuple("bus"),
+                         std::forward_as_tuple(std::string(el.name)));
             item.emplace(std::piecewise_construct, std::forward_as_tuple("type"),
                          std::forward_as_tuple(std::string("RideBus")));
             item.emplace(std::piecewise_construct, std::forward_as_tuple("span_count"),
-                         std::forward_as_tuple(static_cast<int>(reinterpret_cast<Bus *>(el.get())->span_count)));
+                         std::forward_as_tuple(static_cast<int>(el.span_count)));
         } else {
-            item.emplace(std::piecewise_construct, std::forward_as_tuple("stop_name"), std::forward_as_tuple(el->name));
+            item.emplace(std::piecewise_construct, std::forward_as_tuple("stop_name"),
+                         std::forward_as_tuple(std::string(el.name)));
             item.emplace(std::piecewise_construct, std::forward_as_tuple("type"),
                          std::forward_as_tuple(std::string("WaitBus")));
         }
-        items_.emplace_back(item);
+        items_.emplace_back(std::move(item));
     }
-    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("items"), std::forward_as_tuple(items_));
-    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("map"),
-                       std::forward_as_tuple(std::move(route_render)));
+    return items_;
+}
+
+void RoutesResponse::MakeJson() {
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("request_id"), std::forward_as_tuple(id));
+    std::vector<Json::Node> routes_;
+    for (auto &route: routes) {
+        Dict route_json;
+        route_json.emplace(std::piecewise_construct, std::forward_as_tuple("total_time"),
+                           std::forward_as_tuple(route->total_time));
+        route_json.emplace(std::piecewise_construct, std::forward_as_tuple("items"),
+                           std::forward_as_tuple(RouteResponse::MakeItemsJson(route->items)));
+        routes_.emplace_back(std::move(route_json));
+    }
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("routes"), std::forward_as_tuple(routes_));
+}
+
+void RouteMatrixResponse::MakeJson() {
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("request_id"), std::forward_as_tuple(id));
+    std::vector<Json::Node> rows;
+    rows.reserve(row_count);
+    // a row per source even if there are no targets
+    for (size_t row = 0; row < row_count; row++) {
+        auto first = times.begin() + row * column_count;
+        rows.emplace_back(std::vector<Json::Node>(first, first + column_count));
+    }
+    valid_data.emplace(std::piecewise_construct, std::forward_as_tuple("times"), std::forward_as_tuple(rows));
 }
 
 void MapResponse::MakeJson() {
@@ -104,5 +142,6 @@ void RouteToCompaniesResponse::MakeJson() {
 }
 
 void PrintResponses(const std::vector<JsonResponse> &responses, std::ostream &os) {
+    TRACE_DURATION("PrintResponses");
     Json::Serializer::Serialize(responses, os);
 }
\ No newline at end of file
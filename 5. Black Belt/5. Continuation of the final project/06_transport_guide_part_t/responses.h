@@ -1,13 +1,17 @@
 #ifndef RESPONSES_H
 #define RESPONSES_H
 
-#include <set>
+#include <memory_resource>
+#include <cstdint>
+#include <string>
 #include <string_view>
 #include <memory>
 #include <utility>
+#include <vector>
 
 #include "xml.h"
 #include "json.h"
+#include "ranges.h"
 
 using JsonResponse = Json::Node;
 using ResponseType = std::shared_ptr<struct Response>;
@@ -27,9 +31,16 @@ protected:
 
 struct StopResponse : public Response {
 public:
+    using BusRange = Ranges::Range<std::vector<uint32_t>::const_iterator>;
+
+    StopResponse(BusRange buses_, std::vector<std::string> const &bus_names_)
+            : buses(buses_), bus_names(&bus_names_) {}
+
     void MakeJson() override;
 
-    std::set<std::string> buses;
+    // bus indices sorted by name, names are looked up only while making json
+    BusRange buses;
+    std::vector<std::string> const *bus_names;
 };
 
 struct BusResponse : public Response {
@@ -50,32 +61,57 @@ public:
             BUS
         };
 
-        explicit Item(ItemType t) : type(t) {}
-
-        const ItemType type;
-        std::string name{};
-        double time{};
-    };
+        static Item Wait(std::string_view stop_name, double time) {
+            return Item{ItemType::WAIT, stop_name, time, 0};
+        }
 
-    struct Wait : public Item {
-        Wait() : Item(ItemType::WAIT) {};
-    };
+        static Item Bus(std::string_view bus_name, double time, size_t span_count) {
+            return Item{ItemType::BUS, bus_name, time, span_count};
+        }
 
-    struct Bus : public Item {
-        explicit Bus(size_t span_c) : Item(ItemType::BUS), span_count(span_c) {};
+        ItemType type;
+        // points into names owned by the router, which outlives every response
+        std::string_view name;
+        double time{};
         size_t span_count{};
     };
 
-    using ItemPtr = std::shared_ptr<Item>;
+    using Items = std::pmr::vector<Item>;
+
+    explicit RouteResponse(std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+            : items(resource) {}
 
     void MakeJson() override;
 
+    static std::vector<Json::Node> MakeItemsJson(Items const &items);
+
     double total_time;
-    std::vector<ItemPtr> items;
+    Items items;
 
     XML::xml route_render;
 };
 
+struct RoutesResponse : public Response {
+public:
+    explicit RoutesResponse(std::vector<std::shared_ptr<RouteResponse>> routes_) : routes(std::move(routes_)) {}
+
+    void MakeJson() override;
+
+    std::vector<std::shared_ptr<RouteResponse>> routes;
+};
+
+struct RouteMatrixResponse : public Response {
+public:
+    static constexpr double NO_ROUTE = -1;
+
+    void MakeJson() override;
+
+    size_t row_count{};
+    size_t column_count{};
+    // row per source, column per target; NO_ROUTE if the target is unreachable
+    std::vector<double> times;
+};
+
 struct MapResponse : public Response {
 public:
     void MakeJson() override;
@@ -95,6 +131,8 @@ struct CompaniesResponse : public Response {
 };
 
 struct RouteToCompaniesResponse : public RouteResponse {
+    using RouteResponse::RouteResponse;
+
     void MakeJson() override;
 
     double time_to_walk;
@@ -1,5 +1,7 @@
 #include "route_manager.h"
 #include "data_manager.h"
+#include "parallel.h"
+#include "trace.h"
 
 #include "transport_catalog.pb.h"
 
@@ -27,7 +29,9 @@ bool Data_Structure::DataBaseRouter::proxy_route::IsValid() const {
 Data_Structure::DataBaseRouter::DataBaseRouter(RouterProto::Router const &router_mes,
                                                DbItemIdNameMap &db_item_id_name_map) : routing_settings(
         {router_mes.routing_settings().bus_wait_time(), router_mes.routing_settings().bus_velocity(),
-         router_mes.routing_settings().pedestrian_velocity()}), graph_map(router_mes) {
+         router_mes.routing_settings().pedestrian_velocity(),
+         router_mes.routing_settings().on_board_vertices()}), graph_map(router_mes) {
+    TRACE_DURATION("DataBaseRouter restore");
     for (auto &vert: router_mes.vertexes()) {
         waiting_stops.emplace(vert.vertex_id(),
                               vertices_path{
@@ -36,127 +40,261 @@ Data_Structure::DataBaseRouter::DataBaseRouter(RouterProto::Router const &router
     }
 
     for (auto &edge: router_mes.edges()) {
-        RouteResponse::ItemPtr item;
-        if (edge.has_count()) {
-            item = std::make_shared<RouteResponse::Bus>(edge.count().count());
-        } else {
-            item = std::make_shared<RouteResponse::Wait>();
-        }
-
-        item->name = db_item_id_name_map.GetNameById(edge.edge_id());
-        item->time = edge.weight();
-        edge_by_bus.emplace(edge.id(), std::move(item));
+        if (edge.is_transfer())
+            continue;
+        auto name = InternName(db_item_id_name_map.GetNameById(edge.edge_id()));
+        edge_by_bus.emplace(edge.id(), edge.has_count()
+                                       ? RouteResponse::Item::Bus(name, edge.weight(), edge.count().count())
+                                       : RouteResponse::Item::Wait(name, edge.weight()));
     }
 
     router = std::make_shared<Graph::Router<double>>(graph_map, router_mes);
 }
 
 
-Data_Structure::DataBaseRouter::DataBaseRouter(const std::unordered_map<int, Stop> &stops,
-                                               const std::unordered_map<int, Bus> &buses,
+Data_Structure::DataBaseRouter::DataBaseRouter(const TransportNetwork &network,
                                                RoutingSettings routing_settings_,
-                                               DbItemIdNameMap &db_item_id_name_map) : graph_map(stops.size() * 2),
-                                                                                       routing_settings(
-                                                                                               routing_settings_) {
-    FillGraphWithStops(stops, db_item_id_name_map);
-    FillGraphWithBuses(buses, stops, db_item_id_name_map);
+                                               DbItemIdNameMap &db_item_id_name_map) : routing_settings(
+        routing_settings_), graph_map(network.GetStopCount() * 2 + (routing_settings_.on_board_vertices
+                                                                    ? CountOnBoardVertices(network) : 0)) {
+    TRACE_DURATION("DataBaseRouter build");
+    FillGraphWithStops(network, db_item_id_name_map);
+    if (routing_settings.on_board_vertices)
+        FillGraphWithBusChains(network, db_item_id_name_map);
+    else
+        FillGraphWithBuses(network, db_item_id_name_map);
+    TRACE_COUNTER("graph vertices", graph_map.GetVertexCount());
+    TRACE_COUNTER("graph edges", graph_map.GetEdgeCount());
 
-    router = std::make_shared<Graph::Router<double>>(graph_map);
+    {
+        TRACE_DURATION("Graph::Router all-pairs relax");
+        // routes start and end only at stops, on-board vertices get neither rows nor columns
+        router = std::make_shared<Graph::Router<double>>(graph_map, network.GetStopCount() * 2);
+    }
 }
 
-void Data_Structure::DataBaseRouter::FillGraphWithStops(const std::unordered_map<int, Stop> &stops,
+void Data_Structure::DataBaseRouter::FillGraphWithStops(const TransportNetwork &network,
                                                         DbItemIdNameMap &db_item_id_name_map) {
-    Graph::VertexID vertex_id = 0;
-    for (auto &[id, _]: stops) {
-        vertices_path &vert_ids = waiting_stops[id];
-        vert_ids.inp = vertex_id++;
-        vert_ids.out = vertex_id++;
+    for (TransportNetwork::Index stop = 0; stop < network.GetStopCount(); stop++) {
+        vertices_path &vert_ids = waiting_stops[network.GetStopId(stop)];
+        vert_ids.inp = 2 * stop;
+        vert_ids.out = 2 * stop + 1;
 
         auto edge_id = graph_map.AddEdge({
                                                  vert_ids.inp,
                                                  vert_ids.out,
                                                  routing_settings.bus_wait_time
                                          });
-        auto cur_item = std::make_shared<RouteResponse::Wait>();
-        cur_item->time = routing_settings.bus_wait_time;
-        cur_item->name = db_item_id_name_map.GetNameById(id);
-        edge_by_bus.emplace(std::piecewise_construct, std::forward_as_tuple(edge_id),
-                            std::forward_as_tuple(std::move(cur_item)));
+        edge_by_bus.emplace(edge_id, RouteResponse::Item::Wait(
+                InternName(db_item_id_name_map.GetNameById(network.GetStopId(stop))),
+                routing_settings.bus_wait_time));
+    }
+}
+
+std::vector<std::string_view> Data_Structure::DataBaseRouter::InternBusNames(const TransportNetwork &network,
+                                                                              DbItemIdNameMap &db_item_id_name_map) {
+    std::vector<std::string_view> bus_names(network.GetBusCount());
+    for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+        bus_names[bus] = InternName(db_item_id_name_map.GetNameById(network.GetBusId(bus)));
     }
+    return bus_names;
 }
 
-void Data_Structure::DataBaseRouter::FillGraphWithBuses(const std::unordered_map<int, Bus> &buses,
-                                                        const std::unordered_map<int, Stop> &stops,
+// edges of each chunk of buses are collected separately and added in bus order,
+// so edge ids do not depend on the number of threads
+void Data_Structure::DataBaseRouter::AddBusEdges(std::vector<std::vector<BusEdge>> const &chunk_edges) {
+    for (auto &bus_edges: chunk_edges) {
+        for (auto &[edge, item]: bus_edges) {
+            auto edge_id = graph_map.AddEdge(edge);
+            if (item)
+                edge_by_bus.emplace(edge_id, *item);
+        }
+    }
+}
+
+void Data_Structure::DataBaseRouter::FillGraphWithBuses(const TransportNetwork &network,
                                                         DbItemIdNameMap &db_item_id_name_map) {
-    for (auto &[_, bus]: buses) {
-        size_t stop_count = bus.stops.size();
-        if (stop_count <= 1)
-            continue;
+    const auto bus_names = InternBusNames(network, db_item_id_name_map);
+    std::vector<std::vector<BusEdge>> chunk_edges(
+            Parallel::GetChunkCount(network.GetBusCount(), MIN_BUSES_PER_THREAD));
+    Parallel::ForChunks(network.GetBusCount(), MIN_BUSES_PER_THREAD, [&](size_t chunk, size_t begin, size_t end) {
+        auto &bus_edges = chunk_edges[chunk];
+        for (auto bus = static_cast<TransportNetwork::Index>(begin); bus < end; bus++) {
+            const auto bus_stops = network.GetBusStops(bus);
+            const auto stops = bus_stops.begin();
+            const size_t stop_count = bus_stops.end() - bus_stops.begin();
+            if (stop_count <= 1)
+                continue;
+            const bool is_roundtrip = network.IsRoundtrip(bus);
 
-        auto range = !bus.is_roundtrip
-                     ? Ranges::ToMiddle(Ranges::AsRange(bus.stops))
-                     : Ranges::AsRange(bus.stops);
-        for (auto bus_stop = range.begin(); bus_stop != range.end(); bus_stop++) {
-            int total_distance = 0;
-            auto &cur_stop = *bus_stop;
-            size_t i = 0;
-            for (auto stop_it = bus_stop; stop_it != std::prev(range.end()); stop_it++) {
-                auto time = Data_Structure::ComputeStopsDistance(stops.at(*stop_it),
-                                                                 stops.at(*std::next(stop_it)),
-                                                                 db_item_id_name_map);
-                total_distance += time;
-                auto edge_id = graph_map.AddEdge(
-                        {waiting_stops.at(cur_stop).out,
-                         waiting_stops.at(*std::next(stop_it)).inp,
-                         (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60});
-                auto cur_item = std::make_shared<RouteResponse::Bus>(++i);
-                cur_item->time = (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60;
-                cur_item->name = db_item_id_name_map.GetNameById(bus.bus_id);
-                edge_by_bus.emplace(std::piecewise_construct, std::forward_as_tuple(edge_id),
-                                    std::forward_as_tuple(std::move(cur_item)));
-            }
-            total_distance = 0;
-            i = 0;
-            if (!bus.is_roundtrip) {
-                for (auto stop_it = bus_stop; stop_it != range.begin(); stop_it--) {
-                    auto time = Data_Structure::ComputeStopsDistance(
-                            stops.at(*stop_it),
-                            stops.at(*std::prev(stop_it)),
-                            db_item_id_name_map);
-                    total_distance += time;
-                    auto edge_id = graph_map.AddEdge(
-                            {waiting_stops.at(cur_stop).out,
-                             waiting_stops.at(*std::prev(stop_it)).inp,
-                             (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60});
-                    auto cur_item = std::make_shared<RouteResponse::Bus>(++i);
-                    cur_item->time = (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60;
-                    cur_item->name = db_item_id_name_map.GetNameById(bus.bus_id);
-                    edge_by_bus.emplace(std::piecewise_construct, std::forward_as_tuple(edge_id),
-                                        std::forward_as_tuple(std::move(cur_item)));
+            // vertices of a stop with index s are 2s (inp) and 2s + 1 (out)
+            const size_t range_end = is_roundtrip ? stop_count : stop_count / 2 + 1;
+            for (size_t from = 0; from < range_end; from++) {
+                const Graph::VertexID out = 2 * stops[from] + 1;
+                int total_distance = 0;
+                size_t i = 0;
+                for (size_t to = from + 1; to < range_end; to++) {
+                    total_distance += network.GetRoadDistance(stops[to - 1], stops[to]);
+                    auto time = (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60;
+                    bus_edges.push_back(
+                            {{out, 2 * stops[to], time}, RouteResponse::Item::Bus(bus_names[bus], time, ++i)});
+                }
+                if (!is_roundtrip) {
+                    total_distance = 0;
+                    i = 0;
+                    for (size_t to = from; to > 0; to--) {
+                        total_distance += network.GetRoadDistance(stops[to], stops[to - 1]);
+                        auto time = (static_cast<double>(total_distance) / (routing_settings.bus_velocity / 3.6)) / 60;
+                        bus_edges.push_back(
+                                {{out, 2 * stops[to - 1], time}, RouteResponse::Item::Bus(bus_names[bus], time, ++i)});
+                    }
                 }
             }
         }
+    });
+    AddBusEdges(chunk_edges);
+}
+
+// A roundtrip bus is one chain over all its stops. A non-roundtrip bus is two chains,
+// there and back, which share the terminal stop but not the vertex: turning around
+// at the terminal means getting off and waiting, as with an edge per stop pair.
+std::vector<std::pair<size_t, size_t>> Data_Structure::DataBaseRouter::GetBusChains(const TransportNetwork &network,
+                                                                                    TransportNetwork::Index bus) {
+    const auto bus_stops = network.GetBusStops(bus);
+    const size_t stop_count = bus_stops.end() - bus_stops.begin();
+    if (stop_count <= 1)
+        return {};
+    if (network.IsRoundtrip(bus))
+        return {{0, stop_count}};
+    return {{0, stop_count / 2 + 1}, {stop_count / 2, stop_count}};
+}
+
+size_t Data_Structure::DataBaseRouter::CountOnBoardVertices(const TransportNetwork &network) {
+    size_t count = 0;
+    for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+        for (auto [first, last]: GetBusChains(network, bus)) {
+            count += last - first;
+        }
     }
+    return count;
+}
+
+void Data_Structure::DataBaseRouter::FillGraphWithBusChains(const TransportNetwork &network,
+                                                            DbItemIdNameMap &db_item_id_name_map) {
+    const auto bus_names = InternBusNames(network, db_item_id_name_map);
+
+    // on-board vertices follow the stop vertices, bus after bus
+    std::vector<Graph::VertexID> first_vertices(network.GetBusCount());
+    Graph::VertexID vertex_id = 2 * network.GetStopCount();
+    for (TransportNetwork::Index bus = 0; bus < network.GetBusCount(); bus++) {
+        first_vertices[bus] = vertex_id;
+        for (auto [first, last]: GetBusChains(network, bus)) {
+            vertex_id += last - first;
+        }
+    }
+
+    std::vector<std::vector<BusEdge>> chunk_edges(
+            Parallel::GetChunkCount(network.GetBusCount(), MIN_BUSES_PER_THREAD));
+    Parallel::ForChunks(network.GetBusCount(), MIN_BUSES_PER_THREAD, [&](size_t chunk, size_t begin, size_t end) {
+        auto &bus_edges = chunk_edges[chunk];
+        for (auto bus = static_cast<TransportNetwork::Index>(begin); bus < end; bus++) {
+            const auto stops = network.GetBusStops(bus).begin();
+            Graph::VertexID on_board = first_vertices[bus];
+            for (auto [first, last]: GetBusChains(network, bus)) {
+                for (size_t i = first; i < last; i++, on_board++) {
+                    // boarding from the out vertex, after the wait edge, and getting off to the inp vertex
+                    if (i + 1 < last)
+                        bus_edges.push_back({{2 * stops[i] + 1, on_board, 0}, std::nullopt});
+                    if (i > first)
+                        bus_edges.push_back({{on_board, 2 * stops[i], 0}, std::nullopt});
+                    if (i + 1 < last) {
+                        auto time = (static_cast<double>(network.GetRoadDistance(stops[i], stops[i + 1])) /
+                                     (routing_settings.bus_velocity / 3.6)) / 60;
+                        bus_edges.push_back(
+                                {{on_board, on_board + 1, time}, RouteResponse::Item::Bus(bus_names[bus], time, 1)});
+                    }
+                }
+            }
+        }
+    });
+    AddBusEdges(chunk_edges);
 }
 
 Data_Structure::RouteRespType
 Data_Structure::DataBaseRouter::CreateRoute(std::string const &from,
                                             std::string const &to,
-                                            DbItemIdNameMap &db_item_id_name_map) {
+                                            DbItemIdNameMap &db_item_id_name_map,
+                                            std::pmr::memory_resource *resource) {
+    TRACE_DURATION("DataBaseRouter::CreateRoute");
     proxy_route proxy{router, router->BuildRoute(waiting_stops.at(db_item_id_name_map.GetIdByName(from)).inp,
                                                  waiting_stops.at(db_item_id_name_map.GetIdByName(to)).inp)};
     if (!proxy.IsValid())
         return nullptr;
 
-    RouteRespType resp = std::make_shared<RouteResponse>();
+    return MakeRouteResponse(proxy, resource);
+}
+
+std::vector<Data_Structure::RouteRespType>
+Data_Structure::DataBaseRouter::CreateRoutes(std::string const &from,
+                                             std::string const &to,
+                                             size_t k,
+                                             DbItemIdNameMap &db_item_id_name_map,
+                                             std::pmr::memory_resource *resource) {
+    auto routes_info = router->BuildRoutes(waiting_stops.at(db_item_id_name_map.GetIdByName(from)).inp,
+                                           waiting_stops.at(db_item_id_name_map.GetIdByName(to)).inp,
+                                           k * ALTERNATIVE_ROUTES_OVERSAMPLING,
+                                           MAX_ALTERNATIVE_ROUTES_RELAXATIONS);
+
+    std::vector<RouteRespType> routes;
+    for (auto &route_info: routes_info) {
+        proxy_route proxy{router, route_info};
+        if (routes.size() == k)
+            continue;
+
+        auto resp = MakeRouteResponse(proxy, resource);
+        // getting off and boarding the same bus again is not an alternative for a rider
+        bool is_same_bus_again = false;
+        std::string_view last_bus;
+        for (auto const &item: resp->items) {
+            if (item.type != RouteResponse::Item::ItemType::BUS)
+                continue;
+            is_same_bus_again = is_same_bus_again || item.name == last_bus;
+            last_bus = item.name;
+        }
+        if (!is_same_bus_again || routes.empty())
+            routes.push_back(std::move(resp));
+    }
+    return routes;
+}
+
+Data_Structure::RouteRespType
+Data_Structure::DataBaseRouter::MakeRouteResponse(proxy_route const &proxy,
+                                                  std::pmr::memory_resource *resource) const {
+    RouteRespType resp = std::allocate_shared<RouteResponse>(std::pmr::polymorphic_allocator<RouteResponse>(resource),
+                                                             resource);
     resp->items.reserve(proxy.GetInfo()->edge_count);
     for (auto edge_id: proxy.GetRoute()) {
-        resp->items.push_back(edge_by_bus.at(edge_id));
+        auto it = edge_by_bus.find(edge_id);
+        if (it == edge_by_bus.end())
+            continue;
+        auto const &item = it->second;
+        // consecutive rides are the same bus without getting off: a wait separates any two boardings
+        if (item.type == RouteResponse::Item::ItemType::BUS && !resp->items.empty() &&
+            resp->items.back().type == RouteResponse::Item::ItemType::BUS) {
+            resp->items.back().time += item.time;
+            resp->items.back().span_count += item.span_count;
+        } else {
+            resp->items.push_back(item);
+        }
     }
     resp->total_time = proxy.GetInfo()->weight;
     return resp;
 }
 
+std::string_view Data_Structure::DataBaseRouter::InternName(std::string name) {
+    return *item_names.insert(std::move(name)).first;
+}
+
 std::optional<double> Data_Structure::DataBaseRouter::GetRouteWeight(std::string const &from,
                                                                      std::string const &to,
                                                                      DbItemIdNameMap &db_item_id_name_map) {
@@ -164,6 +302,44 @@ std::optional<double> Data_Structure::DataBaseRouter::GetRouteWeight(std::string
                                   waiting_stops.at(db_item_id_name_map.GetIdByName(to)).inp);
 }
 
+std::shared_ptr<RouteMatrixResponse>
+Data_Structure::DataBaseRouter::CreateRouteMatrix(std::vector<std::string> const &from,
+                                                  std::vector<std::string> const &to,
+                                                  DbItemIdNameMap &db_item_id_name_map) {
+    TRACE_DURATION("DataBaseRouter::CreateRouteMatrix");
+    auto to_vertices = [&](std::vector<std::string> const &names) -> std::optional<std::vector<Graph::VertexID>> {
+        std::vector<Graph::VertexID> vertices;
+        vertices.reserve(names.size());
+        for (auto &name: names) {
+            auto it = waiting_stops.find(db_item_id_name_map.GetIdByName(name));
+            if (it == waiting_stops.end())
+                return std::nullopt;
+            vertices.push_back(it->second.inp);
+        }
+        return vertices;
+    };
+    auto sources = to_vertices(from);
+    auto targets = to_vertices(to);
+    if (!sources || !targets)
+        return nullptr;
+
+    auto resp = std::make_shared<RouteMatrixResponse>();
+    resp->row_count = sources->size();
+    resp->column_count = targets->size();
+    resp->times.resize(resp->row_count * resp->column_count);
+    // rows are independent, each chunk of sources fills its own rows
+    Parallel::ForChunks(sources->size(), MIN_MATRIX_ROWS_PER_THREAD, [&](size_t, size_t begin, size_t end) {
+        for (size_t row = begin; row < end; row++) {
+            auto weights = router->GetRouteWeights((*sources)[row], *targets);
+            auto times = resp->times.begin() + row * resp->column_count;
+            for (size_t column = 0; column < weights.size(); column++) {
+                times[column] = weights[column].value_or(RouteMatrixResponse::NO_ROUTE);
+            }
+        }
+    });
+    return resp;
+}
+
 void Data_Structure::DataBaseRouter::Serialize(TCProto::TransportCatalog &tc,
                                                DbItemIdNameMap &db_item_id_name_map) const {
     RouterProto::Router router_mes;
@@ -172,7 +348,9 @@ void Data_Structure::DataBaseRouter::Serialize(TCProto::TransportCatalog &tc,
     rs_mes.set_bus_wait_time(routing_settings.bus_wait_time);
     rs_mes.set_bus_velocity(routing_settings.bus_velocity);
     rs_mes.set_pedestrian_velocity(routing_settings.pedestrian_velocity);
+    rs_mes.set_on_board_vertices(routing_settings.on_board_vertices);
     *router_mes.mutable_routing_settings() = std::move(rs_mes);
+    router_mes.set_vertex_count(graph_map.GetVertexCount());
 
     for (auto &[stop_id, verts]: waiting_stops) {
         RouterProto::Vertex vert;
@@ -194,12 +372,17 @@ void Data_Structure::DataBaseRouter::Serialize(TCProto::TransportCatalog &tc,
     graph_map.Serialize(router_mes);
 
     for (auto &edge: *router_mes.mutable_edges()) {
-        auto &item = edge_by_bus.at(edge.id());
+        auto it = edge_by_bus.find(edge.id());
+        if (it == edge_by_bus.end()) {
+            edge.set_is_transfer(true);
+            continue;
+        }
+        auto &item = it->second;
 
-        edge.set_edge_id(db_item_id_name_map.GetIdByName(item->name));
-        if (item->type == RouteResponse::Item::ItemType::BUS) {
+        edge.set_edge_id(db_item_id_name_map.GetIdByName(std::string(item.name)));
+        if (item.type == RouteResponse::Item::ItemType::BUS) {
             RouterProto::SpanCount sc;
-            sc.set_count(reinterpret_cast<RouteResponse::Bus const *>(item.get())->span_count);
+            sc.set_count(item.span_count);
             *edge.mutable_count() = std::move(sc);
         }
     }
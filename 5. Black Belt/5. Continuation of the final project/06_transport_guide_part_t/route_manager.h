@@ -1,13 +1,18 @@
 #ifndef ROUTE_STRUCTURE_H
 #define ROUTE_STRUCTURE_H
 
+#include <memory_resource>
+#include <optional>
 #include <unordered_map>
+#include <unordered_set>
 #include <utility>
+#include <vector>
 
 #include "graph.h"
 #include "router.h"
 #include "responses.h"
 #include "db_item_name_id_map.h"
+#include "transport_network.h"
 
 #include "transport_catalog.pb.h"
 #include "transport_router.pb.h"
@@ -18,15 +23,23 @@ namespace Data_Structure {
         double bus_wait_time;
         int bus_velocity;
         double pedestrian_velocity;
+        // a vertex per bus stop linked by an edge per consecutive stops instead of an edge per stop pair
+        bool on_board_vertices = false;
     };
 
     struct DataBaseRouter {
     private:
+        static constexpr size_t ALTERNATIVE_ROUTES_OVERSAMPLING = 3;
+        static constexpr size_t MAX_ALTERNATIVE_ROUTES_RELAXATIONS = 500'000;
+        static constexpr size_t MIN_BUSES_PER_THREAD = 16;
+        static constexpr size_t MIN_MATRIX_ROWS_PER_THREAD = 8;
+
         const struct RoutingSettings routing_settings;
         Graph::DirectedWeightedGraph<double> graph_map;
         std::shared_ptr<Graph::Router<double>> router;
 
-        std::unordered_map<Graph::EdgeID, RouteResponse::ItemPtr> edge_by_bus;
+        std::unordered_set<std::string> item_names;
+        std::unordered_map<Graph::EdgeID, RouteResponse::Item> edge_by_bus;
         struct vertices_path {
             Graph::VertexID inp;
             Graph::VertexID out;
@@ -59,8 +72,7 @@ namespace Data_Structure {
             ~proxy_route();
         };
 
-        DataBaseRouter(const std::unordered_map<int, struct Stop> &,
-                       const std::unordered_map<int, struct Bus> &,
+        DataBaseRouter(const TransportNetwork &,
                        RoutingSettings routing_settings_,
                        DbItemIdNameMap &);
 
@@ -68,24 +80,57 @@ namespace Data_Structure {
 
         RouteRespType CreateRoute(std::string const &from,
                                   std::string const &to,
-                                  DbItemIdNameMap &);
+                                  DbItemIdNameMap &,
+                                  std::pmr::memory_resource *resource = std::pmr::get_default_resource());
+
+        std::vector<RouteRespType> CreateRoutes(std::string const &from,
+                                                std::string const &to,
+                                                size_t k,
+                                                DbItemIdNameMap &,
+                                                std::pmr::memory_resource *resource = std::pmr::get_default_resource());
 
         std::optional<double> GetRouteWeight(std::string const &from,
                                              std::string const &to,
                                              DbItemIdNameMap &);
 
+        // nullptr if one of the stops is unknown
+        std::shared_ptr<RouteMatrixResponse> CreateRouteMatrix(std::vector<std::string> const &from,
+                                                               std::vector<std::string> const &to,
+                                                               DbItemIdNameMap &);
+
         RoutingSettings GetSettings() const;
 
         void Serialize(TCProto::TransportCatalog &, DbItemIdNameMap &dbItemIdNameMap) const;
 
     private:
-        void FillGraphWithStops(const std::unordered_map<int, Stop> &,
+        RouteRespType MakeRouteResponse(proxy_route const &proxy, std::pmr::memory_resource *resource) const;
+
+        std::string_view InternName(std::string name);
+
+        void FillGraphWithStops(const TransportNetwork &,
                                 DbItemIdNameMap &);
 
-        void
-        FillGraphWithBuses(const std::unordered_map<int, Bus> &,
-                           const std::unordered_map<int, Stop> &,
-                           DbItemIdNameMap &);
+        struct BusEdge {
+            Graph::Edge<double> edge;
+            // no item for getting on and off a bus
+            std::optional<RouteResponse::Item> item;
+        };
+
+        std::vector<std::string_view> InternBusNames(const TransportNetwork &, DbItemIdNameMap &);
+
+        void AddBusEdges(std::vector<std::vector<BusEdge>> const &chunk_edges);
+
+        void FillGraphWithBuses(const TransportNetwork &,
+                                DbItemIdNameMap &);
+
+        // chains of on-board vertices as [first, last) ranges of bus stop positions
+        static std::vector<std::pair<size_t, size_t>> GetBusChains(const TransportNetwork &,
+                                                                   TransportNetwork::Index bus);
+
+        static size_t CountOnBoardVertices(const TransportNetwork &);
+
+        void FillGraphWithBusChains(const TransportNetwork &,
+                                    DbItemIdNameMap &);
     };
 }
 
@@ -2,13 +2,16 @@
 #define ROUTER_H
 
 #include "graph.h"
+#include "parallel.h"
 
 #include <set>
 #include <cassert>
 #include <vector>
 #include <cstdint>
 #include <unordered_map>
+#include <unordered_set>
 #include <optional>
+#include <algorithm>
 
 #include "transport_router.pb.h"
 
@@ -19,7 +22,11 @@ namespace Graph {
         using Graph_t = DirectedWeightedGraph<Weight>;
         using RouteID = uint64_t;
     public:
-        explicit Router(const Graph_t &);
+        explicit Router(const Graph_t &graph_ref) : Router(graph_ref, graph_ref.GetVertexCount()) {}
+
+        // only routes between vertices [0, tree_vertex_count) are precomputed and stored; the part of such
+        // a route that runs through the other vertices is found again by a search over them when needed
+        Router(const Graph_t &, size_t tree_vertex_count);
 
         explicit Router(const Graph_t &, const RouterProto::Router &router_mes);
 
@@ -33,8 +40,16 @@ namespace Graph {
 
         std::optional<RouteInfo> BuildRoute(VertexID from, VertexID to) const;
 
+        // Yen's algorithm: up to k loopless routes ordered by weight.
+        // max_relaxations bounds the edges relaxed by all spur searches together.
+        std::vector<RouteInfo> BuildRoutes(VertexID from, VertexID to, size_t k, size_t max_relaxations) const;
+
         std::optional<double> GetRouteWeight(VertexID from, VertexID to) const;
 
+        // Weights from one vertex to each target: read from the precomputed tree when the vertex has one,
+        // otherwise found by a search that stops once every target is reached.
+        std::vector<std::optional<Weight>> GetRouteWeights(VertexID from, std::vector<VertexID> const &targets) const;
+
         [[nodiscard]] EdgeID GetRouteEdge(RouteID route_id, size_t edge_idx) const;
 
         auto GetRouteRangeOfEdges(RouteID route_id) const;
@@ -54,23 +69,44 @@ namespace Graph {
             }
         };
 
+        static constexpr size_t MIN_SOURCES_PER_THREAD = 64;
+
         using RoutesInternalData = std::vector<std::vector<std::optional<RouteInternalData>>>;
+        using EdgesPath = std::vector<EdgeID>;
 
         Graph_t const &graph;
+        size_t tree_vertex_count;
         RoutesInternalData routes_internal_data;
 
         mutable std::unordered_map<RouteID, std::vector<EdgeID>> routes_cache;
         mutable size_t routes_index{0};
 
-        void InitializeRouteInternalData() {
-            const size_t vertex_count = graph.GetVertexCount();
-            for (size_t vertex_id = 0; vertex_id < vertex_count; vertex_id++) {
-                routes_internal_data[vertex_id][vertex_id] = RouteInternalData{0, vertex_id, std::nullopt};
-            }
+        RouteID CacheRoute(EdgesPath const &path) const;
+
+        Weight GetPathWeight(EdgesPath const &path) const;
+
+        std::optional<EdgesPath> GetTreePath(VertexID from, VertexID to) const;
+
+        // edges from `to` back to `from`
+        std::optional<EdgesPath> GetReversedTreePath(VertexID from, VertexID to) const;
+
+        // appends edges from `finish` back to `start` of the shortest path that runs through vertices
+        // without trees only
+        void AppendReversedDetour(VertexID start, VertexID finish, EdgesPath &path) const;
+
+        std::optional<EdgesPath> GetRestrictedPath(VertexID from, VertexID to,
+                                                   std::unordered_set<EdgeID> const &banned_edges,
+                                                   std::unordered_set<VertexID> const &banned_vertices,
+                                                   size_t &relaxations_left) const;
+
+        [[nodiscard]] bool HasTree(VertexID from) const {
+            return !routes_internal_data[from].empty();
         }
 
         void RelaxRoute(VertexID vertex_id) {
             auto &relax_route = routes_internal_data[vertex_id];
+            relax_route.resize(graph.GetVertexCount());
+            relax_route[vertex_id] = RouteInternalData{0, vertex_id, std::nullopt};
             std::set < RouteInternalData > heap_of_route_internal_data;
             heap_of_route_internal_data.insert(*relax_route[vertex_id]);
             while (!heap_of_route_internal_data.empty()) {
@@ -90,49 +126,310 @@ namespace Graph {
                 }
             }
         }
+
+        // keeps only the tree vertices of a row: the prev edge of a tree vertex reached through other
+        // vertices becomes the edge that left the last tree vertex on the way
+        void CompressRoute(VertexID vertex_id) {
+            auto &route = routes_internal_data[vertex_id];
+            if (route.size() == tree_vertex_count)
+                return;
+            for (VertexID vertex = 0; vertex < tree_vertex_count; vertex++) {
+                if (!route[vertex] || !route[vertex]->prev_edge)
+                    continue;
+                EdgeID edge_id = *route[vertex]->prev_edge;
+                while (graph.GetEdge(edge_id).from >= tree_vertex_count)
+                    edge_id = *route[graph.GetEdge(edge_id).from]->prev_edge;
+                route[vertex]->prev_edge = edge_id;
+            }
+            route.resize(tree_vertex_count);
+            route.shrink_to_fit();
+        }
     };
 
     template<typename Weight>
-    Router<Weight>::Router(const Router::Graph_t &graph_ref) :
+    Router<Weight>::Router(const Router::Graph_t &graph_ref, size_t tree_vertex_count_) :
             graph(graph_ref),
-            routes_internal_data(graph.GetVertexCount(),
-                                 std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount())) {
-        InitializeRouteInternalData();
+            tree_vertex_count(tree_vertex_count_),
+            routes_internal_data(graph.GetVertexCount()) {
+        // each source writes only its own row of routes_internal_data
+        Parallel::ForChunks(tree_vertex_count, MIN_SOURCES_PER_THREAD, [this](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                RelaxRoute(i);
+                CompressRoute(i);
+            }
+        });
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexID from, VertexID to) const {
+        auto edges = GetReversedTreePath(from, to);
+        if (!edges)
+            return std::nullopt;
 
-        for (size_t i = 0; i < graph.GetVertexCount(); i++) {
-            RelaxRoute(i);
+        RouteID new_route_id = routes_index++;
+        const size_t edge_count = edges->size();
+        routes_cache[new_route_id] = std::move(*edges);
+        return RouteInfo{new_route_id, routes_internal_data[from][to]->weight, edge_count};
+    }
+
+    template<typename Weight>
+    typename Router<Weight>::RouteID Router<Weight>::CacheRoute(const EdgesPath &path) const {
+        RouteID new_route_id = routes_index++;
+        routes_cache[new_route_id] = EdgesPath(path.rbegin(), path.rend());
+        return new_route_id;
+    }
+
+    template<typename Weight>
+    Weight Router<Weight>::GetPathWeight(const EdgesPath &path) const {
+        Weight weight{};
+        for (EdgeID edge_id: path) {
+            weight += graph.GetEdge(edge_id).weight;
         }
+        return weight;
     }
 
     template<typename Weight>
-    std::optional<typename Router<Weight>::RouteInfo> Router<Weight>::BuildRoute(VertexID from, VertexID to) const {
+    std::optional<typename Router<Weight>::EdgesPath> Router<Weight>::GetTreePath(VertexID from, VertexID to) const {
+        auto path = GetReversedTreePath(from, to);
+        if (path)
+            std::reverse(path->begin(), path->end());
+        return path;
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::EdgesPath>
+    Router<Weight>::GetReversedTreePath(VertexID from, VertexID to) const {
         auto const &router = routes_internal_data[from];
-        auto finish = router[to];
-        if (finish) {
-            std::vector<EdgeID> edges;
-            for (std::optional<EdgeID> edge = finish->prev_edge;
-                 edge; finish = router[graph.GetEdge(*edge).from], edge = finish->prev_edge) {
-                edges.push_back(*edge);
+        if (to >= router.size() || !router[to])
+            return std::nullopt;
+
+        EdgesPath path;
+        for (VertexID vertex = to; router[vertex]->prev_edge;) {
+            auto const &edge = graph.GetEdge(*router[vertex]->prev_edge);
+            if (edge.to != vertex)
+                AppendReversedDetour(edge.to, vertex, path);
+            path.push_back(*router[vertex]->prev_edge);
+            vertex = edge.from;
+        }
+        return path;
+    }
+
+    template<typename Weight>
+    void Router<Weight>::AppendReversedDetour(VertexID start, VertexID finish, EdgesPath &path) const {
+        std::unordered_map<VertexID, RouteInternalData> relax_route;
+        std::set<RouteInternalData> heap_of_route_internal_data;
+        relax_route[start] = RouteInternalData{0, start, std::nullopt};
+        heap_of_route_internal_data.insert(relax_route[start]);
+        while (!heap_of_route_internal_data.empty()) {
+            auto min_vert = *heap_of_route_internal_data.begin();
+            heap_of_route_internal_data.erase(heap_of_route_internal_data.begin());
+            if (min_vert.vertex_number == finish)
+                break;
+
+            for (EdgeID edge_id: graph.GetIncidenceList(min_vert.vertex_number)) {
+                auto const &edge = graph.GetEdge(edge_id);
+                if (edge.to < tree_vertex_count && edge.to != finish)
+                    continue;
+
+                auto it = relax_route.find(edge.to);
+                if (it == relax_route.end() || min_vert.weight + edge.weight < it->second.weight) {
+                    auto rt = RouteInternalData{min_vert.weight + edge.weight, edge.to, edge_id};
+                    if (it != relax_route.end()) {
+                        heap_of_route_internal_data.erase(it->second);
+                        it->second = rt;
+                    } else {
+                        relax_route.emplace(edge.to, rt);
+                    }
+                    heap_of_route_internal_data.insert(rt);
+                }
             }
-            RouteID new_route_id = routes_index++;
-            routes_cache[new_route_id] = std::move(edges);
-            return RouteInfo{new_route_id, router[to]->weight, routes_cache[new_route_id].size()};
-        } else {
+        }
+
+        for (std::optional<EdgeID> edge = relax_route.at(finish).prev_edge; edge;
+             edge = relax_route.at(graph.GetEdge(*edge).from).prev_edge) {
+            path.push_back(*edge);
+        }
+    }
+
+    template<typename Weight>
+    std::optional<typename Router<Weight>::EdgesPath>
+    Router<Weight>::GetRestrictedPath(VertexID from, VertexID to,
+                                      const std::unordered_set<EdgeID> &banned_edges,
+                                      const std::unordered_set<VertexID> &banned_vertices,
+                                      size_t &relaxations_left) const {
+        // the precomputed tree is still optimal when it avoids everything banned;
+        // vertices without a tree of their own always search
+        if (HasTree(from)) {
+            auto tree_path = GetTreePath(from, to);
+            if (!tree_path)
+                return std::nullopt;
+
+            VertexID cur_vertex = from;
+            bool is_allowed = true;
+            for (EdgeID edge_id: *tree_path) {
+                if (banned_edges.count(edge_id) || banned_vertices.count(cur_vertex)) {
+                    is_allowed = false;
+                    break;
+                }
+                cur_vertex = graph.GetEdge(edge_id).to;
+            }
+            if (is_allowed && !banned_vertices.count(cur_vertex))
+                return tree_path;
+        }
+
+        std::unordered_map<VertexID, RouteInternalData> relax_route;
+        std::set<RouteInternalData> heap_of_route_internal_data;
+        relax_route[from] = RouteInternalData{0, from, std::nullopt};
+        heap_of_route_internal_data.insert(relax_route[from]);
+        while (!heap_of_route_internal_data.empty()) {
+            auto min_vert = *heap_of_route_internal_data.begin();
+            heap_of_route_internal_data.erase(heap_of_route_internal_data.begin());
+            if (min_vert.vertex_number == to)
+                break;
+
+            for (EdgeID edge_id: graph.GetIncidenceList(min_vert.vertex_number)) {
+                if (relaxations_left == 0)
+                    return std::nullopt;
+                --relaxations_left;
+
+                auto const &edge = graph.GetEdge(edge_id);
+                if (banned_edges.count(edge_id) || banned_vertices.count(edge.to))
+                    continue;
+
+                auto it = relax_route.find(edge.to);
+                if (it == relax_route.end() || min_vert.weight + edge.weight < it->second.weight) {
+                    auto rt = RouteInternalData{min_vert.weight + edge.weight, edge.to, edge_id};
+                    if (it != relax_route.end()) {
+                        heap_of_route_internal_data.erase(it->second);
+                        it->second = rt;
+                    } else {
+                        relax_route.emplace(edge.to, rt);
+                    }
+                    heap_of_route_internal_data.insert(rt);
+                }
+            }
+        }
+
+        auto finish = relax_route.find(to);
+        if (finish == relax_route.end())
             return std::nullopt;
+
+        EdgesPath path;
+        for (std::optional<EdgeID> edge = finish->second.prev_edge; edge;
+             edge = relax_route.at(graph.GetEdge(*edge).from).prev_edge) {
+            path.push_back(*edge);
         }
+        std::reverse(path.begin(), path.end());
+        return path;
+    }
+
+    template<typename Weight>
+    std::vector<typename Router<Weight>::RouteInfo>
+    Router<Weight>::BuildRoutes(VertexID from, VertexID to, size_t k, size_t max_relaxations) const {
+        std::vector<RouteInfo> routes;
+        auto shortest = GetTreePath(from, to);
+        if (!shortest || k == 0)
+            return routes;
+
+        std::vector<EdgesPath> found{std::move(*shortest)};
+        std::set<std::pair<Weight, EdgesPath>> candidates;
+        size_t relaxations_left = max_relaxations;
+
+        while (found.size() < k && relaxations_left > 0) {
+            auto const &prev_path = found.back();
+            std::unordered_set<VertexID> root_vertices;
+            VertexID spur_vertex = from;
+            Weight root_weight{};
+
+            for (size_t i = 0; i < prev_path.size() && relaxations_left > 0; i++) {
+                std::unordered_set<EdgeID> banned_edges;
+                for (auto const &path: found) {
+                    if (path.size() > i && std::equal(prev_path.begin(), prev_path.begin() + i, path.begin()))
+                        banned_edges.insert(path[i]);
+                }
+
+                if (auto spur_path = GetRestrictedPath(spur_vertex, to, banned_edges, root_vertices,
+                                                       relaxations_left)) {
+                    EdgesPath candidate(prev_path.begin(), prev_path.begin() + i);
+                    candidate.insert(candidate.end(), spur_path->begin(), spur_path->end());
+                    candidates.emplace(root_weight + GetPathWeight(*spur_path), std::move(candidate));
+                }
+
+                auto const &edge = graph.GetEdge(prev_path[i]);
+                root_vertices.insert(spur_vertex);
+                root_weight += edge.weight;
+                spur_vertex = edge.to;
+            }
+
+            if (candidates.empty())
+                break;
+            found.push_back(candidates.begin()->second);
+            candidates.erase(candidates.begin());
+        }
+
+        routes.reserve(found.size());
+        for (auto const &path: found) {
+            routes.push_back(RouteInfo{CacheRoute(path), GetPathWeight(path), path.size()});
+        }
+        return routes;
     }
 
     template<typename Weight>
     std::optional<double> Router<Weight>::GetRouteWeight(VertexID from, VertexID to) const {
         auto const &router = routes_internal_data[from];
-        auto finish = router[to];
-        if (finish) {
+        if (to < router.size() && router[to]) {
             return router[to]->weight;
         } else {
             return std::nullopt;
         }
     }
 
+    template<typename Weight>
+    std::vector<std::optional<Weight>>
+    Router<Weight>::GetRouteWeights(VertexID from, const std::vector<VertexID> &targets) const {
+        std::vector<std::optional<Weight>> weights(targets.size());
+        if (HasTree(from) && std::all_of(targets.begin(), targets.end(), [this](VertexID target) {
+            return target < tree_vertex_count;
+        })) {
+            auto const &router = routes_internal_data[from];
+            for (size_t i = 0; i < targets.size(); i++) {
+                if (router[targets[i]])
+                    weights[i] = router[targets[i]]->weight;
+            }
+            return weights;
+        }
+
+        std::unordered_map<VertexID, Weight> settled;
+        std::unordered_set<VertexID> targets_left(targets.begin(), targets.end());
+        std::unordered_map<VertexID, Weight> relax_route;
+        std::set<std::pair<Weight, VertexID>> heap_of_route_internal_data;
+        relax_route[from] = 0;
+        heap_of_route_internal_data.emplace(0, from);
+        while (!heap_of_route_internal_data.empty() && !targets_left.empty()) {
+            auto [weight, vertex] = *heap_of_route_internal_data.begin();
+            heap_of_route_internal_data.erase(heap_of_route_internal_data.begin());
+            settled.emplace(vertex, weight);
+            targets_left.erase(vertex);
+
+            for (EdgeID edge_id: graph.GetIncidenceList(vertex)) {
+                auto const &edge = graph.GetEdge(edge_id);
+                auto it = relax_route.find(edge.to);
+                if (it == relax_route.end() || weight + edge.weight < it->second) {
+                    if (it != relax_route.end())
+                        heap_of_route_internal_data.erase({it->second, edge.to});
+                    relax_route[edge.to] = weight + edge.weight;
+                    heap_of_route_internal_data.emplace(weight + edge.weight, edge.to);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < targets.size(); i++) {
+            if (auto it = settled.find(targets[i]); it != settled.end())
+                weights[i] = it->second;
+        }
+        return weights;
+    }
+
     template<typename Weight>
     EdgeID Router<Weight>::GetRouteEdge(Router::RouteID route_id, size_t edge_idx) const {
         return routes_cache.at(route_id)[edge_idx];
@@ -156,9 +453,12 @@ namespace Graph {
     template<typename Weight>
     Router<Weight>::Router(const Router::Graph_t &graph, const RouterProto::Router &router_mes) :
             graph(graph),
-            routes_internal_data(graph.GetVertexCount(),
-                                 std::vector<std::optional<RouteInternalData>>(graph.GetVertexCount())) {
+            tree_vertex_count(router_mes.tree_vertex_count() ? router_mes.tree_vertex_count()
+                                                             : graph.GetVertexCount()),
+            routes_internal_data(graph.GetVertexCount()) {
         auto Deserialize = [this](auto &verts) {
+            auto &row = this->routes_internal_data[verts[0].vertex_id()];
+            row.resize(this->tree_vertex_count);
             for (auto &vertex: verts) {
                 RouteInternalData cur_data;
 
@@ -167,7 +467,7 @@ namespace Graph {
                     cur_data.prev_edge.emplace(vertex.edge_id().id());
                 }
                 cur_data.weight = vertex.weight();
-                this->routes_internal_data[verts[0].vertex_id()][cur_data.vertex_number] = std::move(cur_data);
+                row[cur_data.vertex_number] = std::move(cur_data);
             }
         };
 
@@ -197,6 +497,7 @@ namespace Graph {
 
     template<typename Weight>
     void Router<Weight>::Serialize(RouterProto::Router &router_mes) {
+        router_mes.set_tree_vertex_count(tree_vertex_count);
         for (auto &verts: *router_mes.mutable_vertexes()) {
             SerializeVert(verts, out);
             SerializeVert(verts, in);
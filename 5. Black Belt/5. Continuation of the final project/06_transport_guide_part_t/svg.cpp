@@ -1,5 +1,44 @@
 #include "svg.h"
 
+#include <charconv>
+
+Svg::Writer &Svg::Writer::operator<<(std::string_view str) {
+    buffer.append(str);
+    return *this;
+}
+
+Svg::Writer &Svg::Writer::operator<<(double value) {
+    char chars[32];
+    auto result = std::to_chars(chars, chars + sizeof(chars), value, std::chars_format::general, DOUBLE_PRECISION);
+    buffer.append(chars, result.ptr);
+    return *this;
+}
+
+Svg::Writer &Svg::Writer::operator<<(uint32_t value) {
+    char chars[16];
+    auto result = std::to_chars(chars, chars + sizeof(chars), value);
+    buffer.append(chars, result.ptr);
+    return *this;
+}
+
+size_t Svg::Writer::Size() const {
+    return buffer.size();
+}
+
+std::string Svg::Writer::Release() {
+    return std::move(buffer);
+}
+
+std::shared_ptr<const std::string> Svg::Color::FormatRgba(const Svg::Rgba &rgb) {
+    Writer writer;
+    writer << (rgb.alpha ? "rgba(" : "rgb(") << uint32_t{rgb.red} << ", " << uint32_t{rgb.green} << ", "
+           << uint32_t{rgb.blue};
+    if (rgb.alpha)
+        writer << ", " << *rgb.alpha;
+    writer << ")";
+    return std::make_shared<const std::string>(writer.Release());
+}
+
 template<typename cur_prim>
 XML::config Svg::Primitive<cur_prim>::MakeXml() const {
     XML::config xml;
@@ -16,6 +55,17 @@ XML::config Svg::Primitive<cur_prim>::MakeXml() const {
     return xml;
 }
 
+template<typename cur_prim>
+void Svg::Primitive<cur_prim>::WriteAttributes(Svg::Writer &writer) const {
+    writer.Attribute("fill", !fill_color.IsNone() ? fill_color.Text() : "none");
+    writer.Attribute("stroke", !stroke_color.IsNone() ? stroke_color.Text() : "none");
+    writer.Attribute("stroke-width", stroke_width);
+
+    if (!type_of_stroke_linecap.empty())
+        writer.Attribute("stroke-linecap", type_of_stroke_linecap);
+    if (!type_of_stroke_linejoin.empty())
+        writer.Attribute("stroke-linejoin", type_of_stroke_linejoin);
+}
 
 Svg::Polyline &Svg::Polyline::AddPoint(Svg::Point pnt) &{
     points.emplace_back(pnt);
@@ -41,6 +91,16 @@ XML::xml Svg::Polyline::MakeXml() const {
     return xml;
 }
 
+void Svg::Polyline::Write(Svg::Writer &writer) const {
+    writer << "<polyline ";
+    WriteAttributes(writer);
+    writer << "points=\\\"";
+    for (auto &point: points) {
+        writer << point.x << "," << point.y << " ";
+    }
+    writer << "\\\" />";
+}
+
 Svg::Circle &Svg::Circle::SetCenter(Svg::Point pnt) &{
     point = pnt;
     return *this;
@@ -73,6 +133,12 @@ XML::xml Svg::Circle::MakeXml() const {
     return xml;
 }
 
+void Svg::Circle::Write(Svg::Writer &writer) const {
+    writer << "<circle ";
+    WriteAttributes(writer);
+    writer.Attribute("cx", point.x).Attribute("cy", point.y).Attribute("r", radius) << "/>";
+}
+
 Svg::Rect &Svg::Rect::SetPoint(Svg::Point pnt) &{
     Left_Up_Corner = pnt;
     return *this;
@@ -116,6 +182,13 @@ XML::xml Svg::Rect::MakeXml() const {
     return xml;
 }
 
+void Svg::Rect::Write(Svg::Writer &writer) const {
+    writer << "<rect ";
+    WriteAttributes(writer);
+    writer.Attribute("x", Left_Up_Corner.x).Attribute("y", Left_Up_Corner.y).Attribute("width", w)
+            .Attribute("height", h) << "/>";
+}
+
 
 Svg::Text &Svg::Text::SetPoint(Svg::Point pnt) &{
     point = pnt;
@@ -199,27 +272,50 @@ XML::xml Svg::Text::MakeXml() const {
     return xml_par;
 }
 
+void Svg::Text::Write(Svg::Writer &writer) const {
+    writer << "<text ";
+    WriteAttributes(writer);
+    writer.Attribute("x", point.x).Attribute("y", point.y).Attribute("dx", offset.x).Attribute("dy", offset.y)
+            .Attribute("font-size", font_size);
+    if (!font_family.empty())
+        writer.Attribute("font-family", font_family);
+    if (!font_weight.empty())
+        writer.Attribute("font-weight", font_weight);
+    writer << ">" << text.raw_str << "</text>";
+}
+
 void Svg::Document::Render(std::ostream &out) {
-    XML::config_with_parameters conf;
-    conf.open = "svg";
-    conf.close = "/svg";
-    conf.data.emplace_back("version", 1.1);
-    conf.data.emplace_back("xmlns", "http://www.w3.org/2000/svg");
+    SimpleRender();
+    out << *rendered;
+}
 
-    std::vector<XML::xml> pod_xml;
-    auto visitor = [&pod_xml](const auto &prim_node) {
-        pod_xml.emplace_back(prim_node.MakeXml());
-    };
+void Svg::Document::SimpleRender() {
+    Writer writer;
+    writer << "<?xml ";
+    writer.Attribute("version", std::to_string(1.0)).Attribute("encoding", "UTF-8") << "?>";
+    writer << "<svg ";
+    writer.Attribute("version", 1.1).Attribute("xmlns", "http://www.w3.org/2000/svg") << ">";
+
+    const size_t primitives_begin = writer.Size();
+    writer << base_primitives;
     for (auto &el: primitives) {
-        std::visit(visitor, el);
+        std::visit([&writer](const auto &prim_node) {
+            prim_node.Write(writer);
+        }, el);
     }
-    conf.parameters->emplace<std::vector<XML::xml>>(pod_xml);
-    xml_s.emplace_back(conf);
+    const size_t primitives_end = writer.Size();
+    writer << "</svg>";
 
-    XML::Serializer::Serialize(xml_s, out);
+    rendered = std::make_shared<const std::string>(writer.Release());
+    rendered_primitives = std::string_view(*rendered).substr(primitives_begin, primitives_end - primitives_begin);
+    rendered_count = primitives.size();
+}
+
+XML::xml Svg::Document::Get() const {
+    return XML::text(rendered ? *rendered : std::string());
 }
 
-Svg::Document::Document() {
+XML::xml Svg::Document::MakeXml() const {
     XML::config xml_;
     XML::Array arr;
     arr.emplace_back("version", std::to_string(1.0));
@@ -227,10 +323,7 @@ Svg::Document::Document() {
     xml_.open = "?xml";
     xml_.close = "?";
     xml_.data = std::move(arr);
-    xml_s.emplace_back(xml_);
-}
 
-void Svg::Document::SimpleRender() {
     XML::config_with_parameters conf;
     conf.open = "svg";
     conf.close = "/svg";
@@ -238,6 +331,8 @@ void Svg::Document::SimpleRender() {
     conf.data.emplace_back("xmlns", "http://www.w3.org/2000/svg");
 
     std::vector<XML::xml> pod_xml;
+    if (!base_primitives.empty())
+        pod_xml.emplace_back(XML::text(std::string(base_primitives)));
     auto visitor = [&pod_xml](const auto &prim_node) {
         pod_xml.emplace_back(prim_node.MakeXml());
     };
@@ -245,23 +340,19 @@ void Svg::Document::SimpleRender() {
         std::visit(visitor, el);
     }
     conf.parameters->emplace<std::vector<XML::xml>>(pod_xml);
-    xml_s.emplace_back(conf);
-}
 
-XML::xml Svg::Document::Get() const {
-    return xml_s;
+    return std::vector<XML::xml>{xml_, conf};
 }
 
 Svg::Document::Document(const Svg::Document &other) {
-    primitives = other.primitives;
-    xml_s = other.xml_s;
-    while (xml_s.size() >= 2)
-        xml_s.pop_back();
-}
-
-Svg::Document::Document(Svg::Document &&other) {
-    primitives = std::move(other.primitives);
-    xml_s = std::move(other.xml_s);
-    while (xml_s.size() >= 2)
-        xml_s.pop_back();
+    if (other.rendered) {
+        base_text = other.rendered;
+        base_primitives = other.rendered_primitives;
+        primitives.assign(other.primitives.begin() + static_cast<std::ptrdiff_t>(other.rendered_count),
+                          other.primitives.end());
+    } else {
+        base_text = other.base_text;
+        base_primitives = other.base_primitives;
+        primitives = other.primitives;
+    }
 }
@@ -6,11 +6,39 @@
 
 #include <iostream>
 
+#include <memory>
 #include <variant>
 #include <string>
+#include <string_view>
 #include <sstream>
 
 namespace Svg {
+    // Appends SVG text straight into a growing buffer, in exactly the form
+    // XML::Serializer produces for the equivalent XML::xml tree.
+    class Writer {
+    public:
+        // std::ostream's default precision, which the XML::xml output has always used
+        static constexpr int DOUBLE_PRECISION = 6;
+
+        Writer &operator<<(std::string_view str);
+
+        Writer &operator<<(double value);
+
+        Writer &operator<<(uint32_t value);
+
+        template<typename T>
+        Writer &Attribute(std::string_view key, T const &value) {
+            return *this << key << "=\\\"" << value << "\\\" ";
+        }
+
+        [[nodiscard]] size_t Size() const;
+
+        std::string Release();
+
+    private:
+        std::string buffer;
+    };
+
     struct Rgba {
         uint8_t red, green, blue;
         std::optional<double> alpha;
@@ -21,9 +49,9 @@ namespace Svg {
 
         Color(std::string const &color_str) : color(color_str) {};
 
-        Color(const char *color_str) : color(color_str) {};
+        Color(const char *color_str) : color(std::string(color_str)) {};
 
-        Color(Svg::Rgba const &color_rgb) : color(color_rgb) {}
+        Color(Svg::Rgba const &color_rgb) : color(color_rgb), rgba_text(FormatRgba(color_rgb)) {}
 
         Color(RenderProto::Color const &col_mes) {
             if (!col_mes.has_cn()) {
@@ -31,6 +59,7 @@ namespace Svg {
                 if (col_mes.has_alpha())
                     rgb.alpha.emplace(col_mes.alpha().val());
                 color.emplace<Rgba>(rgb);
+                rgba_text = FormatRgba(rgb);
             } else {
                 color.emplace<std::string>(col_mes.cn().color_name());
             }
@@ -40,21 +69,14 @@ namespace Svg {
             return std::holds_alternative<std::monostate>(color);
         }
 
+        [[nodiscard]] std::string_view Text() const {
+            if (std::holds_alternative<Rgba>(color))
+                return *rgba_text;
+            return std::get<std::string>(color);
+        }
+
         explicit operator std::string() const {
-            if (std::holds_alternative<Rgba>(color)) {
-                std::stringstream ss_to_str;
-                auto const &rgb_c = std::get<Rgba>(color);
-                if (!rgb_c.alpha)
-                    ss_to_str << "rgb(" << std::to_string(rgb_c.red) << ", " << std::to_string(rgb_c.green) << ", "
-                              << std::to_string(rgb_c.blue) << ")";
-                else {
-                    ss_to_str << "rgba(" << std::to_string(rgb_c.red) << ", " << std::to_string(rgb_c.green) << ", "
-                              << std::to_string(rgb_c.blue) << ", " << *rgb_c.alpha << ")";
-                }
-                return ss_to_str.str();
-            } else {
-                return std::string(std::get<std::string>(color));
-            }
+            return std::string(Text());
         }
 
         auto Serialize() const {
@@ -78,7 +100,11 @@ namespace Svg {
         }
 
     private:
+        static std::shared_ptr<const std::string> FormatRgba(Rgba const &rgb);
+
         std::variant<std::monostate, std::string, Rgba> color;
+        // formatted once and shared by every copy of a palette color
+        std::shared_ptr<const std::string> rgba_text;
     };
 
     [[maybe_unused]] const Color NoneColor{};
@@ -149,6 +175,8 @@ namespace Svg {
     protected:
         Primitive() = default;
 
+        void WriteAttributes(Writer &writer) const;
+
         Color stroke_color{NoneColor};
         Color fill_color{NoneColor};
 
@@ -166,6 +194,8 @@ namespace Svg {
 
         [[nodiscard]] XML::xml MakeXml() const;
 
+        void Write(Writer &writer) const;
+
     private:
         std::vector<Point> points;
     };
@@ -182,6 +212,8 @@ namespace Svg {
 
         [[nodiscard]] XML::xml MakeXml() const;
 
+        void Write(Writer &writer) const;
+
     private:
         Point point;
         double radius{1.0};
@@ -203,6 +235,8 @@ namespace Svg {
 
         [[nodiscard]] XML::xml MakeXml() const;
 
+        void Write(Writer &writer) const;
+
     private:
         Point Left_Up_Corner;
         double w{}, h{};
@@ -236,6 +270,8 @@ namespace Svg {
 
         [[nodiscard]] XML::xml MakeXml() const;
 
+        void Write(Writer &writer) const;
+
     private:
         Point point;
         Point offset;
@@ -267,11 +303,11 @@ namespace Svg {
 
     struct Document {
     public:
-        Document();
+        Document() = default;
 
         Document(const Document &);
 
-        Document(Document &&);
+        Document(Document &&) = default;
 
         template<typename T>
         std::enable_if_t<is_inherited<std::decay_t<T>, Primitive<std::decay_t<T>>>::value, void> Add(T &&obj) noexcept {
@@ -289,9 +325,19 @@ namespace Svg {
 
         [[nodiscard]] XML::xml Get() const;
 
+        // the same document as an XML::xml tree, the way it was rendered before Writer
+        [[nodiscard]] XML::xml MakeXml() const;
+
     private:
         std::vector<sigma_types> primitives;
-        std::vector<XML::xml> xml_s;
+
+        // a copy of a rendered document reuses its primitives' text instead of the primitives
+        std::shared_ptr<const std::string> base_text;
+        std::string_view base_primitives;
+
+        std::shared_ptr<const std::string> rendered;
+        std::string_view rendered_primitives;
+        size_t rendered_count = 0;
     };
 }
 
@@ -0,0 +1,155 @@
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string_view>
+
+#include "city_generator.h"
+#include "svg.h"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace {
+    const Svg::Color UnderlayerColor(Svg::Rgba{255, 255, 255, 0.85});
+
+    double MillisecondsSince(steady_clock::time_point start) {
+        return duration<double, milli>(steady_clock::now() - start).count();
+    }
+
+    Svg::Text MakeLabel(Svg::Point point, string const &data, uint32_t font_size) {
+        return Svg::Text{}
+                .SetPoint(point)
+                .SetOffset({7, -3})
+                .SetFontSize(font_size)
+                .SetFontFamily("Verdana")
+                .SetData(data);
+    }
+
+    void AddLabel(Svg::Document &doc, Svg::Text const &text, Svg::Color const &color) {
+        doc.Add(Svg::Text(text)
+                        .SetFillColor(UnderlayerColor)
+                        .SetStrokeColor(UnderlayerColor)
+                        .SetStrokeWidth(3)
+                        .SetStrokeLineCap("round")
+                        .SetStrokeLineJoin("round"));
+        doc.Add(Svg::Text(text).SetFillColor(color));
+    }
+
+    // the same layers DataBaseSvgBuilder draws for a full city map
+    Svg::Document MakeCityMap(Generator::CitySettings const &city) {
+        mt19937 rnd(city.seed);
+        uniform_real_distribution<double> coord(50, 1450);
+        uniform_int_distribution<size_t> route_length(max<size_t>(city.min_route_length, 2),
+                                                      max(city.min_route_length, city.max_route_length));
+        uniform_int_distribution<int> channel(0, 255);
+
+        vector<Svg::Point> stops(city.stop_count);
+        for (auto &stop: stops) {
+            stop = {coord(rnd), coord(rnd)};
+        }
+        vector<Svg::Color> palette{"green", "red", "orange"};
+        for (size_t i = 0; i < 5; i++) {
+            palette.emplace_back(Svg::Rgba{static_cast<uint8_t>(channel(rnd)), static_cast<uint8_t>(channel(rnd)),
+                                           static_cast<uint8_t>(channel(rnd)), nullopt});
+        }
+
+        Svg::Document doc;
+        uniform_int_distribution<size_t> stop_id(0, city.stop_count - 1);
+        vector<vector<size_t>> buses(city.bus_count);
+        for (size_t i = 0; i < buses.size(); i++) {
+            auto polyline = Svg::Polyline{}
+                    .SetStrokeColor(palette[i % palette.size()])
+                    .SetStrokeWidth(14)
+                    .SetStrokeLineJoin("round")
+                    .SetStrokeLineCap("round");
+            buses[i].resize(route_length(rnd));
+            for (auto &id: buses[i]) {
+                id = stop_id(rnd);
+                polyline.AddPoint(stops[id]);
+            }
+            doc.Add(std::move(polyline));
+        }
+        for (size_t i = 0; i < buses.size(); i++) {
+            AddLabel(doc, MakeLabel(stops[buses[i].front()], "Bus " + to_string(i), 20).SetFontWeight("bold"),
+                     palette[i % palette.size()]);
+        }
+        for (auto const &stop: stops) {
+            doc.Add(Svg::Circle{}.SetFillColor("white").SetRadius(3).SetCenter(stop));
+        }
+        for (size_t i = 0; i < stops.size(); i++) {
+            AddLabel(doc, MakeLabel(stops[i], "Stop " + to_string(i), 13), "black");
+        }
+        return doc;
+    }
+
+    string RenderXmlTree(Svg::Document const &doc) {
+        ostringstream out;
+        XML::Serializer::Serialize(doc.MakeXml(), out);
+        return out.str();
+    }
+
+    string RenderWriter(Svg::Document doc) {
+        doc.SimpleRender();
+        return get<XML::text>(doc.Get()).raw_str;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    Generator::CitySettings city;
+    size_t iterations = 20;
+    for (int i = 1; i < argc; i++) {
+        const string_view arg(argv[i]);
+        const auto eq = arg.find('=');
+        const string key(arg.substr(0, eq));
+        const string value(eq == string_view::npos ? "" : arg.substr(eq + 1));
+        if (key == "stops") {
+            city.stop_count = stoul(value);
+        } else if (key == "buses") {
+            city.bus_count = stoul(value);
+        } else if (key == "iterations") {
+            iterations = stoul(value);
+        } else {
+            cerr << "Usage: transport_guide_svg_benchmark [stops=N] [buses=N] [iterations=N]\n";
+            return 5;
+        }
+    }
+
+    const auto doc = MakeCityMap(city);
+    const auto expected = RenderXmlTree(doc);
+    if (RenderWriter(doc) != expected) {
+        cerr << "Writer output differs from XML::xml output\n";
+        return 1;
+    }
+
+    cout << fixed << setprecision(3);
+    cout << "map: stops=" << city.stop_count << " buses=" << city.bus_count << " svg=" << expected.size()
+         << " bytes\n";
+
+    size_t total_size = 0;
+    auto start = steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        total_size += RenderXmlTree(doc).size();
+    }
+    cout << "XML::xml tree + XML::Serializer: " << MillisecondsSince(start) / iterations << " ms per map\n";
+
+    start = steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        total_size += RenderWriter(doc).size();
+    }
+    cout << "Svg::Writer: " << MillisecondsSince(start) / iterations << " ms per map\n";
+
+    // a route overlay on top of the rendered map reuses the map's text
+    auto rendered = doc;
+    rendered.SimpleRender();
+    start = steady_clock::now();
+    for (size_t i = 0; i < iterations; i++) {
+        Svg::Document route_doc(rendered);
+        route_doc.Add(Svg::Rect{}.SetFillColor(UnderlayerColor).SetPoint({-150, -150}).SetWidth(1800).SetHeight(1250));
+        total_size += RenderWriter(std::move(route_doc)).size();
+    }
+    cout << "route overlay on rendered map: " << MillisecondsSince(start) / iterations << " ms per route\n";
+
+    return total_size == 0;
+}
@@ -0,0 +1,167 @@
+#include "trace.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+namespace {
+    const Trace::Clock::time_point ProgramStart = Trace::Clock::now();
+}
+
+size_t Trace::Histogram::BucketOf(uint64_t us) {
+    if (us < SUB_BUCKETS)
+        return us;
+    size_t exponent = 0;
+    while ((us >> exponent) >= 2 * SUB_BUCKETS)
+        ++exponent;
+    // us >> exponent is in [8, 16): its low bits pick the sub-bucket
+    return std::min((exponent + 1) * SUB_BUCKETS + (us >> exponent) - SUB_BUCKETS, BUCKET_COUNT - 1);
+}
+
+uint64_t Trace::Histogram::UpperBoundUs(size_t bucket) {
+    if (bucket < SUB_BUCKETS)
+        return bucket + 1;
+    const size_t exponent = bucket / SUB_BUCKETS - 1;
+    return (SUB_BUCKETS + bucket % SUB_BUCKETS + 1) << exponent;
+}
+
+void Trace::Histogram::Add(double ms) {
+    ++buckets[BucketOf(static_cast<uint64_t>(ms * 1000))];
+    ++count;
+    total_ms += ms;
+    max_ms = std::max(max_ms, ms);
+}
+
+double Trace::Histogram::Percentile(double p) const {
+    const auto rank = static_cast<size_t>(p * static_cast<double>(count) + 0.5);
+    size_t seen = 0;
+    for (size_t bucket = 0; bucket < BUCKET_COUNT; bucket++) {
+        seen += buckets[bucket];
+        if (seen >= std::max<size_t>(rank, 1))
+            return std::min(static_cast<double>(UpperBoundUs(bucket)) / 1000, max_ms);
+    }
+    return max_ms;
+}
+
+Trace::Registry &Trace::Registry::Instance() {
+    static Registry registry;
+    return registry;
+}
+
+void Trace::Registry::AddPhase(const std::string &name, Clock::time_point start, Clock::time_point finish) {
+    const double ms = std::chrono::duration<double, std::milli>(finish - start).count();
+    std::lock_guard<std::mutex> guard(mutex);
+    auto &phase = phases[name];
+    ++phase.count;
+    phase.total_ms += ms;
+    phase.max_ms = std::max(phase.max_ms, ms);
+    AddEvent(name, start, finish);
+}
+
+void Trace::Registry::AddLatency(const std::string &name, Clock::time_point start, Clock::time_point finish) {
+    const double ms = std::chrono::duration<double, std::milli>(finish - start).count();
+    std::lock_guard<std::mutex> guard(mutex);
+    latencies[name].Add(ms);
+    AddEvent(name, start, finish);
+}
+
+void Trace::Registry::AddCounter(const std::string &name, int64_t value) {
+    std::lock_guard<std::mutex> guard(mutex);
+    counters[name] += value;
+}
+
+std::map<std::string, Trace::Histogram> Trace::Registry::GetLatencies() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    return latencies;
+}
+
+void Trace::Registry::AddEvent([[maybe_unused]] const std::string &name,
+                               [[maybe_unused]] Clock::time_point start,
+                               [[maybe_unused]] Clock::time_point finish) {
+#ifdef TRANSPORT_GUIDE_TRACE_EVENTS
+    using std::chrono::duration_cast;
+    using std::chrono::microseconds;
+    events.push_back(Event{
+            name,
+            duration_cast<microseconds>(start - ProgramStart).count(),
+            duration_cast<microseconds>(finish - start).count(),
+            std::hash<std::thread::id>{}(std::this_thread::get_id())
+    });
+#endif
+}
+
+void Trace::Registry::Dump(std::ostream &os) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    const auto flags = os.flags();
+    const auto precision = os.precision();
+    os << std::fixed << std::setprecision(3);
+
+    if (!phases.empty()) {
+        os << "phase" << std::setw(48) << "count" << std::setw(14) << "total, ms" << std::setw(12) << "max, ms\n";
+        for (const auto &[name, phase]: phases) {
+            os << std::left << std::setw(45) << name << std::right << std::setw(8) << phase.count
+               << std::setw(14) << phase.total_ms << std::setw(12) << phase.max_ms << "\n";
+        }
+    }
+    if (!latencies.empty()) {
+        os << "latency" << std::setw(46) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+           << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "max\n";
+        for (const auto &[name, histogram]: latencies) {
+            os << std::left << std::setw(45) << name << std::right << std::setw(8) << histogram.count
+               << std::setw(10) << histogram.total_ms / static_cast<double>(histogram.count)
+               << std::setw(10) << histogram.Percentile(0.5) << std::setw(10) << histogram.Percentile(0.9)
+               << std::setw(10) << histogram.Percentile(0.99) << std::setw(10) << histogram.max_ms << "\n";
+        }
+    }
+    if (!counters.empty()) {
+        os << "counter\n";
+        for (const auto &[name, value]: counters) {
+            os << std::left << std::setw(45) << name << std::right << std::setw(8) << value << "\n";
+        }
+    }
+
+    os.flags(flags);
+    os.precision(precision);
+}
+
+void Trace::Registry::DumpEvents(std::ostream &os) const {
+    std::lock_guard<std::mutex> guard(mutex);
+    os << "{\"traceEvents\": [";
+    bool is_first = true;
+    for (const auto &event: events) {
+        if (!is_first)
+            os << ", ";
+        is_first = false;
+        os << "{\"name\": " << std::quoted(event.name) << ", \"ph\": \"X\", \"pid\": 0, \"tid\": "
+           << event.thread_id % 1000000 << ", \"ts\": " << event.start_us << ", \"dur\": " << event.duration_us
+           << "}";
+    }
+    os << "]}\n";
+}
+
+Trace::Registry::~Registry() {
+    Dump(std::cerr);
+    if (events.empty())
+        return;
+
+    const char *path = std::getenv("TRANSPORT_GUIDE_TRACE_FILE");
+    if (!path || !*path)
+        path = "trace_events.json";
+    std::ofstream file(path);
+    DumpEvents(file);
+    if (file)
+        std::cerr << "trace events: " << events.size() << " written to " << path << "\n";
+    else
+        std::cerr << "trace events: can't write " << path << "\n";
+}
+
+Trace::ScopedTimer::~ScopedTimer() {
+    if (is_latency)
+        Registry::Instance().AddLatency(name, start, Clock::now());
+    else
+        Registry::Instance().AddPhase(name, start, Clock::now());
+}
@@ -0,0 +1,122 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+// Lightweight tracing for make_base/process_requests.
+// Build with -DTRANSPORT_GUIDE_TRACE to collect per-phase timings, counters and
+// per-request-type latency histograms; a summary is printed to stderr at exit.
+// -DTRANSPORT_GUIDE_TRACE_EVENTS additionally writes Chrome trace-event JSON to
+// the file named by the TRANSPORT_GUIDE_TRACE_FILE environment variable
+// (trace_events.json by default), so it never mixes with the summary.
+// Without TRANSPORT_GUIDE_TRACE every TRACE_* macro expands to nothing.
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace Trace {
+    using Clock = std::chrono::steady_clock;
+
+    struct PhaseStats {
+        size_t count = 0;
+        double total_ms = 0;
+        double max_ms = 0;
+    };
+
+    // log-linear buckets of microseconds: latencies below 8 us get a bucket per
+    // microsecond, every power of two above is split into 8 equal buckets.
+    // A percentile is reported as the upper bound of its bucket, at most 12.5%
+    // above the true value
+    struct Histogram {
+        static constexpr size_t SUB_BUCKETS = 8;
+        static constexpr size_t BUCKET_COUNT = SUB_BUCKETS * 36;
+
+        static size_t BucketOf(uint64_t us);
+
+        static uint64_t UpperBoundUs(size_t bucket);
+
+        void Add(double ms);
+
+        [[nodiscard]] double Percentile(double p) const;
+
+        std::array<size_t, BUCKET_COUNT> buckets{};
+        size_t count = 0;
+        double total_ms = 0;
+        double max_ms = 0;
+    };
+
+    struct Event {
+        std::string name;
+        int64_t start_us;
+        int64_t duration_us;
+        size_t thread_id;
+    };
+
+    class Registry {
+    public:
+        static Registry &Instance();
+
+        void AddPhase(const std::string &name, Clock::time_point start, Clock::time_point finish);
+
+        void AddLatency(const std::string &name, Clock::time_point start, Clock::time_point finish);
+
+        void AddCounter(const std::string &name, int64_t value);
+
+        [[nodiscard]] std::map<std::string, Histogram> GetLatencies() const;
+
+        void Dump(std::ostream &os) const;
+
+        void DumpEvents(std::ostream &os) const;
+
+        ~Registry();
+
+    private:
+        Registry() = default;
+
+        void AddEvent(const std::string &name, Clock::time_point start, Clock::time_point finish);
+
+        mutable std::mutex mutex;
+        std::map<std::string, PhaseStats> phases;
+        std::map<std::string, Histogram> latencies;
+        std::map<std::string, int64_t> counters;
+        std::vector<Event> events;
+    };
+
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(std::string name_, bool is_latency_ = false)
+                : name(std::move(name_)), is_latency(is_latency_), start(Clock::now()) {}
+
+        ScopedTimer(const ScopedTimer &) = delete;
+
+        ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+        ~ScopedTimer();
+
+    private:
+        std::string name;
+        bool is_latency;
+        Clock::time_point start;
+    };
+}
+
+#define TRACE_UNIQ_ID_IMPL(lineno) _trace_local_var_##lineno
+#define TRACE_UNIQ_ID(lineno) TRACE_UNIQ_ID_IMPL(lineno)
+
+#ifdef TRANSPORT_GUIDE_TRACE
+#define TRACE_DURATION(name) \
+    Trace::ScopedTimer TRACE_UNIQ_ID(__LINE__){name}
+#define TRACE_LATENCY(name) \
+    Trace::ScopedTimer TRACE_UNIQ_ID(__LINE__){name, true}
+#define TRACE_COUNTER(name, value) \
+    Trace::Registry::Instance().AddCounter(name, static_cast<int64_t>(value))
+#else
+#define TRACE_DURATION(name)
+#define TRACE_LATENCY(name)
+#define TRACE_COUNTER(name, value)
+#endif
+
+#endif //TRACE_H
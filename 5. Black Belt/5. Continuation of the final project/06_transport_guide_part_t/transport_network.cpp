@@ -0,0 +1,182 @@
+#include "transport_network.h"
+#include "parallel.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+Data_Structure::TransportNetwork::Index Data_Structure::TransportNetwork::AddStop(int stop_id, Distance coordinates) {
+    stop_ids.push_back(stop_id);
+    longitudes.push_back(coordinates.GetLongitude());
+    latitudes.push_back(coordinates.GetLatitude());
+    geo_points.Add(coordinates);
+    adjacency_offsets.push_back(adjacency_offsets.back());
+    stop_bus_offsets.push_back(stop_bus_offsets.back());
+    return static_cast<Index>(stop_ids.size() - 1);
+}
+
+void Data_Structure::TransportNetwork::AddRoadDistance(int to_stop_id, int meters) {
+    adjacent_stops.push_back(static_cast<Index>(to_stop_id));
+    adjacent_distances.push_back(meters);
+    ++adjacency_offsets.back();
+}
+
+void Data_Structure::TransportNetwork::AddStopBus(int bus_id) {
+    stop_buses.push_back(static_cast<Index>(bus_id));
+    ++stop_bus_offsets.back();
+}
+
+Data_Structure::TransportNetwork::Index Data_Structure::TransportNetwork::AddBus(int bus_id, bool is_roundtrip) {
+    bus_ids.push_back(bus_id);
+    roundtrip_flags.push_back(is_roundtrip);
+    bus_stop_offsets.push_back(bus_stop_offsets.back());
+    return static_cast<Index>(bus_ids.size() - 1);
+}
+
+void Data_Structure::TransportNetwork::AddBusStop(int stop_id) {
+    bus_stops.push_back(static_cast<Index>(stop_id));
+    ++bus_stop_offsets.back();
+}
+
+void Data_Structure::TransportNetwork::SetBusStats(int route_length, double curvature, Index unique_stop_count) {
+    if (route_lengths.size() + 1 != bus_ids.size())
+        throw std::logic_error("bus stats must be set once for every bus, right after it is added");
+    route_lengths.push_back(route_length);
+    curvatures.push_back(curvature);
+    unique_stop_counts.push_back(unique_stop_count);
+}
+
+std::vector<Data_Structure::TransportNetwork::Index>
+Data_Structure::TransportNetwork::MakeIndex(const std::vector<int> &ids) {
+    std::vector<Index> index;
+    for (size_t i = 0; i < ids.size(); i++) {
+        if (static_cast<size_t>(ids[i]) >= index.size())
+            index.resize(ids[i] + 1, NO_INDEX);
+        index[ids[i]] = static_cast<Index>(i);
+    }
+    return index;
+}
+
+void Data_Structure::TransportNetwork::Finalize() {
+    stop_index_by_id = MakeIndex(stop_ids);
+    bus_index_by_id = MakeIndex(bus_ids);
+
+    auto resolve_stop = [this](Index &stop) {
+        const int stop_id = static_cast<int>(stop);
+        stop = GetStopIndex(stop_id);
+        if (stop == NO_INDEX)
+            throw std::out_of_range("no stop with id=" + std::to_string(stop_id));
+    };
+    std::for_each(adjacent_stops.begin(), adjacent_stops.end(), resolve_stop);
+    std::for_each(bus_stops.begin(), bus_stops.end(), resolve_stop);
+    std::for_each(stop_buses.begin(), stop_buses.end(), [this](Index &bus) {
+        const int bus_id = static_cast<int>(bus);
+        bus = GetBusIndex(bus_id);
+        if (bus == NO_INDEX)
+            throw std::out_of_range("no bus with id=" + std::to_string(bus_id));
+    });
+
+    if (route_lengths.size() == bus_ids.size())
+        return;
+
+    route_lengths.assign(bus_ids.size(), 0);
+    curvatures.assign(bus_ids.size(), 0);
+    unique_stop_counts.assign(bus_ids.size(), 0);
+    Parallel::ForChunks(bus_ids.size(), MIN_BUSES_PER_THREAD, [this](size_t, size_t begin, size_t end) {
+        std::vector<Index> unique_stops;
+        std::vector<double> geo_distances;
+        for (auto bus = static_cast<Index>(begin); bus < end; bus++) {
+            auto stops = GetBusStops(bus);
+            const size_t stop_count = stops.end() - stops.begin();
+            geo_distances.resize(stop_count);
+            ComputeDistances(geo_points, bus_stops.data() + bus_stop_offsets[bus], stop_count, geo_distances.data());
+            double geo_length = 0;
+            for (size_t i = 0; i + 1 < stop_count; i++) {
+                route_lengths[bus] += GetRoadDistance(stops.begin()[i], stops.begin()[i + 1]);
+                geo_length += geo_distances[i];
+            }
+            curvatures[bus] = route_lengths[bus] / geo_length;
+
+            unique_stops.assign(stops.begin(), stops.end());
+            std::sort(unique_stops.begin(), unique_stops.end());
+            unique_stop_counts[bus] = std::unique(unique_stops.begin(), unique_stops.end()) - unique_stops.begin();
+        }
+    });
+}
+
+size_t Data_Structure::TransportNetwork::GetStopCount() const {
+    return stop_ids.size();
+}
+
+size_t Data_Structure::TransportNetwork::GetBusCount() const {
+    return bus_ids.size();
+}
+
+Data_Structure::TransportNetwork::Index Data_Structure::TransportNetwork::GetStopIndex(int stop_id) const {
+    if (stop_id < 0 || static_cast<size_t>(stop_id) >= stop_index_by_id.size())
+        return NO_INDEX;
+    return stop_index_by_id[stop_id];
+}
+
+Data_Structure::TransportNetwork::Index Data_Structure::TransportNetwork::GetBusIndex(int bus_id) const {
+    if (bus_id < 0 || static_cast<size_t>(bus_id) >= bus_index_by_id.size())
+        return NO_INDEX;
+    return bus_index_by_id[bus_id];
+}
+
+int Data_Structure::TransportNetwork::GetStopId(Index stop) const {
+    return stop_ids[stop];
+}
+
+int Data_Structure::TransportNetwork::GetBusId(Index bus) const {
+    return bus_ids[bus];
+}
+
+Distance Data_Structure::TransportNetwork::GetCoordinates(Index stop) const {
+    return {longitudes[stop], latitudes[stop]};
+}
+
+Data_Structure::TransportNetwork::IndexRange Data_Structure::TransportNetwork::GetAdjacentStops(Index stop) const {
+    return {adjacent_stops.begin() + adjacency_offsets[stop], adjacent_stops.begin() + adjacency_offsets[stop + 1]};
+}
+
+int Data_Structure::TransportNetwork::GetAdjacentDistance(Index stop, size_t i) const {
+    return adjacent_distances[adjacency_offsets[stop] + i];
+}
+
+int Data_Structure::TransportNetwork::GetRoadDistance(Index from, Index to) const {
+    for (Index i = adjacency_offsets[from]; i < adjacency_offsets[from + 1]; i++) {
+        if (adjacent_stops[i] == to)
+            return adjacent_distances[i];
+    }
+    for (Index i = adjacency_offsets[to]; i < adjacency_offsets[to + 1]; i++) {
+        if (adjacent_stops[i] == from)
+            return adjacent_distances[i];
+    }
+    throw std::out_of_range("no road distance between stops " + std::to_string(stop_ids[from]) + " and " +
+                            std::to_string(stop_ids[to]));
+}
+
+Data_Structure::TransportNetwork::IndexRange Data_Structure::TransportNetwork::GetStopBuses(Index stop) const {
+    return {stop_buses.begin() + stop_bus_offsets[stop], stop_buses.begin() + stop_bus_offsets[stop + 1]};
+}
+
+Data_Structure::TransportNetwork::IndexRange Data_Structure::TransportNetwork::GetBusStops(Index bus) const {
+    return {bus_stops.begin() + bus_stop_offsets[bus], bus_stops.begin() + bus_stop_offsets[bus + 1]};
+}
+
+bool Data_Structure::TransportNetwork::IsRoundtrip(Index bus) const {
+    return roundtrip_flags[bus];
+}
+
+int Data_Structure::TransportNetwork::GetRouteLength(Index bus) const {
+    return route_lengths[bus];
+}
+
+double Data_Structure::TransportNetwork::GetCurvature(Index bus) const {
+    return curvatures[bus];
+}
+
+size_t Data_Structure::TransportNetwork::GetUniqueStopCount(Index bus) const {
+    return unique_stop_counts[bus];
+}
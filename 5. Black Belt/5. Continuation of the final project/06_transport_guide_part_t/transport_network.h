@@ -0,0 +1,104 @@
+#ifndef TRANSPORT_NETWORK_H
+#define TRANSPORT_NETWORK_H
+
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <vector>
+
+#include "distance.h"
+#include "ranges.h"
+
+namespace Data_Structure {
+    // Stops and buses stored column-wise and addressed by dense indices.
+    // Rows are appended in order: AddRoadDistance and AddStopBus extend the last
+    // added stop, AddBusStop and SetBusStats the last added bus. Ids are resolved
+    // to indices by Finalize.
+    struct TransportNetwork {
+    public:
+        using Index = uint32_t;
+        using IndexRange = Ranges::Range<std::vector<Index>::const_iterator>;
+
+        static constexpr Index NO_INDEX = std::numeric_limits<Index>::max();
+
+        Index AddStop(int stop_id, Distance coordinates);
+
+        void AddRoadDistance(int to_stop_id, int meters);
+
+        // buses are kept in the order they are added, callers add them sorted by name
+        void AddStopBus(int bus_id);
+
+        Index AddBus(int bus_id, bool is_roundtrip);
+
+        void AddBusStop(int stop_id);
+
+        // stats computed by Finalize of an earlier network, loaded as they were stored
+        void SetBusStats(int route_length, double curvature, Index unique_stop_count);
+
+        // Resolves ids to indices and computes the stats of the buses, unless every bus
+        // got them from SetBusStats; throws std::out_of_range on an id never added
+        void Finalize();
+
+        [[nodiscard]] size_t GetStopCount() const;
+
+        [[nodiscard]] size_t GetBusCount() const;
+
+        [[nodiscard]] Index GetStopIndex(int stop_id) const;
+
+        [[nodiscard]] Index GetBusIndex(int bus_id) const;
+
+        [[nodiscard]] int GetStopId(Index stop) const;
+
+        [[nodiscard]] int GetBusId(Index bus) const;
+
+        [[nodiscard]] Distance GetCoordinates(Index stop) const;
+
+        [[nodiscard]] IndexRange GetAdjacentStops(Index stop) const;
+
+        [[nodiscard]] int GetAdjacentDistance(Index stop, size_t i) const;
+
+        // road distance from -> to, or to -> from if only that one is known
+        [[nodiscard]] int GetRoadDistance(Index from, Index to) const;
+
+        [[nodiscard]] IndexRange GetStopBuses(Index stop) const;
+
+        [[nodiscard]] IndexRange GetBusStops(Index bus) const;
+
+        [[nodiscard]] bool IsRoundtrip(Index bus) const;
+
+        [[nodiscard]] int GetRouteLength(Index bus) const;
+
+        [[nodiscard]] double GetCurvature(Index bus) const;
+
+        [[nodiscard]] size_t GetUniqueStopCount(Index bus) const;
+
+    private:
+        static constexpr size_t MIN_BUSES_PER_THREAD = 64;
+
+        static std::vector<Index> MakeIndex(std::vector<int> const &ids);
+
+        std::vector<int> stop_ids;
+        std::vector<double> latitudes;
+        std::vector<double> longitudes;
+        GeoPoints geo_points;
+        std::vector<Index> adjacency_offsets{0};
+        std::vector<Index> adjacent_stops;
+        std::vector<int> adjacent_distances;
+        std::vector<Index> stop_bus_offsets{0};
+        std::vector<Index> stop_buses;
+
+        std::vector<int> bus_ids;
+        std::vector<uint8_t> roundtrip_flags;
+        std::vector<Index> bus_stop_offsets{0};
+        std::vector<Index> bus_stops;
+
+        std::vector<int> route_lengths;
+        std::vector<double> curvatures;
+        std::vector<Index> unique_stop_counts;
+
+        std::vector<Index> stop_index_by_id;
+        std::vector<Index> bus_index_by_id;
+    };
+}
+
+#endif //TRANSPORT_NETWORK_H
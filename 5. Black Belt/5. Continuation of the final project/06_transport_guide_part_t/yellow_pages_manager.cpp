@@ -2,11 +2,16 @@
 
 #include <list>
 
-Data_Structure::DataBaseYellowPages::DataBaseYellowPages(YellowPages::Database new_db) : db(std::move(new_db)) {}
+Data_Structure::DataBaseYellowPages::DataBaseYellowPages(YellowPages::Database new_db) : owned_db(std::move(new_db)),
+                                                                                       db(&owned_db) {}
+
+Data_Structure::DataBaseYellowPages::DataBaseYellowPages(YellowPages::Database const &parsed_db,
+                                                         std::shared_ptr<google::protobuf::Arena> arena_)
+        : arena(std::move(arena_)), db(&parsed_db) {}
 
 ResponseType Data_Structure::DataBaseYellowPages::FindCompanies(const std::vector<std::shared_ptr<Query>> &queries) {
     std::list<const YellowPages::Company *> companies;
-    for (auto &el: db.companies()) {
+    for (auto &el: db->companies()) {
         companies.push_back(&el);
     }
     for (auto &query: queries) {
@@ -3,8 +3,11 @@
 
 #include <string>
 #include <list>
+#include <memory>
 #include <vector>
 
+#include <google/protobuf/arena.h>
+
 #include "interval_map.h"
 #include "responses.h"
 
@@ -71,22 +74,31 @@ namespace Data_Structure {
     public:
         explicit DataBaseYellowPages(YellowPages::Database new_db);
 
-        inline YellowPages::Database Serialize() {
-            return db;
+        // Uses parsed_db in place; arena owns it and is kept alive as long as this object.
+        DataBaseYellowPages(YellowPages::Database const &parsed_db, std::shared_ptr<google::protobuf::Arena> arena);
+
+        DataBaseYellowPages(DataBaseYellowPages const &) = delete;
+
+        DataBaseYellowPages &operator=(DataBaseYellowPages const &) = delete;
+
+        [[nodiscard]] const YellowPages::Database &Serialize() const {
+            return *db;
         };
 
         const YellowPages::Database &GetOrigin() const {
-            return db;
+            return *db;
         };
 
         [[nodiscard]] YellowPages::Rubric const &GetRubric(size_t id) const {
-            return db.rubrics().at(id);
+            return db->rubrics().at(id);
         }
 
         [[nodiscard]] ResponseType FindCompanies(const std::vector<std::shared_ptr<Query>> &queries);
 
     private:
-        YellowPages::Database db;
+        std::shared_ptr<google::protobuf::Arena> arena;
+        YellowPages::Database owned_db;
+        YellowPages::Database const *db;
     };
 }
 #endif //YELLOW_PAGES_MANAGER_H
@@ -1,13 +1,15 @@
 #include "FormulaAST.h"
-#include "FormulaBaseListener.h"
-#include "FormulaLexer.h"
-#include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
+#include <climits>
 #include <cmath>
+#include <cstdlib>
+#include <iterator>
 #include <memory>
 #include <optional>
-#include <sstream>
+#include <string>
+#include <unordered_map>
 
 namespace ASTImpl {
 
@@ -82,6 +84,9 @@ PR_BOTH,  PR_BOTH,  PR_NONE,  PR_NONE,  PR_NONE, PR_NONE},
 PR_NONE,  PR_NONE,  PR_NONE,  PR_NONE,  PR_NONE, PR_NONE},
 };
 
+// maps a node of FormulaAST::cells_ or FormulaAST::aggregates_ to its index in the list
+using CellIndices = std::unordered_map<const void *, uint32_t>;
+
 class Expr {
 public:
     virtual ~Expr() = default;
@@ -91,7 +96,12 @@ public:
     virtual void DoPrintFormula(std::ostream &out,
                                 ExprPrecedence precedence) const = 0;
 
-    virtual double Evaluate(const CellLookup &cell_lookup) const = 0;
+    virtual double Evaluate(const CellLookup &cell_lookup,
+                            const AggregateLookup &aggregate_lookup) const = 0;
+
+    // appends the postfix code of the subtree to program
+    virtual void Compile(std::vector <Instruction> &program,
+                         const CellIndices &cell_indices) const = 0;
 
     // higher is tighter
     virtual ExprPrecedence GetPrecedence() const = 0;
@@ -163,9 +173,10 @@ namespace {
             }
         }
 
-        double Evaluate(const CellLookup &cell_lookup) const override {
-            auto lhs_value = lhs_->Evaluate(cell_lookup);
-            auto rhs_value = rhs_->Evaluate(cell_lookup);
+        double Evaluate(const CellLookup &cell_lookup,
+                        const AggregateLookup &aggregate_lookup) const override {
+            auto lhs_value = lhs_->Evaluate(cell_lookup, aggregate_lookup);
+            auto rhs_value = rhs_->Evaluate(cell_lookup, aggregate_lookup);
 
             double result = NAN;
             switch (type_) {
@@ -190,6 +201,29 @@ namespace {
             return result;
         }
 
+        void Compile(std::vector <Instruction> &program,
+                     const CellIndices &cell_indices) const override {
+            lhs_->Compile(program, cell_indices);
+            rhs_->Compile(program, cell_indices);
+
+            Instruction instruction{};
+            switch (type_) {
+                case Add:
+                    instruction.code = Instruction::Code::Add;
+                    break;
+                case Subtract:
+                    instruction.code = Instruction::Code::Subtract;
+                    break;
+                case Multiply:
+                    instruction.code = Instruction::Code::Multiply;
+                    break;
+                case Divide:
+                    instruction.code = Instruction::Code::Divide;
+                    break;
+            }
+            program.push_back(instruction);
+        }
+
     private:
         Type type_;
         std::unique_ptr <Expr> lhs_;
@@ -224,8 +258,9 @@ namespace {
             return EP_UNARY;
         }
 
-        double Evaluate(const CellLookup &cell_lookup) const override {
-            auto operand_value = operand_->Evaluate(cell_lookup);
+        double Evaluate(const CellLookup &cell_lookup,
+                        const AggregateLookup &aggregate_lookup) const override {
+            auto operand_value = operand_->Evaluate(cell_lookup, aggregate_lookup);
             switch (type_) {
                 case UnaryPlus:
                     return +operand_value;
@@ -239,6 +274,17 @@ namespace {
             }
         }
 
+        void Compile(std::vector <Instruction> &program,
+                     const CellIndices &cell_indices) const override {
+            operand_->Compile(program, cell_indices);
+            // unary plus doesn't change the value
+            if (type_ == UnaryMinus) {
+                Instruction instruction{};
+                instruction.code = Instruction::Code::Negate;
+                program.push_back(instruction);
+            }
+        }
+
     private:
         Type type_;
         std::unique_ptr <Expr> operand_;
@@ -265,10 +311,19 @@ namespace {
             return EP_ATOM;
         }
 
-        double Evaluate(const CellLookup &cell_lookup) const override {
+        double Evaluate(const CellLookup &cell_lookup,
+                        const AggregateLookup &) const override {
             return cell_lookup(*cell_);
         }
 
+        void Compile(std::vector <Instruction> &program,
+                     const CellIndices &cell_indices) const override {
+            Instruction instruction{};
+            instruction.code = Instruction::Code::Cell;
+            instruction.index = cell_indices.at(cell_);
+            program.push_back(instruction);
+        }
+
     private:
         const Position *cell_;
     };
@@ -290,147 +345,383 @@ namespace {
             return EP_ATOM;
         }
 
-        double Evaluate(const CellLookup &) const override {
+        double Evaluate(const CellLookup &, const AggregateLookup &) const override {
             return value_;
         }
 
+        void Compile(std::vector <Instruction> &program,
+                     const CellIndices &) const override {
+            Instruction instruction{};
+            instruction.code = Instruction::Code::Number;
+            instruction.number = value_;
+            program.push_back(instruction);
+        }
+
     private:
         double value_;
     };
 
-    class ParseASTListener final : public FormulaBaseListener {
+    class AggregateExpr final : public Expr {
     public:
-        std::unique_ptr <Expr> MoveRoot() {
-            assert(args_.size() == 1);
-            auto root = std::move(args_.front());
-            args_.clear();
+        explicit AggregateExpr(const RangeAggregate *aggregate) : aggregate_(aggregate) {}
 
-            return root;
+        void Print(std::ostream &out) const override {
+            out << ToString(aggregate_->function) << '(' << aggregate_->range.ToString() << ')';
         }
 
-        std::forward_list <Position> MoveCells() {
-            return std::move(cells_);
+        void DoPrintFormula(std::ostream &out,
+                            ExprPrecedence /* precedence */) const override {
+            Print(out);
         }
 
-    public:
-        void exitUnaryOp(FormulaParser::UnaryOpContext *ctx) override {
-            assert(args_.size() >= 1);
+        ExprPrecedence GetPrecedence() const override {
+            return EP_ATOM;
+        }
 
-            auto operand = std::move(args_.back());
+        double Evaluate(const CellLookup &,
+                        const AggregateLookup &aggregate_lookup) const override {
+            const auto &range = aggregate_->range;
+            if (!range.IsValid()) {
+                throw FormulaError(FormulaError::Category::Ref);
+            }
 
-            UnaryOpExpr::Type type;
-            if (ctx->SUB()) {
-                type = UnaryOpExpr::UnaryMinus;
-            } else {
-                assert(ctx->ADD() != nullptr);
-                type = UnaryOpExpr::UnaryPlus;
+            // column by column, so that the first error is the one sheets report
+            RangeStats stats;
+            for (int col = range.first.col; col <= range.last.col; ++col) {
+                for (int row = range.first.row; row <= range.last.row; ++row) {
+                    stats.Add(aggregate_lookup({row, col}));
+                }
             }
 
-            auto node = std::make_unique<UnaryOpExpr>(type, std::move(operand));
-            args_.back() = std::move(node);
+            auto result = stats.Get(aggregate_->function);
+            if (const auto *error = std::get_if<FormulaError>(&result)) {
+                throw *error;
+            }
+            return std::get<double>(result);
         }
 
-        void exitLiteral(FormulaParser::LiteralContext *ctx) override {
-            double value = 0;
-            auto valueStr = ctx->NUMBER()->getSymbol()->getText();
-            std::istringstream in(valueStr);
-            in >> value;
-            if (!in) {
-                throw ParsingError("Invalid number: " + valueStr);
-            }
+        void Compile(std::vector <Instruction> &program,
+                     const CellIndices &cell_indices) const override {
+            Instruction instruction{};
+            instruction.code = Instruction::Code::Aggregate;
+            instruction.index = cell_indices.at(aggregate_);
+            program.push_back(instruction);
+        }
+
+    private:
+        const RangeAggregate *aggregate_;
+    };
+
+    // Splits a formula into tokens:
+    //   NUMBER    UINT EXPONENT? | UINT? '.' UINT EXPONENT? | UINT '.' UINT? EXPONENT?,
+    //             where EXPONENT is [eE] [+-]? UINT
+    //   FUNCTION  SUM | MIN | MAX | AVERAGE | COUNT
+    //   CELL      [A-Z]+ [0-9]+
+    //   + - * / ( ) :
+    // Spaces, tabs and line breaks between tokens are skipped. As with any longest-match
+    // lexer, SUM1 is a cell and not a function followed by a number.
+    class Lexer {
+    public:
+        enum class TokenType {
+            Number,
+            Function,
+            Cell,
+            Add,
+            Sub,
+            Mul,
+            Div,
+            LeftParen,
+            RightParen,
+            Colon,
+            End,
+        };
 
-            auto node = std::make_unique<NumberExpr>(value);
-            args_.push_back(std::move(node));
+        struct Token {
+            TokenType type;
+            std::string_view text;
+        };
+
+        explicit Lexer(std::string_view in) : in_(in) {
+            Advance();
         }
 
-        void exitCell(FormulaParser::CellContext *ctx) override {
-            auto value_str = ctx->CELL()->getSymbol()->getText();
-            auto value = Position::FromString(value_str);
-            if (!value.IsValid()) {
-                throw FormulaException("Invalid position: " + value_str);
+        const Token &Peek() const {
+            return current_;
+        }
+
+        Token Next() {
+            Token token = current_;
+            Advance();
+            return token;
+        }
+
+        static bool IsDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+    private:
+        void Advance() {
+            while (pos_ < in_.size() && IsSpace(in_[pos_])) {
+                ++pos_;
+            }
+            if (pos_ == in_.size()) {
+                current_ = {TokenType::End, {}};
+                return;
             }
 
-            cells_.push_front(value);
-            auto node = std::make_unique<CellExpr>(&cells_.front());
-            args_.push_back(std::move(node));
+            const size_t start = pos_;
+            const char c = in_[pos_];
+            TokenType type;
+            if (IsDigit(c) || c == '.') {
+                type = TokenType::Number;
+                ScanNumber();
+            } else if (IsUpper(c)) {
+                ScanWhile(IsUpper);
+                const size_t letters_end = pos_;
+                ScanWhile(IsDigit);
+                if (pos_ > letters_end) {
+                    type = TokenType::Cell;
+                } else if (ParseAggregateFunction(in_.substr(start, pos_ - start))) {
+                    type = TokenType::Function;
+                } else {
+                    throw ParsingError("Error when lexing: unknown name " +
+                                       std::string(in_.substr(start, pos_ - start)));
+                }
+            } else {
+                type = GetOperatorType(c);
+                ++pos_;
+            }
+            current_ = {type, in_.substr(start, pos_ - start)};
         }
 
-        void exitBinaryOp(FormulaParser::BinaryOpContext *ctx) override {
-            assert(args_.size() >= 2);
+        void ScanNumber() {
+            const size_t int_digits = ScanWhile(IsDigit);
+            size_t frac_digits = 0;
+            if (pos_ < in_.size() && in_[pos_] == '.') {
+                ++pos_;
+                frac_digits = ScanWhile(IsDigit);
+            }
+            if (int_digits == 0 && frac_digits == 0) {
+                throw ParsingError("Error when lexing: a number without digits");
+            }
 
-            auto rhs = std::move(args_.back());
-            args_.pop_back();
+            // the exponent belongs to the number only if it has digits
+            if (pos_ < in_.size() && (in_[pos_] == 'e' || in_[pos_] == 'E')) {
+                size_t exponent = pos_ + 1;
+                if (exponent < in_.size() && (in_[exponent] == '+' || in_[exponent] == '-')) {
+                    ++exponent;
+                }
+                if (exponent < in_.size() && IsDigit(in_[exponent])) {
+                    pos_ = exponent;
+                    ScanWhile(IsDigit);
+                }
+            }
+        }
 
-            auto lhs = std::move(args_.back());
+        size_t ScanWhile(bool (*matches)(char)) {
+            const size_t start = pos_;
+            while (pos_ < in_.size() && matches(in_[pos_])) {
+                ++pos_;
+            }
+            return pos_ - start;
+        }
 
-            BinaryOpExpr::Type type;
-            if (ctx->ADD()) {
-                type = BinaryOpExpr::Add;
-            } else if (ctx->SUB()) {
-                type = BinaryOpExpr::Subtract;
-            } else if (ctx->MUL()) {
-                type = BinaryOpExpr::Multiply;
-            } else {
-                assert(ctx->DIV() != nullptr);
-                type = BinaryOpExpr::Divide;
+        static TokenType GetOperatorType(char c) {
+            switch (c) {
+                case '+':
+                    return TokenType::Add;
+                case '-':
+                    return TokenType::Sub;
+                case '*':
+                    return TokenType::Mul;
+                case '/':
+                    return TokenType::Div;
+                case '(':
+                    return TokenType::LeftParen;
+                case ')':
+                    return TokenType::RightParen;
+                case ':':
+                    return TokenType::Colon;
+                default:
+                    throw ParsingError(std::string("Error when lexing: unexpected character '") + c + "'");
             }
+        }
 
-            auto node = std::make_unique<BinaryOpExpr>(type, std::move(lhs),
-                                                       std::move(rhs));
-            args_.back() = std::move(node);
+        static bool IsSpace(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r';
         }
 
-        void visitErrorNode(antlr4::tree::ErrorNode *node) override {
-            throw ParsingError("Error when parsing: " +
-                               node->getSymbol()->getText());
+        static bool IsUpper(char c) {
+            return c >= 'A' && c <= 'Z';
         }
 
-    private:
-        std::vector <std::unique_ptr<Expr>> args_;
-        std::forward_list <Position> cells_;
+        std::string_view in_;
+        size_t pos_ = 0;
+        Token current_{TokenType::End, {}};
     };
 
-    class BailErrorListener : public antlr4::BaseErrorListener {
+    // Recursive descent over the formula grammar, one function per precedence level:
+    //   expr   : term (('+' | '-') term)*
+    //   term   : unary (('*' | '/') unary)*
+    //   unary  : ('+' | '-') unary | atom
+    //   atom   : NUMBER | CELL | FUNCTION '(' CELL ':' CELL ')' | '(' expr ')'
+    // Binary operators are left-associative and unary ones bind tighter than any of them,
+    // so the resulting tree, and thus PrintFormula, is the one the grammar has always given.
+    class Parser {
     public:
-        void syntaxError(antlr4::Recognizer * /* recognizer */,
-                         antlr4::Token * /* offendingSymbol */, size_t /* line */,
-                         size_t /* charPositionInLine */, const std::string &msg,
-                         std::exception_ptr /* e */
-        ) override {
-            throw ParsingError("Error when lexing: " + msg);
+        explicit Parser(std::string_view in) : lexer_(in) {}
+
+        FormulaAST Parse() {
+            auto root = ParseExpr();
+            if (lexer_.Peek().type != Lexer::TokenType::End) {
+                ThrowUnexpected();
+            }
+            return FormulaAST(std::move(root), std::move(cells_), std::move(aggregates_));
         }
-    };
 
-}  // namespace
-}  // namespace ASTImpl
+    private:
+        using TokenType = Lexer::TokenType;
+
+        std::unique_ptr <Expr> ParseExpr() {
+            auto lhs = ParseTerm();
+            for (;;) {
+                BinaryOpExpr::Type type;
+                if (lexer_.Peek().type == TokenType::Add) {
+                    type = BinaryOpExpr::Add;
+                } else if (lexer_.Peek().type == TokenType::Sub) {
+                    type = BinaryOpExpr::Subtract;
+                } else {
+                    return lhs;
+                }
+                lexer_.Next();
+                lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseTerm());
+            }
+        }
 
-FormulaAST ParseFormulaAST(std::istream &in) {
-    using namespace antlr4;
+        std::unique_ptr <Expr> ParseTerm() {
+            auto lhs = ParseUnary();
+            for (;;) {
+                BinaryOpExpr::Type type;
+                if (lexer_.Peek().type == TokenType::Mul) {
+                    type = BinaryOpExpr::Multiply;
+                } else if (lexer_.Peek().type == TokenType::Div) {
+                    type = BinaryOpExpr::Divide;
+                } else {
+                    return lhs;
+                }
+                lexer_.Next();
+                lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseUnary());
+            }
+        }
+
+        std::unique_ptr <Expr> ParseUnary() {
+            UnaryOpExpr::Type type;
+            if (lexer_.Peek().type == TokenType::Add) {
+                type = UnaryOpExpr::UnaryPlus;
+            } else if (lexer_.Peek().type == TokenType::Sub) {
+                type = UnaryOpExpr::UnaryMinus;
+            } else {
+                return ParseAtom();
+            }
+            lexer_.Next();
+            return std::make_unique<UnaryOpExpr>(type, ParseUnary());
+        }
+
+        std::unique_ptr <Expr> ParseAtom() {
+            switch (lexer_.Peek().type) {
+                case TokenType::Number:
+                    return std::make_unique<NumberExpr>(ParseNumber(lexer_.Next().text));
+                case TokenType::Cell:
+                    cells_.push_front(ParseCell(lexer_.Next().text));
+                    return std::make_unique<CellExpr>(&cells_.front());
+                case TokenType::Function:
+                    return ParseAggregate();
+                case TokenType::LeftParen: {
+                    lexer_.Next();
+                    auto expr = ParseExpr();
+                    Expect(TokenType::RightParen);
+                    return expr;
+                }
+                default:
+                    ThrowUnexpected();
+            }
+        }
 
-    ANTLRInputStream input(in);
+        std::unique_ptr <Expr> ParseAggregate() {
+            const auto function = *ParseAggregateFunction(lexer_.Next().text);
+            Expect(TokenType::LeftParen);
+            const auto first = ParseCell(Expect(TokenType::Cell).text);
+            Expect(TokenType::Colon);
+            const auto last = ParseCell(Expect(TokenType::Cell).text);
+            Expect(TokenType::RightParen);
+
+            // B5:A1 is the same range as A1:B5
+            Range range{
+                    {std::min(first.row, last.row), std::min(first.col, last.col)},
+                    {std::max(first.row, last.row), std::max(first.col, last.col)},
+            };
+            aggregates_.push_front({function, range});
+            return std::make_unique<AggregateExpr>(&aggregates_.front());
+        }
 
-    FormulaLexer lexer(&input);
-    ASTImpl::BailErrorListener error_listener;
-    lexer.removeErrorListeners();
-    lexer.addErrorListener(&error_listener);
+        static double ParseNumber(std::string_view text) {
+            // short integers are the usual case, and any of them is exact in a double
+            if (text.size() <= 15 && std::all_of(text.begin(), text.end(), Lexer::IsDigit)) {
+                double value = 0;
+                for (char c: text) {
+                    value = value * 10 + (c - '0');
+                }
+                return value;
+            }
 
-    CommonTokenStream tokens(&lexer);
+            // the number is copied to get a terminating zero for strtod
+            const std::string value_str(text);
+            char *end = nullptr;
+            const double value = std::strtod(value_str.c_str(), &end);
+            if (end != value_str.c_str() + value_str.size() || std::isinf(value)) {
+                throw ParsingError("Invalid number: " + value_str);
+            }
+            return value;
+        }
 
-    FormulaParser parser(&tokens);
-    auto error_handler = std::make_shared<BailErrorStrategy>();
-    parser.setErrorHandler(error_handler);
-    parser.removeErrorListeners();
+        static Position ParseCell(std::string_view text) {
+            auto value = Position::FromString(text);
+            if (!value.IsValid()) {
+                throw FormulaException("Invalid position: " + std::string(text));
+            }
+            return value;
+        }
 
-    tree::ParseTree *tree = parser.main();
-    ASTImpl::ParseASTListener listener;
-    tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
+        Lexer::Token Expect(TokenType type) {
+            if (lexer_.Peek().type != type) {
+                ThrowUnexpected();
+            }
+            return lexer_.Next();
+        }
+
+        [[noreturn]] void ThrowUnexpected() const {
+            const auto &token = lexer_.Peek();
+            if (token.type == TokenType::End) {
+                throw ParsingError("Error when parsing: unexpected end of formula");
+            }
+            throw ParsingError("Error when parsing: " + std::string(token.text));
+        }
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+        Lexer lexer_;
+        std::forward_list <Position> cells_;
+        std::forward_list <RangeAggregate> aggregates_;
+    };
+
+}  // namespace
+}  // namespace ASTImpl
+
+FormulaAST ParseFormulaAST(std::string_view in) {
+    return ASTImpl::Parser(in).Parse();
 }
 
-FormulaAST ParseFormulaAST(const std::string &in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+FormulaAST ParseFormulaAST(std::istream &in) {
+    const std::string in_str(std::istreambuf_iterator<char>(in), {});
+    return ParseFormulaAST(in_str);
 }
 
 void FormulaAST::PrintCells(std::ostream &out) const {
@@ -447,15 +738,53 @@ void FormulaAST::PrintFormula(std::ostream &out) const {
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute(const CellLookup &cell_lookup) const {
-    return root_expr_->Evaluate(cell_lookup);
+double FormulaAST::Execute(const CellLookup &cell_lookup,
+                           const AggregateLookup &aggregate_lookup) const {
+    return root_expr_->Evaluate(cell_lookup, aggregate_lookup);
+}
+
+double FormulaAST::Execute(const std::vector <CellValue> &cell_values,
+                           const std::vector <CellValue> &aggregate_values) const {
+    return Execute([&cell_values](uint32_t index) -> const CellValue & { return cell_values[index]; },
+                   [&aggregate_values](uint32_t index) -> const CellValue & {
+                       return aggregate_values[index];
+                   });
 }
 
 FormulaAST::FormulaAST(std::unique_ptr <ASTImpl::Expr> root_expr,
-                       std::forward_list <Position> cells) :
+                       std::forward_list <Position> cells,
+                       std::forward_list <RangeAggregate> aggregates) :
         root_expr_(std::move(root_expr)),
-        cells_(std::move(cells)) {
+        cells_(std::move(cells)),
+        aggregates_(std::move(aggregates)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+
+    // sort() relinks the nodes without moving them, so cell expressions still
+    // point into cells_ and can be numbered in the final list order
+    ASTImpl::CellIndices cell_indices;
+    for (const auto &cell: cells_) {
+        cell_indices.emplace(&cell, static_cast<uint32_t>(cell_indices.size()));
+    }
+    uint32_t aggregate_index = 0;
+    for (const auto &aggregate: aggregates_) {
+        cell_indices.emplace(&aggregate, aggregate_index++);
+    }
+    root_expr_->Compile(program_, cell_indices);
+
+    size_t size = 0;
+    for (const auto &instruction: program_) {
+        switch (instruction.code) {
+            case ASTImpl::Instruction::Code::Number:
+            case ASTImpl::Instruction::Code::Cell:
+            case ASTImpl::Instruction::Code::Aggregate:
+                max_stack_size_ = std::max(max_stack_size_, ++size);
+                break;
+            case ASTImpl::Instruction::Code::Negate:
+                break;
+            default:
+                --size;
+        }
+    }
 }
 
 FormulaAST::~FormulaAST() = default;
@@ -1,17 +1,49 @@
 #pragma once
 
 #include "common.h"
+#include "range.h"
 
-#include "FormulaLexer.h"
-
+#include <cassert>
+#include <cmath>
+#include <cstdint>
 #include <forward_list>
 #include <functional>
+#include <istream>
 #include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <variant>
+#include <vector>
 
 using CellLookup = std::function<double(Position)>;
 
+// what a cell contributes to aggregates, the way sheets aggregate it: nothing for
+// empty and non-numeric text cells
+using AggregateLookup = std::function<AggregatedValue(Position)>;
+
 namespace ASTImpl {
     class Expr;
+
+    // a single step of a formula compiled to postfix order:
+    // operands are pushed onto a stack, operators replace their arguments with the result
+    struct Instruction {
+        enum class Code : uint8_t {
+            Number,
+            Cell,
+            Aggregate,
+            Add,
+            Subtract,
+            Multiply,
+            Divide,
+            Negate,
+        };
+
+        Code code;
+        // for Cell and Aggregate: index of the operand in GetCells() or GetAggregates() order
+        uint32_t index = 0;
+        // for Number
+        double number = 0;
+    };
 }
 
 class ParsingError : public std::runtime_error {
@@ -21,7 +53,8 @@ class ParsingError : public std::runtime_error {
 class FormulaAST {
 public:
     explicit FormulaAST(std::unique_ptr <ASTImpl::Expr> root_expr,
-                        std::forward_list <Position> cells);
+                        std::forward_list <Position> cells,
+                        std::forward_list <RangeAggregate> aggregates = {});
 
     FormulaAST(FormulaAST &&) = default;
 
@@ -29,7 +62,25 @@ public:
 
     ~FormulaAST();
 
-    double Execute(const CellLookup &cell_lookup) const;
+    // a referenced cell or aggregate as seen by a formula: a number or the error it evaluates to
+    using CellValue = std::variant<double, FormulaError>;
+
+    // walks the expression tree, looking cells up one by one;
+    // aggregates read every cell of their range through aggregate_lookup
+    double Execute(const CellLookup &cell_lookup, const AggregateLookup &aggregate_lookup) const;
+
+    // runs the compiled program, reading each operand only when it is reached:
+    // read_cell(i) is the value of the i-th cell in GetCells() order, read_aggregate(i) the result
+    // of the i-th aggregate in GetAggregates() order. A template, so that the readers are inlined;
+    // readers taking a Position go to the tree walk above
+    template<typename ReadCell, typename ReadAggregate,
+             typename = std::enable_if_t<std::is_invocable_v<const ReadCell &, uint32_t>>>
+    double Execute(const ReadCell &read_cell, const ReadAggregate &read_aggregate) const;
+
+    // runs the compiled program; cell_values[i] is the value of the i-th cell in GetCells() order,
+    // aggregate_values[i] is the result of the i-th aggregate in GetAggregates() order
+    double Execute(const std::vector <CellValue> &cell_values,
+                   const std::vector <CellValue> &aggregate_values = {}) const;
 
     void PrintCells(std::ostream &out) const;
 
@@ -45,6 +96,14 @@ public:
         return cells_;
     }
 
+    std::forward_list <RangeAggregate> &GetAggregates() {
+        return aggregates_;
+    }
+
+    const std::forward_list <RangeAggregate> &GetAggregates() const {
+        return aggregates_;
+    }
+
 private:
     std::unique_ptr <ASTImpl::Expr> root_expr_;
 
@@ -52,8 +111,81 @@ private:
     // efficiently traversed without going through
     // the whole AST
     std::forward_list <Position> cells_;
+
+    // SUM(A1:B5) and the like, stored apart from cells_ for the same reason; their
+    // ranges are not single cell references and are not reported by GetCells()
+    std::forward_list <RangeAggregate> aggregates_;
+
+    // the same expression in postfix order; refers to cells and aggregates by index,
+    // so renaming cells_ and aggregates_ in place on row/column changes keeps it valid
+    std::vector <ASTImpl::Instruction> program_;
+    size_t max_stack_size_ = 0;
 };
 
-FormulaAST ParseFormulaAST(std::istream &in);
+template<typename ReadCell, typename ReadAggregate, typename>
+double FormulaAST::Execute(const ReadCell &read_cell, const ReadAggregate &read_aggregate) const {
+    using Code = ASTImpl::Instruction::Code;
+
+    // formulas are short, so the stack almost always fits into a local buffer
+    constexpr size_t kLocalStackSize = 32;
+    double local_stack[kLocalStackSize];
+    std::vector<double> heap_stack;
+    double *stack = local_stack;
+    if (max_stack_size_ > kLocalStackSize) {
+        heap_stack.resize(max_stack_size_);
+        stack = heap_stack.data();
+    }
+
+    size_t size = 0;
+    for (const auto &instruction: program_) {
+        switch (instruction.code) {
+            case Code::Number:
+                stack[size++] = instruction.number;
+                break;
+            case Code::Cell:
+            case Code::Aggregate: {
+                const auto &value = instruction.code == Code::Cell
+                                    ? read_cell(instruction.index)
+                                    : read_aggregate(instruction.index);
+                if (const auto *error = std::get_if<FormulaError>(&value)) {
+                    throw *error;
+                }
+                stack[size++] = std::get<double>(value);
+                break;
+            }
+            case Code::Negate:
+                stack[size - 1] = -stack[size - 1];
+                break;
+            default: {
+                const double rhs = stack[--size];
+                double &lhs = stack[size - 1];
+                switch (instruction.code) {
+                    case Code::Add:
+                        lhs += rhs;
+                        break;
+                    case Code::Subtract:
+                        lhs -= rhs;
+                        break;
+                    case Code::Multiply:
+                        lhs *= rhs;
+                        break;
+                    default:
+                        lhs /= rhs;
+                        break;
+                }
+                if (!std::isfinite(lhs)) {
+                    throw FormulaError(FormulaError::Category::Div0);
+                }
+            }
+        }
+    }
+
+    assert(size == 1);
+    return stack[0];
+}
 
-FormulaAST ParseFormulaAST(const std::string &in_str);
+// parses an expression without the leading '=';
+// throws ParsingError on malformed input and FormulaException on out of range cells
+FormulaAST ParseFormulaAST(std::string_view in);
+
+FormulaAST ParseFormulaAST(std::istream &in);
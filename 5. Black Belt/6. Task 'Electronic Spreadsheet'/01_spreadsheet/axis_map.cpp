@@ -0,0 +1,177 @@
+#include "axis_map.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+AxisMap::AxisMap(int size) : size_(size) {
+    root_ = NewNode(0, size);
+}
+
+int AxisMap::ToStorage(int index) const {
+    assert(index >= 0 && index < size_);
+    // Пока отрезок один, номер лишь сдвигается
+    if (nodes_[root_].length == size_) {
+        return nodes_[root_].stored + index;
+    }
+    int node = root_;
+    while (true) {
+        const Node &current = nodes_[node];
+        const int leftSize = Size(current.left);
+        if (index < leftSize) {
+            node = current.left;
+        } else if (index < leftSize + current.length) {
+            return current.stored + index - leftSize;
+        } else {
+            index -= leftSize + current.length;
+            node = current.right;
+        }
+    }
+}
+
+int AxisMap::FromStorage(int stored) const {
+    // Пока отрезок один, поиск по дереву не нужен
+    const Node &root = nodes_[root_];
+    if (root.length == size_) {
+        return stored >= root.stored && stored - root.stored < size_ ? stored - root.stored : -1;
+    }
+
+    auto it = byStored_.upper_bound(stored);
+    if (it == byStored_.begin()) {
+        return -1;
+    }
+    int node = std::prev(it)->second;
+    const int offset = stored - nodes_[node].stored;
+    if (offset >= nodes_[node].length) {
+        return -1;
+    }
+
+    // Номер складывается из номеров всех отрезков левее нашего: поднимаемся к
+    // корню и добавляем левые поддеревья, из которых пришли справа
+    int index = offset + Size(nodes_[node].left);
+    for (int parent = nodes_[node].parent; parent >= 0; node = parent, parent = nodes_[node].parent) {
+        if (nodes_[parent].right == node) {
+            index += Size(nodes_[parent].left) + nodes_[parent].length;
+        }
+    }
+    return index;
+}
+
+void AxisMap::Insert(int before, int count) {
+    before = std::min(before, size_);
+    count = std::min(count, size_ - before);
+    if (count <= 0) {
+        return;
+    }
+    auto [left, right] = Split(root_, before);
+    auto [kept, dropped] = Split(right, Size(right) - count);
+    root_ = Merge(Merge(left, dropped), kept);
+    nodes_[root_].parent = -1;
+}
+
+void AxisMap::Erase(int first, int count) {
+    first = std::min(first, size_);
+    count = std::min(count, size_ - first);
+    if (count <= 0) {
+        return;
+    }
+    auto [left, right] = Split(root_, first);
+    auto [erased, kept] = Split(right, count);
+    root_ = Merge(Merge(left, kept), erased);
+    nodes_[root_].parent = -1;
+}
+
+void AxisMap::ForEachRun(int first, int last,
+                         const std::function<void(int index, int stored, int length)> &visit) const {
+    first = std::max(first, 0);
+    last = std::min(last, size_ - 1);
+    if (first <= last) {
+        VisitRuns(root_, 0, first, last, visit);
+    }
+}
+
+int AxisMap::Size(int node) const {
+    return node < 0 ? 0 : nodes_[node].size;
+}
+
+void AxisMap::Update(int node) {
+    Node &current = nodes_[node];
+    current.size = current.length + Size(current.left) + Size(current.right);
+    if (current.left >= 0) {
+        nodes_[current.left].parent = node;
+    }
+    if (current.right >= 0) {
+        nodes_[current.right].parent = node;
+    }
+}
+
+int AxisMap::NewNode(int stored, int length) {
+    const Node node{stored, length, length, static_cast<uint32_t>(random_()), -1, -1, -1};
+    const int index = static_cast<int>(nodes_.size());
+    nodes_.push_back(node);
+    byStored_[stored] = index;
+    return index;
+}
+
+int AxisMap::Merge(int left, int right) {
+    if (left < 0) {
+        return right;
+    }
+    if (right < 0) {
+        return left;
+    }
+    if (nodes_[left].priority > nodes_[right].priority) {
+        const int merged = Merge(nodes_[left].right, right);
+        nodes_[left].right = merged;
+        Update(left);
+        return left;
+    }
+    const int merged = Merge(left, nodes_[right].left);
+    nodes_[right].left = merged;
+    Update(right);
+    return right;
+}
+
+std::pair<int, int> AxisMap::Split(int node, int count) {
+    if (node < 0) {
+        return {-1, -1};
+    }
+    const int leftSize = Size(nodes_[node].left);
+    if (count <= leftSize) {
+        auto [left, right] = Split(nodes_[node].left, count);
+        nodes_[node].left = right;
+        Update(node);
+        return {left, node};
+    }
+    if (count >= leftSize + nodes_[node].length) {
+        auto [left, right] = Split(nodes_[node].right, count - leftSize - nodes_[node].length);
+        nodes_[node].right = left;
+        Update(node);
+        return {node, right};
+    }
+
+    // Граница приходится на середину отрезка: хвост становится отдельным узлом
+    const int cut = count - leftSize;
+    const int tail = NewNode(nodes_[node].stored + cut, nodes_[node].length - cut);
+    nodes_[node].length = cut;
+    const int right = nodes_[node].right;
+    nodes_[node].right = -1;
+    Update(node);
+    return {node, Merge(tail, right)};
+}
+
+void AxisMap::VisitRuns(int node, int offset, int first, int last,
+                        const std::function<void(int, int, int)> &visit) const {
+    if (node < 0 || offset > last || offset + nodes_[node].size <= first) {
+        return;
+    }
+    const Node &current = nodes_[node];
+    VisitRuns(current.left, offset, first, last, visit);
+    const int begin = offset + Size(current.left);
+    const int runFirst = std::max(first, begin);
+    const int runLast = std::min(last, begin + current.length - 1);
+    if (runFirst <= runLast) {
+        visit(runFirst, current.stored + runFirst - begin, runLast - runFirst + 1);
+    }
+    VisitRuns(current.right, begin + current.length, first, last, visit);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Отображение номеров строк (или столбцов) листа в номера, под которыми они
+// лежат в хранилище ячеек. Вставка и удаление строк не двигают ячейки, а лишь
+// перестраивают отображение. Номера листа разбиты на отрезки, которые идут в
+// хранилище подряд; отрезки лежат в декартовом дереве по неявному ключу, так
+// что перевод номера в обе стороны, вставка и удаление стоят O(log отрезков).
+// Пока строки не вставляли и не удаляли, отрезок всего один. Номера в
+// хранилище не выходят за размер листа: строки, которые пропадают при
+// вставке или удалении, пусты, и их номера достаются новым строкам.
+class AxisMap {
+public:
+    // Вначале номер в хранилище совпадает с номером листа
+    explicit AxisMap(int size);
+
+    int ToStorage(int index) const;
+
+    // -1 для номера за пределами хранилища
+    int FromStorage(int stored) const;
+
+    // Заводит count новых номеров перед before, в хранилище под ними лежат
+    // последние count номеров листа. Ячеек там быть не должно
+    void Insert(int before, int count);
+
+    // Убирает номера [first, first + count) и заводит столько же новых в конце
+    // на их месте в хранилище. Ячеек в убираемых строках быть не должно
+    void Erase(int first, int count);
+
+    // Номера [first, last] кусками, которые лежат в хранилище подряд, по порядку
+    void ForEachRun(int first, int last,
+                    const std::function<void(int index, int stored, int length)> &visit) const;
+
+private:
+    struct Node {
+        int stored;
+        int length;
+        // Число номеров в поддереве
+        int size;
+        uint32_t priority;
+        int left;
+        int right;
+        int parent;
+    };
+
+    int Size(int node) const;
+
+    void Update(int node);
+
+    int NewNode(int stored, int length);
+
+    int Merge(int left, int right);
+
+    // Левое дерево получает первые count номеров, отрезок на границе режется
+    std::pair<int, int> Split(int node, int count);
+
+    void VisitRuns(int node, int offset, int first, int last,
+                   const std::function<void(int, int, int)> &visit) const;
+
+    // Узлы не освобождаются: каждый - отрезок номеров хранилища, а их не
+    // больше, чем номеров
+    std::vector<Node> nodes_;
+    // Первый номер отрезка в хранилище -> его узел
+    std::map<int, int> byStored_;
+    int root_ = -1;
+    int size_;
+    std::minstd_rand random_;
+};
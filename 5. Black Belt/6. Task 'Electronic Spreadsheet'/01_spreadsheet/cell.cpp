@@ -1,9 +1,14 @@
 #include "cell.h"
 #include "sheet.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <exception>
+#include <future>
 #include <optional>
-#include <stack>
+#include <string_view>
+#include <unordered_map>
 
 class Cell::Impl {
 public:
@@ -13,19 +18,45 @@ public:
 
     virtual std::string GetText() const = 0;
 
+    // Формулы читают число при каждом вычислении, поэтому оно лежит здесь и
+    // читается без виртуальных вызовов. У формулы оно верно, только пока
+    // IsCacheValid()
+    IFormula::Value GetNumber() const {
+        return number_;
+    }
+
+    virtual AggregatedValue GetAggregatedValue() const {
+        return ToAggregatedValue(GetValue());
+    }
+
     virtual std::vector <Position> GetReferencedCells() const {
         return {};
     }
 
+    virtual std::vector<Range> GetReferencedRanges() const {
+        return {};
+    }
+
     virtual IFormula *GetFormula() {
         return nullptr;
     }
 
-    virtual bool IsCacheValid() const {
-        return true;
+    bool IsCacheValid() const {
+        return cacheValid_.load(std::memory_order_acquire);
     }
 
     virtual void InvalidateCache() {}
+
+    virtual void Evaluate() {}
+
+protected:
+    explicit Impl(IFormula::Value number = 0.0, bool cacheValid = true) :
+            number_(number), cacheValid_(cacheValid) {}
+
+    // При параллельном пересчёте число читают другие потоки: флаг
+    // выставляется последним, чтобы они не увидели недописанное значение
+    mutable IFormula::Value number_;
+    mutable std::atomic<bool> cacheValid_;
 };
 
 class Cell::EmptyImpl : public Impl {
@@ -37,6 +68,10 @@ public:
     std::string GetText() const override {
         return "";
     }
+
+    AggregatedValue GetAggregatedValue() const override {
+        return std::nullopt;
+    }
 };
 
 class Cell::TextImpl : public Impl {
@@ -47,6 +82,18 @@ public:
                     "TextImpl should not contain empty text, use EmptyImpl for this "
                     "purpose.");
         }
+        // Формулы читают текст как число, разбираем его один раз здесь. Один
+        // знак экранирования - пустой текст, его формулы читают как 0
+        std::string_view value = text_;
+        if (value[0] == kEscapeSign) {
+            value.remove_prefix(1);
+        }
+        parsedNumber_ = ParseTextAsNumber(value);
+        if (parsedNumber_) {
+            number_ = *parsedNumber_;
+        } else if (!value.empty()) {
+            number_ = FormulaError(FormulaError::Category::Value);
+        }
     }
 
     Value GetValue() const override {
@@ -60,13 +107,19 @@ public:
         return text_;
     }
 
+    AggregatedValue GetAggregatedValue() const override {
+        return parsedNumber_;
+    }
+
 private:
     std::string text_;
+    std::optional<double> parsedNumber_;
 };
 
 class Cell::FormulaImpl : public Impl {
 public:
-    explicit FormulaImpl(std::string text, const ISheet &sheet) : sheet_(sheet) {
+    explicit FormulaImpl(std::string text, const ISheet &sheet) :
+            Impl(0.0, false), sheet_(sheet) {
         if (text.empty() || text[0] != kFormulaSign) {
             throw std::logic_error("A formula should start with '=' sign");
         }
@@ -74,10 +127,18 @@ public:
     }
 
     Value GetValue() const override {
-        if (!cachedValue_) {
-            cachedValue_ = formula_->Evaluate(sheet_);
+        // Обычно кеш уже заполнен пересчётом в Sheet, здесь лишь подстраховка
+        if (!IsCacheValid()) {
+            UpdateCache();
+        }
+        return std::visit([](const auto &x) { return Value(x); }, number_);
+    }
+
+    AggregatedValue GetAggregatedValue() const override {
+        if (!IsCacheValid()) {
+            UpdateCache();
         }
-        return std::visit([](const auto &x) { return Value(x); }, *cachedValue_);
+        return number_;
     }
 
     std::string GetText() const override {
@@ -88,27 +149,79 @@ public:
         return formula_->GetReferencedCells();
     }
 
+    std::vector<Range> GetReferencedRanges() const override {
+        return ::GetReferencedRanges(*formula_);
+    }
+
     IFormula *GetFormula() override {
         return formula_.get();
     }
 
-    bool IsCacheValid() const override {
-        return cachedValue_.has_value();
+    void InvalidateCache() override {
+        cacheValid_.store(false, std::memory_order_relaxed);
     }
 
-    void InvalidateCache() override {
-        cachedValue_.reset();
+    void Evaluate() override {
+        UpdateCache();
     }
 
 private:
+    void UpdateCache() const {
+        number_ = formula_->Evaluate(sheet_);
+        cacheValid_.store(true, std::memory_order_release);
+    }
+
     const ISheet &sheet_;
     std::unique_ptr <IFormula> formula_;
-    mutable std::optional <IFormula::Value> cachedValue_;
 };
 
+namespace {
+    // Меньше стольких формул на поток считать параллельно невыгодно
+    const size_t kMinFormulasPerThread = 256;
+    // Столько формул поток забирает из общей очереди за раз
+    const size_t kFormulasPerGrab = 32;
+
+    // Потоки забирают номера порциями из общего счётчика, так что
+    // освободившийся поток сразу берёт следующую порцию и нагрузка выравнивается
+    // сама собой, даже если формулы считаются разное время
+    void ParallelFor(size_t count, size_t threads,
+                     const std::function<void(size_t)> &process) {
+        threads = std::min(threads, count / kMinFormulasPerThread);
+        if (threads <= 1) {
+            for (size_t i = 0; i < count; ++i) {
+                process(i);
+            }
+            return;
+        }
+
+        std::atomic<size_t> next = 0;
+        auto worker = [&] {
+            for (size_t begin = next.fetch_add(kFormulasPerGrab); begin < count;
+                 begin = next.fetch_add(kFormulasPerGrab)) {
+                const size_t end = std::min(count, begin + kFormulasPerGrab);
+                for (size_t i = begin; i < end; ++i) {
+                    process(i);
+                }
+            }
+        };
+        std::vector<std::future<void>> futures;
+        for (size_t i = 1; i < threads; ++i) {
+            futures.push_back(std::async(std::launch::async, worker));
+        }
+        worker();
+        for (auto &future: futures) {
+            future.get();
+        }
+    }
+}
+
 Cell::Cell(Sheet &sheet) :
         impl_(std::make_unique<EmptyImpl>()),
-        sheet_(sheet) {}
+        sheet_(sheet),
+        // У новой ячейки ещё нет ссылок, и она может стоять перед всеми. Так
+        // ячейка, появившаяся внутри чужого диапазона, сразу окажется раньше
+        // формулы с этим диапазоном
+        order_(sheet.TakeOrderBeforeAll()) {}
 
 Cell::~Cell() {
     // Если ячейку удаляют, когда на неё существуют ссылки, то соответствующие
@@ -119,14 +232,7 @@ Cell::~Cell() {
 }
 
 void Cell::Set(std::string text) {
-    std::unique_ptr <Impl> newImpl;
-    if (text.empty()) {
-        newImpl = std::make_unique<EmptyImpl>();
-    } else if (text.size() > 1 && text[0] == kFormulaSign) {
-        newImpl = std::make_unique<FormulaImpl>(std::move(text), sheet_);
-    } else {
-        newImpl = std::make_unique<TextImpl>(std::move(text));
-    }
+    std::unique_ptr <Impl> newImpl = CreateImpl(std::move(text), sheet_);
 
     if (WouldIntroduceCircularDependency(*newImpl)) {
         throw CircularDependencyException(
@@ -137,12 +243,7 @@ void Cell::Set(std::string text) {
 
     UpdateRefs();
 
-    // Запускаем инвалидацию с флагом force, т.к. наше собственное значение только
-    // что было создано, и нам не важно, есть там кеш или нет, но все ячейки, что
-    // от нас зависят, точно нужно инвалидировать
-    // TODO do not force invalidate in case the cell was already invalid before
-    // the call
-    InvalidateCacheRecursive(true);
+    InvalidateDependents();
 }
 
 void Cell::Clear() {
@@ -150,6 +251,9 @@ void Cell::Clear() {
 }
 
 Cell::Value Cell::GetValue() const {
+    if (!impl_->IsCacheValid()) {
+        sheet_.Recalculate();
+    }
     return impl_->GetValue();
 }
 
@@ -161,50 +265,152 @@ std::vector <Position> Cell::GetReferencedCells() const {
     return impl_->GetReferencedCells();
 }
 
-void Cell::UpdateFormula(
-        const std::function<IFormula::HandlingResult(IFormula & )> &update) {
-    if (IFormula * formula = impl_->GetFormula()) {
-        auto result = update(*formula);
-        if (result == IFormula::HandlingResult::ReferencesChanged) {
-            UpdateRefs();
-        }
+bool Cell::IsReferenced() const {
+    return !incomingRefs_.empty();
+}
+
+Position Cell::GetPosition() const {
+    return sheet_.GetCellPosition(*this);
+}
+
+IFormula::Value Cell::GetNumber() const {
+    if (!impl_->IsCacheValid()) {
+        sheet_.Recalculate();
     }
+    return impl_->GetNumber();
 }
 
-bool Cell::IsReferenced() const {
-    return !incomingRefs_.empty();
+AggregatedValue Cell::GetAggregatedValue() const {
+    if (!impl_->IsCacheValid()) {
+        return std::nullopt;
+    }
+    return impl_->GetAggregatedValue();
 }
 
-bool Cell::WouldIntroduceCircularDependency(const Impl &newImpl) const {
-    if (newImpl.GetReferencedCells().empty()) {
+bool Cell::WouldIntroduceCircularDependency(const Impl &newImpl) {
+    // Топологический порядок поддерживается алгоритмом Пирса-Келли. Цикл
+    // может замкнуть только ссылка на ячейку, стоящую в порядке позже нас, а
+    // переставлять при этом нужно лишь ячейки между нами и ею
+    const auto refs = newImpl.GetReferencedCells();
+    const auto ranges = newImpl.GetReferencedRanges();
+    if (refs.empty() && ranges.empty()) {
         return false;
     }
 
-    std::unordered_set<const Cell *> referenced;
-    for (const auto &pos: newImpl.GetReferencedCells()) {
-        referenced.insert(sheet_.GetConcreteCell(pos));
+    std::vector<Cell *> referenced;
+    for (const auto &pos: refs) {
+        if (Cell *cell = sheet_.GetConcreteCell(pos)) {
+            referenced.push_back(cell);
+        }
+    }
+    // Диапазон проверяется по позиции, так что ячейки внутри него не нужно
+    // перебирать, и даже несуществующие пока ячейки ему не мешают
+    const Position position = GetPosition();
+    if (std::find(referenced.begin(), referenced.end(), this) != referenced.end() ||
+        std::any_of(ranges.begin(), ranges.end(), [position](const Range &range) {
+            return range.Contains(position);
+        })) {
+        return true;
+    }
+
+    // От ячейки без зависимых цикл не замкнуть, её достаточно поставить в конец
+    bool hasDependents = false;
+    ForEachDependent([&hasDependents](Cell *) { hasDependents = true; });
+    if (!hasDependents) {
+        order_ = sheet_.TakeOrderAfterAll();
+        return false;
     }
 
-    std::unordered_set<const Cell *> visited;
-    std::stack<const Cell *> toVisit;
-    toVisit.push(this);
+    std::unordered_set<Cell *> sources;
+    int64_t upperOrder = order_;
+    auto addSource = [&](Cell *cell) {
+        if (cell->order_ > order_) {
+            sources.insert(cell);
+            upperOrder = std::max(upperOrder, cell->order_);
+        }
+    };
+    for (Cell *cell: referenced) {
+        addSource(cell);
+    }
+    for (const auto &range: ranges) {
+        sheet_.ForEachCellInRange(range, addSource);
+    }
+    if (sources.empty()) {
+        return false;
+    }
+
+    // Вперёд от нас по зависимым, не дальше самой поздней из новых ссылок
+    std::vector<Cell *> forward;
+    std::unordered_set<Cell *> visited;
+    std::vector<Cell *> toVisit{this};
+    visited.insert(this);
     while (!toVisit.empty()) {
-        const Cell *current = toVisit.top();
-        toVisit.pop();
-        visited.insert(current);
-        if (referenced.find(current) != referenced.end()) {
+        Cell *current = toVisit.back();
+        toVisit.pop_back();
+        if (sources.count(current) > 0) {
             return true;
         }
-        for (const Cell *incoming: current->incomingRefs_) {
-            if (visited.find(incoming) == visited.end()) {
-                toVisit.push(incoming);
+        forward.push_back(current);
+        current->ForEachDependent([&](Cell *dependent) {
+            if (dependent->order_ <= upperOrder && visited.insert(dependent).second) {
+                toVisit.push_back(dependent);
             }
+        });
+    }
+
+    // Назад от новых ссылок по тому, на что они ссылаются, не раньше нас
+    std::vector<Cell *> backward;
+    for (Cell *source: sources) {
+        if (visited.insert(source).second) {
+            toVisit.push_back(source);
         }
     }
+    while (!toVisit.empty()) {
+        Cell *current = toVisit.back();
+        toVisit.pop_back();
+        backward.push_back(current);
+        current->ForEachReferenced([&](Cell *referencedCell) {
+            if (referencedCell->order_ > order_ && visited.insert(referencedCell).second) {
+                toVisit.push_back(referencedCell);
+            }
+        });
+    }
+
+    // Найденные ячейки занимают те же места, но сначала идут те, от которых
+    // мы теперь зависим, а за ними мы и наши зависимые
+    auto byOrder = [](const Cell *lhs, const Cell *rhs) { return lhs->order_ < rhs->order_; };
+    std::sort(backward.begin(), backward.end(), byOrder);
+    std::sort(forward.begin(), forward.end(), byOrder);
+    std::vector<int64_t> orders;
+    orders.reserve(backward.size() + forward.size());
+    for (const Cell *cell: backward) {
+        orders.push_back(cell->order_);
+    }
+    for (const Cell *cell: forward) {
+        orders.push_back(cell->order_);
+    }
+    std::sort(orders.begin(), orders.end());
+    auto order = orders.begin();
+    for (Cell *cell: backward) {
+        cell->order_ = *order++;
+    }
+    for (Cell *cell: forward) {
+        cell->order_ = *order++;
+    }
 
     return false;
 }
 
+std::unique_ptr<Cell::Impl> Cell::CreateImpl(std::string text, Sheet &sheet) {
+    if (text.empty()) {
+        return std::make_unique<EmptyImpl>();
+    }
+    if (text.size() > 1 && text[0] == kFormulaSign) {
+        return std::make_unique<FormulaImpl>(std::move(text), sheet);
+    }
+    return std::make_unique<TextImpl>(std::move(text));
+}
+
 void Cell::UpdateRefs() {
     for (Cell *outgoing: outgoingRefs_) {
         outgoing->incomingRefs_.erase(this);
@@ -219,17 +425,303 @@ void Cell::UpdateRefs() {
         outgoingRefs_.insert(outgoing);
         outgoing->incomingRefs_.insert(this);
     }
+    // Ячейки не перемещаются, пока на них ссылаются, так что формула читает
+    // их напрямую, не ища по позиции при каждом вычислении
+    if (IFormula *formula = impl_->GetFormula()) {
+        BindReferencedCells(*formula, [this](Position pos) -> const ICellNumber * {
+            return sheet_.GetConcreteCell(pos);
+        }, sheet_);
+    }
+
+    UpdateRanges();
+}
+
+void Cell::UpdateRanges() {
+    // На диапазон приходится одно ребро, ячейки внутри него не создаются.
+    // Новые диапазоны регистрируются раньше, чем убираются прежние: столбец,
+    // который формула не покидает, не выпадает из индекса
+    auto &rangeIndex = sheet_.GetRangeIndex();
+    auto ranges = impl_->GetReferencedRanges();
+    for (const auto &range: ranges) {
+        rangeIndex.AddDependent(this, range);
+    }
+    for (const auto &range: ranges_) {
+        rangeIndex.RemoveDependent(this, range);
+    }
+    ranges_ = std::move(ranges);
+
+    // По самой дальней ссылке лист находит формулы, которые задевает вставка
+    // или удаление строк и столбцов
+    Position last{-1, -1};
+    for (const auto &pos: impl_->GetReferencedCells()) {
+        last.row = std::max(last.row, pos.row);
+        last.col = std::max(last.col, pos.col);
+    }
+    for (const auto &range: ranges_) {
+        last.row = std::max(last.row, range.last.row);
+        last.col = std::max(last.col, range.last.col);
+    }
+    if (!(last == lastReference_)) {
+        sheet_.UpdateLastReference(this, lastReference_, last);
+        lastReference_ = last;
+    }
 }
 
-void Cell::InvalidateCacheRecursive(bool force) {
-    if (impl_->IsCacheValid() || force) {
-        impl_->InvalidateCache();
-        // Если ячейка текстовая, то она всё равно останется валидной, но она
-        // не может ссылаться на другие ячейки, значит она может быть только
-        // листом в графе зависимостей, и последующий цикл в неё не зайдёт
-        // повторно
-        for (Cell *incoming: incomingRefs_) {
-            incoming->InvalidateCacheRecursive();
+void Cell::InvalidateDependents() {
+    // Наше собственное значение только что создано заново: формула попадает в
+    // очередь на пересчёт, а значение текстовой или пустой ячейки уже известно
+    if (impl_->IsCacheValid()) {
+        sheet_.MarkClean(this);
+        sheet_.GetRangeIndex().UpdateValue(*this);
+    } else {
+        sheet_.MarkDirty(this);
+    }
+
+    // Обход без рекурсии, чтобы длинные цепочки зависимостей не переполняли
+    // стек. Ячейка с уже сброшенным кешем дальше не обходится: все ячейки, что
+    // от неё зависят, были помечены вместе с ней
+    std::vector<Cell *> toVisit;
+    auto push = [&toVisit](Cell *dependent) { toVisit.push_back(dependent); };
+    ForEachDependent(push);
+    while (!toVisit.empty()) {
+        Cell *current = toVisit.back();
+        toVisit.pop_back();
+        if (!current->impl_->IsCacheValid()) {
+            continue;
         }
+        current->impl_->InvalidateCache();
+        sheet_.MarkDirty(current);
+        current->ForEachDependent(push);
+    }
+}
+
+void Cell::ForEachDependent(const std::function<void(Cell *)> &visit) const {
+    for (Cell *incoming: incomingRefs_) {
+        visit(incoming);
+    }
+    sheet_.GetRangeIndex().ForEachDependent(GetPosition(), visit);
+}
+
+void Cell::ForEachReferenced(const std::function<void(Cell *)> &visit) const {
+    for (Cell *outgoing: outgoingRefs_) {
+        visit(outgoing);
+    }
+    for (const auto &range: ranges_) {
+        sheet_.ForEachCellInRange(range, visit);
+    }
+}
+
+void Cell::Recalculate(const std::unordered_set<Cell *> &dirty, size_t threads) {
+    // Алгоритм Кана на подграфе устаревших ячеек, считая и ссылки через
+    // диапазоны. Ссылки на актуальные ячейки не считаются: их значения уже
+    // лежат в кеше. Формулы идут уровнями: все
+    // формулы уровня зависят только от предыдущих уровней, поэтому их можно
+    // считать одновременно, а результат не зависит от числа потоков
+    std::unordered_map<Cell *, size_t> pendingRefs;
+    for (Cell *cell: dirty) {
+        cell->ForEachDependent([&](Cell *dependent) {
+            if (dirty.count(dependent) > 0) {
+                ++pendingRefs[dependent];
+            }
+        });
+    }
+    std::vector<Cell *> level;
+    for (Cell *cell: dirty) {
+        if (pendingRefs.find(cell) == pendingRefs.end()) {
+            level.push_back(cell);
+        }
+    }
+
+    std::vector<Cell *> nextLevel;
+    while (!level.empty()) {
+        ParallelFor(level.size(), threads, [&level](size_t i) { level[i]->impl_->Evaluate(); });
+        // Индекс диапазонов обновляется между уровнями, а не из рабочих потоков
+        for (Cell *cell: level) {
+            cell->sheet_.GetRangeIndex().UpdateValue(*cell);
+            cell->ForEachDependent([&](Cell *dependent) {
+                auto it = pendingRefs.find(dependent);
+                if (it != pendingRefs.end() && --it->second == 0) {
+                    nextLevel.push_back(dependent);
+                }
+            });
+        }
+        level.swap(nextLevel);
+        nextLevel.clear();
+    }
+}
+
+void Cell::SetAll(std::vector<std::pair<Cell *, std::string>> texts, size_t threads) {
+    if (texts.empty()) {
+        return;
+    }
+    Sheet &sheet = texts.front().first->sheet_;
+
+    // Разбор формул ничего не меняет в листе, поэтому идёт параллельно
+    std::vector<std::unique_ptr<Impl>> impls(texts.size());
+    std::vector<std::exception_ptr> errors(texts.size());
+    ParallelFor(texts.size(), threads, [&](size_t i) {
+        try {
+            impls[i] = CreateImpl(std::move(texts[i].second), sheet);
+        } catch (...) {
+            errors[i] = std::current_exception();
+        }
+    });
+    for (const auto &error: errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Новые тексты сразу встают на место, а ссылки проводятся по настоящему
+    // графу. Прежние реализации остаются в impls на случай цикла; ячейка,
+    // заданная несколько раз, получает последний текст. Пустые ячейки под
+    // новые ссылки встают в порядке раньше всех, то есть раньше firstOrder
+    const int64_t firstOrder = sheet.TakeOrderBeforeAll();
+    for (size_t i = 0; i < texts.size(); ++i) {
+        std::swap(texts[i].first->impl_, impls[i]);
+    }
+    for (const auto &[cell, text]: texts) {
+        cell->UpdateRefs();
+    }
+
+    // Цикл может замкнуть только ссылка на ячейку, стоящую в порядке не
+    // раньше формулы, или диапазон. Без таких ссылок прежний порядок остаётся
+    // верным, и пакет обходится без сортировки
+    bool reorder = false;
+    for (const auto &[cell, text]: texts) {
+        reorder = reorder || !cell->ranges_.empty() ||
+                  std::any_of(cell->outgoingRefs_.begin(), cell->outgoingRefs_.end(),
+                              [cell = cell](const Cell *referenced) {
+                                  return referenced->order_ >= cell->order_;
+                              });
+    }
+    if (!reorder) {
+        for (const auto &[cell, text]: texts) {
+            cell->InvalidateDependents();
+        }
+        return;
+    }
+
+    // Цикл, если он появился, проходит через ячейку пакета, так что хватит
+    // алгоритма Кана на ячейках пакета и всех, кто от них зависит. Заодно
+    // эти ячейки получают новые места в топологическом порядке после всех
+    // прочих, чьи места не меняются. Рёбра собираются один раз в списки
+    // номеров, и сортировка уже не ищет ячейки в хеш-таблице
+    std::unordered_map<Cell *, size_t> indices;
+    indices.reserve(texts.size());
+    std::vector<Cell *> affected;
+    affected.reserve(texts.size());
+    for (const auto &[cell, text]: texts) {
+        if (indices.emplace(cell, affected.size()).second) {
+            affected.push_back(cell);
+        }
+    }
+    const size_t batchSize = affected.size();
+    std::vector<size_t> dependents;
+    std::vector<size_t> firstDependent;
+    firstDependent.reserve(texts.size() + 1);
+    for (size_t i = 0; i < affected.size(); ++i) {
+        firstDependent.push_back(dependents.size());
+        affected[i]->ForEachDependent([&](Cell *dependent) {
+            auto [it, inserted] = indices.emplace(dependent, affected.size());
+            if (inserted) {
+                affected.push_back(dependent);
+            }
+            dependents.push_back(it->second);
+        });
+    }
+    firstDependent.push_back(dependents.size());
+
+    std::vector<size_t> pendingRefs(affected.size());
+    for (size_t dependent: dependents) {
+        ++pendingRefs[dependent];
+    }
+    std::vector<size_t> sorted;
+    sorted.reserve(affected.size());
+    for (size_t i = 0; i < affected.size(); ++i) {
+        if (pendingRefs[i] == 0) {
+            sorted.push_back(i);
+        }
+    }
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        for (size_t j = firstDependent[sorted[i]]; j < firstDependent[sorted[i] + 1]; ++j) {
+            if (--pendingRefs[dependents[j]] == 0) {
+                sorted.push_back(dependents[j]);
+            }
+        }
+    }
+    if (sorted.size() < affected.size()) {
+        // Возвращаем прежние тексты и ссылки, а пустые ячейки, заведённые
+        // только ради новых ссылок, убираем
+        std::vector<Position> created;
+        for (const auto &[cell, text]: texts) {
+            for (const Cell *referenced: cell->outgoingRefs_) {
+                if (referenced->order_ < firstOrder) {
+                    created.push_back(referenced->GetPosition());
+                }
+            }
+        }
+        for (size_t i = texts.size(); i-- > 0;) {
+            std::swap(texts[i].first->impl_, impls[i]);
+        }
+        for (const auto &[cell, text]: texts) {
+            cell->UpdateRefs();
+        }
+        // Дерево столбца, заведённое по ходу пакета, успело прочитать новые
+        // значения ячеек пакета
+        for (const auto &[cell, text]: texts) {
+            sheet.GetRangeIndex().UpdateValue(*cell);
+        }
+        for (const auto &pos: created) {
+            sheet.ClearCell(pos);
+        }
+        throw CircularDependencyException(
+                "Setting these cells would introduce circular dependency!");
+    }
+
+    for (size_t i: sorted) {
+        affected[i]->order_ = sheet.TakeOrderAfterAll();
+    }
+
+    // Устаревают ровно найденные выше ячейки: так же их пометил бы
+    // InvalidateDependents, вызванный для каждой ячейки пакета. Пакет стоит в
+    // начале affected
+    for (size_t i = 0; i < affected.size(); ++i) {
+        Cell *cell = affected[i];
+        if (i < batchSize && cell->impl_->IsCacheValid()) {
+            sheet.MarkClean(cell);
+            sheet.GetRangeIndex().UpdateValue(*cell);
+        } else {
+            cell->impl_->InvalidateCache();
+            sheet.MarkDirty(cell);
+        }
+    }
+}
+
+void Cell::UpdateFormulas(
+        const std::vector<Cell *> &cells,
+        const std::function<IFormula::HandlingResult(IFormula & )> &update) {
+    std::vector<Cell *> changed;
+    for (Cell *cell: cells) {
+        IFormula *formula = cell->impl_->GetFormula();
+        if (!formula) {
+            continue;
+        }
+        const auto result = update(*formula);
+        if (result == IFormula::HandlingResult::ReferencesRenamedOnly) {
+            // Те же ячейки под новыми именами: значение прежнее
+            cell->UpdateRanges();
+        } else if (result == IFormula::HandlingResult::ReferencesChanged) {
+            // Ссылка могла стать #REF!, а диапазон - потерять ячейки
+            cell->UpdateRefs();
+            changed.push_back(cell);
+        }
+    }
+
+    // Зависимые ищутся, только когда все диапазоны перерегистрированы: до того
+    // индекс знает часть из них под старыми позициями
+    for (Cell *cell: changed) {
+        cell->impl_->InvalidateCache();
+        cell->InvalidateDependents();
     }
 }
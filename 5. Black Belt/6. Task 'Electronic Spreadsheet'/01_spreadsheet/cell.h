@@ -2,13 +2,18 @@
 
 #include "common.h"
 #include "formula.h"
+#include "range.h"
 
+#include <cstdint>
 #include <functional>
+#include <string>
 #include <unordered_set>
+#include <utility>
+#include <vector>
 
 class Sheet;
 
-class Cell : public ICell {
+class Cell : public ICell, public ICellNumber {
 public:
     Cell(Sheet &sheet);
 
@@ -24,11 +29,40 @@ public:
 
     std::vector <Position> GetReferencedCells() const override;
 
-    void UpdateFormula(
-            const std::function<IFormula::HandlingResult(IFormula & )> &update);
-
     bool IsReferenced() const;
 
+    Position GetPosition() const;
+
+    // Значение, каким его читают формулы: пустая ячейка - 0, текст - число,
+    // если он весь им является, иначе #VALUE!. Текст разбирается один раз,
+    // когда задаётся
+    IFormula::Value GetNumber() const override;
+
+    // Вклад ячейки в агрегаты по диапазонам. Устаревшая формула не вносит
+    // ничего, её значение попадёт в индекс при пересчёте
+    AggregatedValue GetAggregatedValue() const;
+
+    // Вычисляет устаревшие формулы в топологическом порядке: каждую ровно один
+    // раз и только после всех устаревших ячеек, на которые она ссылается.
+    // Независимые формулы считаются в threads потоков
+    static void Recalculate(const std::unordered_set<Cell *> &dirty,
+                            size_t threads = 1);
+
+    // Задаёт тексты многих ячеек одного листа разом: формулы разбираются в
+    // threads потоков, ссылки проводятся по разу, а на циклы проверяется весь
+    // пакет сразу. Итог тот же, что у Set для каждой ячейки по очереди (разве
+    // что без пустых ячеек, на которые ссылались перезаписанные в том же
+    // пакете тексты), но при ошибке разбора или цикле не меняется ни одна ячейка
+    static void SetAll(std::vector<std::pair<Cell *, std::string>> texts,
+                       size_t threads = 1);
+
+    // Для вставки и удаления строк и столбцов: переписывает ссылки формул и
+    // перерегистрирует их диапазоны. Сбрасываются значения только тех формул,
+    // что теперь ссылаются на другие ячейки, и зависящих от них
+    static void UpdateFormulas(
+            const std::vector<Cell *> &cells,
+            const std::function<IFormula::HandlingResult(IFormula & )> &update);
+
 private:
     class Impl;
 
@@ -38,14 +72,41 @@ private:
 
     class FormulaImpl;
 
-    bool WouldIntroduceCircularDependency(const Impl &newImpl) const;
+    // Если цикла не будет, заодно переставляет ячейки в топологическом
+    // порядке так, чтобы новые ссылки ему не противоречили
+    bool WouldIntroduceCircularDependency(const Impl &newImpl);
+
+    static std::unique_ptr<Impl> CreateImpl(std::string text, Sheet &sheet);
 
     void UpdateRefs();
 
-    void InvalidateCacheRecursive(bool force = false);
+    // Перерегистрирует диапазоны в индексе листа и сообщает листу самую
+    // дальнюю строку и столбец, на которые ссылается формула
+    void UpdateRanges();
+
+    void InvalidateDependents();
+
+    // Зависимые ячейки: ссылающиеся на нас напрямую и через диапазоны
+    void ForEachDependent(const std::function<void(Cell *)> &visit) const;
+
+    // Ячейки, на которые мы ссылаемся напрямую и через диапазоны
+    void ForEachReferenced(const std::function<void(Cell *)> &visit) const;
+
+    // Место в хранилище выставляет само хранилище, когда кладёт ячейку в
+    // таблицу; позицию на листе оно же вычисляет по нему
+    friend class CellStorage;
 
     std::unique_ptr <Impl> impl_;
     Sheet &sheet_;
+    Position storedPosition_{-1, -1};
+    // Место в топологическом порядке: ячейка всегда стоит раньше тех, что от
+    // неё зависят
+    int64_t order_;
     std::unordered_set<Cell *> incomingRefs_;
     std::unordered_set<Cell *> outgoingRefs_;
+    // Диапазоны в том виде, в каком они зарегистрированы в индексе листа
+    std::vector<Range> ranges_;
+    // Самые дальние строка и столбец среди ссылок, как они известны листу;
+    // -1, если ссылок нет
+    Position lastReference_{-1, -1};
 };
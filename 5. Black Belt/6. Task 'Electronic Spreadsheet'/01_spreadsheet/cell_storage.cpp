@@ -0,0 +1,293 @@
+#include "cell_storage.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cassert>
+#include <new>
+
+namespace {
+    int CountBits(uint64_t bits) {
+        return static_cast<int>(std::bitset<64>(bits).count());
+    }
+
+    int LowestBit(uint64_t bits) {
+        return CountBits((bits & -bits) - 1);
+    }
+
+    // Биты столбцов плитки с first по last
+    uint64_t ColumnMask(int first, int last) {
+        return (~uint64_t{0} >> (63 - last)) & (~uint64_t{0} << first);
+    }
+}
+
+CellStorage::~CellStorage() {
+    ForEach([](Position, Cell &cell) { cell.~Cell(); });
+}
+
+uint64_t CellStorage::GetTileKey(Position pos) {
+    return static_cast<uint64_t>(pos.row / kTileRows) << 32 |
+           static_cast<uint32_t>(pos.col / kTileCols);
+}
+
+int CellStorage::GetSlot(const Tile &tile, int row, int col) {
+    if (tile.dense) {
+        return row * kTileCols + col;
+    }
+    return tile.firstInRow[row] + CountBits(tile.occupied[row] & ((uint64_t{1} << col) - 1));
+}
+
+void CellStorage::MakeDense(Tile &tile) {
+    std::vector<Cell *> cells(kTileRows * kTileCols);
+    int slot = 0;
+    for (int row = 0; row < kTileRows; ++row) {
+        for (uint64_t bits = tile.occupied[row]; bits; bits &= bits - 1) {
+            cells[row * kTileCols + LowestBit(bits)] = tile.cells[slot++];
+        }
+    }
+    tile.cells.swap(cells);
+    tile.dense = true;
+}
+
+void CellStorage::MakeSparse(Tile &tile) {
+    // Занятая клетка сдвигается только к началу, так что сжатие идёт на месте
+    int slot = 0;
+    for (int row = 0; row < kTileRows; ++row) {
+        tile.firstInRow[row] = static_cast<uint16_t>(slot);
+        for (uint64_t bits = tile.occupied[row]; bits; bits &= bits - 1) {
+            tile.cells[slot++] = tile.cells[row * kTileCols + LowestBit(bits)];
+        }
+    }
+    tile.cells.resize(slot);
+    tile.cells.shrink_to_fit();
+    tile.dense = false;
+}
+
+Cell *CellStorage::Get(Position pos) const {
+    return GetStored(ToStorage(pos));
+}
+
+Cell &CellStorage::GetOrCreate(Position pos, Sheet &sheet) {
+    const Position stored = ToStorage(pos);
+    if (Cell *cell = GetStored(stored)) {
+        return *cell;
+    }
+
+    void *slot;
+    if (!freeSlots_.empty()) {
+        slot = freeSlots_.back();
+        freeSlots_.pop_back();
+    } else {
+        if (usedInLastChunk_ == lastChunkSize_) {
+            lastChunkSize_ = chunks_.empty() ? kFirstChunkSize : std::min(lastChunkSize_ * 2, kChunkSize);
+            chunks_.push_back(std::make_unique<CellSlot[]>(lastChunkSize_));
+            usedInLastChunk_ = 0;
+        }
+        slot = &chunks_.back()[usedInLastChunk_++];
+    }
+    Cell *cell = new(slot) Cell(sheet);
+    Place(stored, cell);
+    return *cell;
+}
+
+Cell *CellStorage::Extract(Position pos) {
+    const Position stored = ToStorage(pos);
+    auto it = tiles_.find(GetTileKey(stored));
+    if (it == tiles_.end()) {
+        return nullptr;
+    }
+    auto &tile = *it->second;
+    const int row = stored.row % kTileRows;
+    const int col = stored.col % kTileCols;
+    const uint64_t bit = uint64_t{1} << col;
+    if (!(tile.occupied[row] & bit)) {
+        return nullptr;
+    }
+    const int slot = GetSlot(tile, row, col);
+    Cell *cell = tile.cells[slot];
+    tile.occupied[row] &= ~bit;
+    Count(rowCounts_, stored.row, -1);
+    Count(colCounts_, stored.col, -1);
+    if (--tile.count == 0) {
+        tiles_.erase(it);
+        return cell;
+    }
+    if (tile.dense) {
+        tile.cells[slot] = nullptr;
+        if (tile.count < kDenseCells / 4) {
+            MakeSparse(tile);
+        }
+    } else {
+        tile.cells.erase(tile.cells.begin() + slot);
+        for (int next = row + 1; next < kTileRows; ++next) {
+            --tile.firstInRow[next];
+        }
+    }
+    return cell;
+}
+
+void CellStorage::Destroy(Cell *cell) {
+    cell->~Cell();
+    freeSlots_.push_back(cell);
+}
+
+Position CellStorage::GetPosition(const Cell &cell) const {
+    return {rows_.FromStorage(cell.storedPosition_.row), cols_.FromStorage(cell.storedPosition_.col)};
+}
+
+void CellStorage::InsertRows(int before, int count) {
+    rows_.Insert(before, count);
+}
+
+void CellStorage::InsertCols(int before, int count) {
+    cols_.Insert(before, count);
+}
+
+void CellStorage::DeleteRows(int first, int count) {
+    assert(!HasCellsInRows(first, first + count - 1));
+    rows_.Erase(first, count);
+}
+
+void CellStorage::DeleteCols(int first, int count) {
+    assert(!HasCellsInCols(first, first + count - 1));
+    cols_.Erase(first, count);
+}
+
+bool CellStorage::HasCellsInRows(int first, int last) const {
+    return HasCells(rows_, rowCounts_, first, last);
+}
+
+bool CellStorage::HasCellsInCols(int first, int last) const {
+    return HasCells(cols_, colCounts_, first, last);
+}
+
+Position CellStorage::ToStorage(Position pos) const {
+    return {rows_.ToStorage(pos.row), cols_.ToStorage(pos.col)};
+}
+
+Cell *CellStorage::GetStored(Position stored) const {
+    auto it = tiles_.find(GetTileKey(stored));
+    if (it == tiles_.end()) {
+        return nullptr;
+    }
+    const Tile &tile = *it->second;
+    const int row = stored.row % kTileRows;
+    const int col = stored.col % kTileCols;
+    if (!(tile.occupied[row] >> col & 1u)) {
+        return nullptr;
+    }
+    return tile.cells[GetSlot(tile, row, col)];
+}
+
+void CellStorage::Place(Position stored, Cell *cell) {
+    auto &tile = tiles_[GetTileKey(stored)];
+    if (!tile) {
+        tile = std::make_unique<Tile>();
+    }
+    const int row = stored.row % kTileRows;
+    const int col = stored.col % kTileCols;
+    assert(!(tile->occupied[row] >> col & 1u));
+    if (!tile->dense && tile->count == kDenseCells) {
+        MakeDense(*tile);
+    }
+    // Номер клетки считается до установки её бита: в нём учтены только
+    // клетки левее
+    const int slot = GetSlot(*tile, row, col);
+    if (tile->dense) {
+        tile->cells[slot] = cell;
+    } else {
+        tile->cells.insert(tile->cells.begin() + slot, cell);
+        for (int next = row + 1; next < kTileRows; ++next) {
+            ++tile->firstInRow[next];
+        }
+    }
+    tile->occupied[row] |= uint64_t{1} << col;
+    ++tile->count;
+    Count(rowCounts_, stored.row, 1);
+    Count(colCounts_, stored.col, 1);
+    cell->storedPosition_ = stored;
+}
+
+bool CellStorage::HasCells(const AxisMap &axis, const std::vector<int> &counts, int first, int last) {
+    bool found = false;
+    axis.ForEachRun(first, last, [&](int, int stored, int length) {
+        const int end = std::min(stored + length, static_cast<int>(counts.size()));
+        for (int i = stored; i < end && !found; ++i) {
+            found = counts[i] > 0;
+        }
+    });
+    return found;
+}
+
+void CellStorage::Count(std::vector<int> &counts, int stored, int delta) {
+    if (stored >= static_cast<int>(counts.size())) {
+        counts.resize(stored + 1);
+    }
+    counts[stored] += delta;
+}
+
+void CellStorage::ForEach(const std::function<void(Position, Cell &)> &visit) const {
+    // Номера на листе для строк и столбцов плитки ищутся по мере надобности:
+    // в разреженной таблице плитки почти пусты
+    std::array<int, kTileRows> rows;
+    std::array<int, kTileCols> cols;
+    for (const auto &[key, tile]: tiles_) {
+        const int firstRow = static_cast<int>(key >> 32) * kTileRows;
+        const int firstCol = static_cast<int>(key & 0xFFFFFFFFu) * kTileCols;
+        cols.fill(-1);
+        for (int i = 0; i < kTileRows; ++i) {
+            if (tile->occupied[i]) {
+                rows[i] = rows_.FromStorage(firstRow + i);
+            }
+        }
+        for (int i = 0; i < kTileRows; ++i) {
+            for (uint64_t bits = tile->occupied[i]; bits; bits &= bits - 1) {
+                const int j = LowestBit(bits);
+                int &col = cols[j];
+                if (col < 0) {
+                    col = cols_.FromStorage(firstCol + j);
+                }
+                visit(Position{rows[i], col}, *tile->cells[GetSlot(*tile, i, j)]);
+            }
+        }
+    }
+}
+
+void CellStorage::ForEachInColumn(int col, const std::function<void(Position, Cell &)> &visit) const {
+    ForEachInRange({{0, col}, {Position::kMaxRows - 1, col}}, visit);
+}
+
+void CellStorage::ForEachInRange(Range range, const std::function<void(Position, Cell &)> &visit) const {
+    // Строки и столбцы диапазона лежат в хранилище несколькими кусками подряд,
+    // каждый их прямоугольник обходится по плиткам
+    rows_.ForEachRun(range.first.row, range.last.row, [&](int firstRow, int storedRow, int rowCount) {
+        cols_.ForEachRun(range.first.col, range.last.col, [&](int firstCol, int storedCol, int colCount) {
+            const Range stored{{storedRow, storedCol}, {storedRow + rowCount - 1, storedCol + colCount - 1}};
+            ForEachStored(stored, [&](Position pos, Cell &cell) {
+                visit(Position{firstRow + pos.row - storedRow, firstCol + pos.col - storedCol}, cell);
+            });
+        });
+    });
+}
+
+void CellStorage::ForEachStored(Range range, const std::function<void(Position, Cell &)> &visit) const {
+    for (int firstRow = range.first.row / kTileRows * kTileRows; firstRow <= range.last.row;
+         firstRow += kTileRows) {
+        for (int firstCol = range.first.col / kTileCols * kTileCols; firstCol <= range.last.col;
+             firstCol += kTileCols) {
+            auto it = tiles_.find(GetTileKey({firstRow, firstCol}));
+            if (it == tiles_.end()) {
+                continue;
+            }
+            const Tile &tile = *it->second;
+            const int lastRow = std::min(range.last.row, firstRow + kTileRows - 1);
+            const uint64_t mask = ColumnMask(std::max(range.first.col, firstCol) - firstCol,
+                                             std::min(range.last.col, firstCol + kTileCols - 1) - firstCol);
+            for (int row = std::max(range.first.row, firstRow); row <= lastRow; ++row) {
+                for (uint64_t bits = tile.occupied[row - firstRow] & mask; bits; bits &= bits - 1) {
+                    const int col = LowestBit(bits);
+                    visit(Position{row, firstCol + col}, *tile.cells[GetSlot(tile, row - firstRow, col)]);
+                }
+            }
+        }
+    }
+}
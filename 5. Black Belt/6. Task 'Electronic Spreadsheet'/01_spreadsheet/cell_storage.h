@@ -0,0 +1,132 @@
+#pragma once
+
+#include "axis_map.h"
+#include "cell.h"
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+class Sheet;
+
+// Разреженное хранилище ячеек: таблица разбита на плитки kTileRows x kTileCols,
+// плитка заводится при первой записи в неё и удаляется, когда пустеет. Пока
+// в плитке мало ячеек, она хранит битовую карту занятых клеток и указатели
+// только на них, плотная плитка - указатели на все клетки. Сами ячейки лежат
+// в пуле растущими кусками и никогда не перемещаются, ведь на них ссылаются
+// другие ячейки. Плитки адресуются номерами строк и
+// столбцов в хранилище, а не на листе: вставка и удаление строк и столбцов
+// меняют только отображения rows_ и cols_ и не трогают ни одной ячейки.
+class CellStorage {
+public:
+    static constexpr int kTileRows = 64;
+    static constexpr int kTileCols = 64;
+
+    CellStorage() = default;
+
+    CellStorage(const CellStorage &) = delete;
+
+    CellStorage &operator=(const CellStorage &) = delete;
+
+    ~CellStorage();
+
+    Cell *Get(Position pos) const;
+
+    Cell &GetOrCreate(Position pos, Sheet &sheet);
+
+    // Убирает ячейку из таблицы, не уничтожая её
+    Cell *Extract(Position pos);
+
+    void Destroy(Cell *cell);
+
+    Position GetPosition(const Cell &cell) const;
+
+    // Строки (столбцы), начиная с before, уезжают на count вперёд. В последних
+    // count строках листа ячеек быть не должно
+    void InsertRows(int before, int count);
+
+    void InsertCols(int before, int count);
+
+    // Строки (столбцы) после удалённых уезжают на их место. Ячейки удаляемых
+    // строк нужно извлечь заранее
+    void DeleteRows(int first, int count);
+
+    void DeleteCols(int first, int count);
+
+    bool HasCellsInRows(int first, int last) const;
+
+    bool HasCellsInCols(int first, int last) const;
+
+    void ForEach(const std::function<void(Position, Cell &)> &visit) const;
+
+    void ForEachInColumn(int col, const std::function<void(Position, Cell &)> &visit) const;
+
+    // Обходит только плитки, пересекающиеся с диапазоном. Ячейки одного
+    // столбца идут по порядку строк
+    void ForEachInRange(Range range, const std::function<void(Position, Cell &)> &visit) const;
+
+private:
+    static_assert(kTileCols == 64, "строка плитки - одно 64-битное слово карты");
+
+    // Первый кусок пула на kFirstChunkSize ячеек, каждый следующий вдвое
+    // больше, но не больше kChunkSize
+    static constexpr size_t kFirstChunkSize = 64;
+    static constexpr size_t kChunkSize = 4096;
+    // С этого числа ячеек плитка становится плотной, а обратно разреженной -
+    // когда их остаётся вчетверо меньше
+    static constexpr int kDenseCells = kTileRows * kTileCols / 8;
+
+    using CellSlot = std::aligned_storage_t<sizeof(Cell), alignof(Cell)>;
+
+    struct Tile {
+        // Бит столбца в слове строки отмечает занятую клетку
+        std::array<uint64_t, kTileRows> occupied{};
+        // Номер первой ячейки строки в cells, только для разреженной плитки
+        std::array<uint16_t, kTileRows> firstInRow{};
+        // Разреженная плитка хранит занятые клетки по порядку строк и столбцов,
+        // плотная - все kTileRows * kTileCols клеток
+        std::vector<Cell *> cells;
+        int count = 0;
+        bool dense = false;
+    };
+
+    static uint64_t GetTileKey(Position pos);
+
+    // Номер занятой клетки плитки в Tile::cells
+    static int GetSlot(const Tile &tile, int row, int col);
+
+    static void MakeDense(Tile &tile);
+
+    static void MakeSparse(Tile &tile);
+
+    Position ToStorage(Position pos) const;
+
+    Cell *GetStored(Position stored) const;
+
+    void Place(Position stored, Cell *cell);
+
+    // Прямоугольник в номерах хранилища
+    void ForEachStored(Range range, const std::function<void(Position, Cell &)> &visit) const;
+
+    static bool HasCells(const AxisMap &axis, const std::vector<int> &counts, int first, int last);
+
+    static void Count(std::vector<int> &counts, int stored, int delta);
+
+    AxisMap rows_{Position::kMaxRows};
+    AxisMap cols_{Position::kMaxCols};
+    // Число ячеек в каждой строке и каждом столбце хранилища
+    std::vector<int> rowCounts_;
+    std::vector<int> colCounts_;
+
+    std::unordered_map<uint64_t, std::unique_ptr<Tile>> tiles_;
+
+    std::vector<std::unique_ptr<CellSlot[]>> chunks_;
+    size_t lastChunkSize_ = 0;
+    size_t usedInLastChunk_ = 0;
+    std::vector<void *> freeSlots_;
+};
@@ -1,14 +1,17 @@
 #include "formula.h"
 #include "FormulaAST.h"
+#include "range.h"
 
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <iterator>
 #include <sstream>
 
 using namespace std::literals;
 
 static const auto kInvalidPosition = Position{-1, -1};
+static const auto kInvalidRange = Range{kInvalidPosition, kInvalidPosition};
 
 FormulaError::FormulaError(Category category) : category_(category) {}
 
@@ -34,14 +37,13 @@ std::string_view FormulaError::ToString() const {
 
 namespace {
     double GetDoubleFrom(const std::string &str) {
-        double value = 0;
-        if (!str.empty()) {
-            std::istringstream in(str);
-            if (!(in >> value) || !in.eof()) {
-                throw FormulaError(FormulaError::Category::Value);
-            }
+        if (str.empty()) {
+            return 0;
         }
-        return value;
+        if (auto value = ParseTextAsNumber(str)) {
+            return *value;
+        }
+        throw FormulaError(FormulaError::Category::Value);
     }
 
     double GetDoubleFrom(double value) {
@@ -57,6 +59,90 @@ namespace {
         return std::visit([](const auto &value) { return GetDoubleFrom(value); },
                           cell->GetValue());
     }
+
+    // numbers is the sheet itself when it keeps numeric values of its cells
+    FormulaAST::CellValue GetCellValue(const ISheet &sheet, const ICellNumbers *numbers,
+                                       Position position) {
+        if (!position.IsValid()) {
+            return FormulaError(FormulaError::Category::Ref);
+        }
+        if (numbers) {
+            return numbers->GetCellNumber(position);
+        }
+        try {
+            return GetCellValue(sheet.GetCell(position));
+        } catch (FormulaError error) {
+            return error;
+        }
+    }
+
+    // rangeStats is the sheet itself when it keeps aggregates of its cells
+    RangeStats GetRangeStats(const ISheet &sheet, const IRangeStats *rangeStats, Range range) {
+        if (rangeStats) {
+            return rangeStats->GetRangeStats(range);
+        }
+        RangeStats stats;
+        // column by column, the order in which the sheet's range index meets errors
+        for (int col = range.first.col; col <= range.last.col; ++col) {
+            for (int row = range.first.row; row <= range.last.row; ++row) {
+                if (const auto *cell = sheet.GetCell({row, col})) {
+                    stats.Add(ToAggregatedValue(cell->GetValue()));
+                }
+            }
+        }
+        return stats;
+    }
+
+    void MergeHandlingResults(IFormula::HandlingResult &result,
+                              IFormula::HandlingResult change) {
+        if (change == IFormula::HandlingResult::ReferencesChanged ||
+            result == IFormula::HandlingResult::NothingChanged) {
+            result = change;
+        }
+    }
+
+    // Ranges follow the rows (cols) they cover: an insertion before a range moves
+    // it, an insertion inside stretches it
+    IFormula::HandlingResult HandleInsertedInRange(Range &range, int Position::*coord,
+                                                   int before, int count, int limit) {
+        if (!range.IsValid() || range.last.*coord < before) {
+            return IFormula::HandlingResult::NothingChanged;
+        }
+        auto result = IFormula::HandlingResult::ReferencesChanged;
+        if (range.first.*coord >= before) {
+            range.first.*coord += count;
+            result = IFormula::HandlingResult::ReferencesRenamedOnly;
+        }
+        range.last.*coord += count;
+        if (range.last.*coord >= limit) {
+            range = kInvalidRange;
+            return IFormula::HandlingResult::ReferencesChanged;
+        }
+        return result;
+    }
+
+    // A deletion inside a range shrinks it, a range deleted completely becomes #REF!
+    IFormula::HandlingResult HandleDeletedInRange(Range &range, int Position::*coord,
+                                                  int first, int count) {
+        if (!range.IsValid() || range.last.*coord < first) {
+            return IFormula::HandlingResult::NothingChanged;
+        }
+        const int end = first + count;
+        if (range.first.*coord >= end) {
+            range.first.*coord -= count;
+            range.last.*coord -= count;
+            return IFormula::HandlingResult::ReferencesRenamedOnly;
+        }
+        const int new_first = std::min(range.first.*coord, first);
+        const int new_last = range.last.*coord >= end ? range.last.*coord - count : first - 1;
+        if (new_first > new_last) {
+            range = kInvalidRange;
+        } else {
+            range.first.*coord = new_first;
+            range.last.*coord = new_last;
+        }
+        return IFormula::HandlingResult::ReferencesChanged;
+    }
 }
 
 std::ostream &operator<<(std::ostream &output, FormulaError fe) {
@@ -73,16 +159,45 @@ namespace {
         }
 
         Value Evaluate(const ISheet &sheet) const override {
-            try {
-                auto cell_lookup = [&sheet](Position position) -> double {
-                    if (!position.IsValid()) {
-                        throw FormulaError(FormulaError::Category::Ref);
-                    }
-                    const auto *cell = sheet.GetCell(position);
-                    return GetCellValue(cell);
-                };
+            if (bound_) {
+                return EvaluateBound();
+            }
 
-                return ast_.Execute(cell_lookup);
+            // Only formulas evaluated against a foreign sheet get here. What that sheet
+            // implements is resolved once per evaluation, not per cell or aggregate;
+            // caching it in the formula would make concurrent evaluations race
+            const auto *numbers = dynamic_cast<const ICellNumbers *>(&sheet);
+            const auto *rangeStats = dynamic_cast<const IRangeStats *>(&sheet);
+
+            // Unbound cells are resolved up front in GetCells() order, errors included: the
+            // compiled program raises a cell's error only when it reaches the cell,
+            // so the first error in evaluation order wins, as in the tree walk
+            const auto &cells = ast_.GetCells();
+            std::vector <FormulaAST::CellValue> cell_values;
+            cell_values.reserve(std::distance(cells.begin(), cells.end()));
+            const Position *previous = nullptr;
+            for (const auto &cell: cells) {
+                if (previous && *previous == cell) {
+                    cell_values.push_back(cell_values.back());
+                } else {
+                    cell_values.push_back(GetCellValue(sheet, numbers, cell));
+                }
+                previous = &cell;
+            }
+
+            // Aggregates are served by the sheet's range index when it has one
+            std::vector <FormulaAST::CellValue> aggregate_values;
+            for (const auto &aggregate: ast_.GetAggregates()) {
+                if (!aggregate.range.IsValid()) {
+                    aggregate_values.emplace_back(FormulaError(FormulaError::Category::Ref));
+                } else {
+                    aggregate_values.push_back(
+                            GetRangeStats(sheet, rangeStats, aggregate.range).Get(aggregate.function));
+                }
+            }
+
+            try {
+                return ast_.Execute(cell_values, aggregate_values);
             } catch (FormulaError error) {
                 // NOTE(a-square): in production, using exceptions in a potentially hot
                 // path is problematic, instead we would remove recursion in favor of a
@@ -127,7 +242,11 @@ namespace {
                     }
                 }
             }
-            return result;
+            for (auto &aggregate: ast_.GetAggregates()) {
+                MergeHandlingResults(result, HandleInsertedInRange(
+                        aggregate.range, &Position::row, before, count, Position::kMaxRows));
+            }
+            return UpdateBinding(result);
         }
 
         HandlingResult HandleInsertedCols(int before, int count) override {
@@ -147,7 +266,11 @@ namespace {
                     }
                 }
             }
-            return result;
+            for (auto &aggregate: ast_.GetAggregates()) {
+                MergeHandlingResults(result, HandleInsertedInRange(
+                        aggregate.range, &Position::col, before, count, Position::kMaxCols));
+            }
+            return UpdateBinding(result);
         }
 
         HandlingResult HandleDeletedRows(int first, int count) override {
@@ -168,7 +291,11 @@ namespace {
                     }
                 }
             }
-            return result;
+            for (auto &aggregate: ast_.GetAggregates()) {
+                MergeHandlingResults(result, HandleDeletedInRange(
+                        aggregate.range, &Position::row, first, count));
+            }
+            return UpdateBinding(result);
         }
 
         HandlingResult HandleDeletedCols(int first, int count) override {
@@ -189,14 +316,97 @@ namespace {
                     }
                 }
             }
-            return result;
+            for (auto &aggregate: ast_.GetAggregates()) {
+                MergeHandlingResults(result, HandleDeletedInRange(
+                        aggregate.range, &Position::col, first, count));
+            }
+            return UpdateBinding(result);
+        }
+
+        const std::forward_list <RangeAggregate> &GetAggregates() const {
+            return ast_.GetAggregates();
+        }
+
+        void Bind(const std::function<const ICellNumber *(Position)> &resolve,
+                  const IRangeStats &rangeStats) {
+            bound_cells_.clear();
+            for (const auto &cell: ast_.GetCells()) {
+                bound_cells_.push_back(cell.IsValid() ? resolve(cell) : nullptr);
+            }
+            // list nodes stay in place when their ranges are renamed
+            bound_aggregates_.clear();
+            for (const auto &aggregate: ast_.GetAggregates()) {
+                bound_aggregates_.push_back(&aggregate);
+            }
+            bound_range_stats_ = &rangeStats;
+            bound_ = true;
         }
 
     private:
+        // Operands are read as the program reaches them, so the first error in
+        // evaluation order wins without resolving every cell up front
+        Value EvaluateBound() const {
+            try {
+                return ast_.Execute(
+                        [this](uint32_t index) -> FormulaAST::CellValue {
+                            if (const auto *cell = bound_cells_[index]) {
+                                return cell->GetNumber();
+                            }
+                            return FormulaError(FormulaError::Category::Ref);
+                        },
+                        [this](uint32_t index) -> FormulaAST::CellValue {
+                            const auto &aggregate = *bound_aggregates_[index];
+                            if (!aggregate.range.IsValid()) {
+                                return FormulaError(FormulaError::Category::Ref);
+                            }
+                            return bound_range_stats_->GetRangeStats(aggregate.range).Get(aggregate.function);
+                        });
+            } catch (FormulaError error) {
+                return error;
+            }
+        }
+
+        // the same cells under new names stay bound, other cells need a new binding
+        HandlingResult UpdateBinding(HandlingResult result) {
+            if (result == HandlingResult::ReferencesChanged) {
+                bound_ = false;
+                bound_cells_.clear();
+                bound_aggregates_.clear();
+                bound_range_stats_ = nullptr;
+            }
+            return result;
+        }
+
         FormulaAST ast_;
+
+        bool bound_ = false;
+        // in GetCells() and GetAggregates() order, nullptr for #REF! cells
+        std::vector<const ICellNumber *> bound_cells_;
+        std::vector<const RangeAggregate *> bound_aggregates_;
+        const IRangeStats *bound_range_stats_ = nullptr;
     };
 }
 
 std::unique_ptr <IFormula> ParseFormula(std::string expression) {
     return std::make_unique<Formula>(std::move(expression));
 }
+
+std::vector<Range> GetReferencedRanges(const IFormula &formula) {
+    std::vector<Range> ranges;
+    if (const auto *concrete = dynamic_cast<const Formula *>(&formula)) {
+        for (const auto &aggregate: concrete->GetAggregates()) {
+            if (aggregate.range.IsValid()) {
+                ranges.push_back(aggregate.range);
+            }
+        }
+    }
+    return ranges;
+}
+
+void BindReferencedCells(IFormula &formula,
+                         const std::function<const ICellNumber *(Position)> &resolve,
+                         const IRangeStats &rangeStats) {
+    if (auto *concrete = dynamic_cast<Formula *>(&formula)) {
+        concrete->Bind(resolve, rangeStats);
+    }
+}
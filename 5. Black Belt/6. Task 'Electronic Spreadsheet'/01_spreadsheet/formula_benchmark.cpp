@@ -0,0 +1,122 @@
+#include "FormulaAST.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace {
+    // Формула из terms слагаемых вида (A1*2-B1/3), каждое ссылается на две ячейки
+    std::string MakeExpression(int terms) {
+        std::string expression;
+        for (int i = 0; i < terms; ++i) {
+            if (i > 0) {
+                expression += i % 2 ? "+" : "-";
+            }
+            expression += "(" + Position{i, 0}.ToString() + "*2-" +
+                          Position{i, 1}.ToString() + "/3)";
+        }
+        return expression;
+    }
+
+    double CellValueAt(Position pos) {
+        return pos.row + pos.col * 0.5 + 1;
+    }
+
+    // Столбец C пуст: агрегаты его пропускают, а ссылка на ячейку читает 0
+    AggregatedValue AggregatedValueAt(Position pos) {
+        if (pos.col == 2) {
+            return std::nullopt;
+        }
+        return CellValueAt(pos);
+    }
+
+    template<typename F>
+    double Measure(const std::string &name, int iterations, F run) {
+        double result = 0;
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            result += run();
+        }
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+        std::cout << name << ": " << elapsed.count() << " ms\n";
+        return result;
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    int terms = 50;
+    int iterations = 200000;
+    if (argc == 3) {
+        terms = std::stoi(argv[1]);
+        iterations = std::stoi(argv[2]);
+    } else if (argc != 1) {
+        std::cerr << "Usage: formula_benchmark [terms iterations]\n";
+        return 5;
+    }
+
+    const auto expression = MakeExpression(terms);
+    const auto ast = ParseFormulaAST(expression);
+    std::cout << terms << " terms, " << iterations << " evaluations\n";
+
+    // Разбор дороже вычисления, поэтому повторяется реже
+    const int parses = std::max(iterations / 20, 1);
+    Measure("parse x" + std::to_string(parses), parses, [&] {
+        return ParseFormulaAST(expression).GetCells().empty() ? 0. : 1.;
+    });
+
+    const CellLookup lookup = CellValueAt;
+    const AggregateLookup aggregateLookup = AggregatedValueAt;
+    const double tree = Measure("tree", iterations, [&] { return ast.Execute(lookup, aggregateLookup); });
+
+    // Значения ячеек разрешаются заранее, как это делает Formula::Evaluate,
+    // только без выделения памяти на каждый вызов
+    std::vector<FormulaAST::CellValue> cellValues;
+    const double program = Measure("program", iterations, [&] {
+        cellValues.clear();
+        for (const auto &cell: ast.GetCells()) {
+            cellValues.emplace_back(CellValueAt(cell));
+        }
+        return ast.Execute(cellValues);
+    });
+
+    // Так считает формула, привязанная к ячейкам листа: операнд читается,
+    // только когда до него дошла программа
+    std::vector<Position> cells(ast.GetCells().begin(), ast.GetCells().end());
+    const auto readCell = [&cells](uint32_t index) {
+        return FormulaAST::CellValue(CellValueAt(cells[index]));
+    };
+    const auto readAggregate = [](uint32_t) {
+        return FormulaAST::CellValue(0.);
+    };
+    const double onDemand = Measure("program, operands on demand", iterations,
+                                    [&] { return ast.Execute(readCell, readAggregate); });
+
+    if (tree != program || tree != onDemand) {
+        std::cerr << "compiled program differs from the tree: " << program << ", " << onDemand
+                  << " != " << tree << "\n";
+        return 1;
+    }
+
+    // Агрегаты дерева должны совпадать с тем, что лист считает по своим ячейкам
+    const auto aggregates = ParseFormulaAST("COUNT(A1:C3)+AVERAGE(A1:C3)*2+SUM(B2:C3)");
+    std::vector<FormulaAST::CellValue> aggregateValues;
+    for (const auto &aggregate: aggregates.GetAggregates()) {
+        RangeStats stats;
+        for (int col = aggregate.range.first.col; col <= aggregate.range.last.col; ++col) {
+            for (int row = aggregate.range.first.row; row <= aggregate.range.last.row; ++row) {
+                stats.Add(AggregatedValueAt({row, col}));
+            }
+        }
+        aggregateValues.push_back(stats.Get(aggregate.function));
+    }
+    const double aggregatesTree = aggregates.Execute(lookup, aggregateLookup);
+    const double aggregatesProgram = aggregates.Execute({}, aggregateValues);
+    if (aggregatesTree != aggregatesProgram) {
+        std::cerr << "aggregates of the tree differ from the sheet's: " << aggregatesTree
+                  << " != " << aggregatesProgram << "\n";
+        return 1;
+    }
+    return 0;
+}
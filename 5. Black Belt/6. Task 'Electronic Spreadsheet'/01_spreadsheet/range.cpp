@@ -0,0 +1,138 @@
+#include "range.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <utility>
+
+bool Range::IsValid() const {
+    return first.IsValid() && last.IsValid();
+}
+
+bool Range::Contains(Position pos) const {
+    return pos.row >= first.row && pos.row <= last.row &&
+           pos.col >= first.col && pos.col <= last.col;
+}
+
+std::string Range::ToString() const {
+    if (!IsValid()) {
+        return std::string(FormulaError(FormulaError::Category::Ref).ToString());
+    }
+    return first.ToString() + ":" + last.ToString();
+}
+
+AggregatedValue ToAggregatedValue(const ICell::Value &value) {
+    if (const auto *text = std::get_if<std::string>(&value)) {
+        if (auto number = ParseTextAsNumber(*text)) {
+            return *number;
+        }
+        return std::nullopt;
+    }
+    if (const auto *error = std::get_if<FormulaError>(&value)) {
+        return *error;
+    }
+    return std::get<double>(value);
+}
+
+std::optional<double> ParseTextAsNumber(std::string_view text) {
+    const char *first = text.data();
+    const char *last = text.data() + text.size();
+    while (first != last && std::isspace(static_cast<unsigned char>(*first))) {
+        ++first;
+    }
+    // from_chars takes no plus sign, and it takes inf and nan, which have never been numbers here
+    const bool plus = first != last && *first == '+';
+    if (plus) {
+        ++first;
+    }
+    const char *digits = !plus && first != last && *first == '-' ? first + 1 : first;
+    if (digits == last || !(std::isdigit(static_cast<unsigned char>(*digits)) || *digits == '.')) {
+        return std::nullopt;
+    }
+
+    double number = 0;
+    const auto [end, error] = std::from_chars(first, last, number);
+    if (error != std::errc() || end != last) {
+        return std::nullopt;
+    }
+    return number;
+}
+
+void RangeStats::Add(const AggregatedValue &value) {
+    if (!value) {
+        return;
+    }
+    if (const auto *error = std::get_if<FormulaError>(&*value)) {
+        if (!this->error) {
+            this->error = *error;
+        }
+        return;
+    }
+    const double number = std::get<double>(*value);
+    sum += number;
+    min = std::min(min, number);
+    max = std::max(max, number);
+    ++count;
+}
+
+void RangeStats::Merge(const RangeStats &other) {
+    sum += other.sum;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+    count += other.count;
+    if (!error) {
+        error = other.error;
+    }
+}
+
+std::variant<double, FormulaError> RangeStats::Get(AggregateFunction function) const {
+    if (function == AggregateFunction::Count) {
+        return static_cast<double>(count);
+    }
+    if (error) {
+        return *error;
+    }
+    switch (function) {
+        case AggregateFunction::Sum:
+            return sum;
+        case AggregateFunction::Min:
+            return count ? min : 0.;
+        case AggregateFunction::Max:
+            return count ? max : 0.;
+        case AggregateFunction::Average:
+            if (!count) {
+                return FormulaError(FormulaError::Category::Div0);
+            }
+            return sum / count;
+        default:
+            return static_cast<double>(count);
+    }
+}
+
+namespace {
+    const std::pair<AggregateFunction, std::string_view> kFunctionNames[] = {
+            {AggregateFunction::Sum,     "SUM"},
+            {AggregateFunction::Min,     "MIN"},
+            {AggregateFunction::Max,     "MAX"},
+            {AggregateFunction::Average, "AVERAGE"},
+            {AggregateFunction::Count,   "COUNT"},
+    };
+}
+
+std::string_view ToString(AggregateFunction function) {
+    for (const auto &[candidate, name]: kFunctionNames) {
+        if (candidate == function) {
+            return name;
+        }
+    }
+    return "";
+}
+
+std::optional<AggregateFunction> ParseAggregateFunction(std::string_view name) {
+    for (const auto &[function, candidate]: kFunctionNames) {
+        if (candidate == name) {
+            return function;
+        }
+    }
+    return std::nullopt;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "common.h"
+#include "formula.h"
+
+#include <functional>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <variant>
+#include <vector>
+
+// a rectangular block of cells, both corners included
+struct Range {
+    Position first;
+    Position last;
+
+    bool IsValid() const;
+
+    bool Contains(Position pos) const;
+
+    std::string ToString() const;
+};
+
+enum class AggregateFunction {
+    Sum,
+    Min,
+    Max,
+    Average,
+    Count,
+};
+
+// an aggregate function applied to a range, as written in a formula: SUM(A1:A10)
+struct RangeAggregate {
+    AggregateFunction function;
+    Range range;
+};
+
+// what a cell contributes to aggregates: nothing for empty and non-numeric text
+// cells, a number or an error otherwise
+using AggregatedValue = std::optional<std::variant<double, FormulaError>>;
+
+// text counts if it is a number as a whole, the way formulas read text cells
+AggregatedValue ToAggregatedValue(const ICell::Value &value);
+
+// the number a text reads as, if the whole text is one; leading spaces and a plus
+// sign are allowed, as they have always been for formulas reading text cells
+std::optional<double> ParseTextAsNumber(std::string_view text);
+
+struct RangeStats {
+    double sum = 0;
+    double min = std::numeric_limits<double>::infinity();
+    double max = -std::numeric_limits<double>::infinity();
+    int count = 0;
+    // the first error met going column by column, errors of later cells are ignored
+    std::optional<FormulaError> error;
+
+    void Add(const AggregatedValue &value);
+
+    // other covers cells that come after the ones of this
+    void Merge(const RangeStats &other);
+
+    // COUNT ignores errors, the other functions return the first one
+    std::variant<double, FormulaError> Get(AggregateFunction function) const;
+};
+
+// implemented by sheets that keep aggregates of their cells up to date;
+// formulas read the cells of a range one by one from other sheets
+class IRangeStats {
+public:
+    virtual ~IRangeStats() = default;
+
+    virtual RangeStats GetRangeStats(Range range) const = 0;
+};
+
+// implemented by sheets whose cells keep the number they read as, so that formulas
+// don't parse a text cell on every read; cells of other sheets are converted each time
+class ICellNumbers {
+public:
+    virtual ~ICellNumbers() = default;
+
+    // what a formula sees: 0 for empty cells, #VALUE! for text that is not a number
+    virtual std::variant<double, FormulaError> GetCellNumber(Position pos) const = 0;
+};
+
+// a cell as formulas read it, implemented by cells that never move while they are
+// referenced; formulas bound to such cells don't look them up on every evaluation
+class ICellNumber {
+public:
+    virtual ~ICellNumber() = default;
+
+    // 0 for empty cells, #VALUE! for text that is not a number
+    virtual std::variant<double, FormulaError> GetNumber() const = 0;
+};
+
+std::string_view ToString(AggregateFunction function);
+
+std::optional<AggregateFunction> ParseAggregateFunction(std::string_view name);
+
+// ranges referenced by a formula, IFormula itself only reports single cells
+std::vector<Range> GetReferencedRanges(const IFormula &formula);
+
+// makes the formula read its cells through the ones resolve returns for their
+// positions and its aggregates from rangeStats, until the next call; resolve must
+// return a cell for every valid position.
+// Renaming references on row/column changes keeps the cells, a change of the cells
+// referenced drops them until the formula is bound again
+void BindReferencedCells(IFormula &formula,
+                         const std::function<const ICellNumber *(Position)> &resolve,
+                         const IRangeStats &rangeStats);
@@ -0,0 +1,243 @@
+#include "range_index.h"
+
+#include <algorithm>
+
+RangeIndex::RangeIndex(const CellStorage &cells) : cells_(cells) {}
+
+void RangeIndex::AddDependent(Cell *cell, Range range) {
+    for (int col = range.first.col; col <= range.last.col; ++col) {
+        dependents_[col].Add(range.first.row, range.last.row, cell);
+        if (trees_.find(col) == trees_.end()) {
+            auto &tree = trees_[col];
+            cells_.ForEachInColumn(col, [&tree](Position pos, const Cell &columnCell) {
+                tree.Set(pos.row, columnCell.GetAggregatedValue());
+            });
+        }
+    }
+}
+
+void RangeIndex::RemoveDependent(Cell *cell, Range range) {
+    for (int col = range.first.col; col <= range.last.col; ++col) {
+        auto it = dependents_.find(col);
+        if (it == dependents_.end()) {
+            continue;
+        }
+        it->second.Remove(range.first.row, range.last.row, cell);
+        // Формула, сменившая диапазон, сначала регистрирует новый, так что
+        // дерево столбца, который она не покидает, не строится заново
+        if (it->second.IsEmpty()) {
+            dependents_.erase(it);
+            trees_.erase(col);
+        }
+    }
+}
+
+void RangeIndex::ForEachDependent(Position pos, const std::function<void(Cell *)> &visit) const {
+    auto it = dependents_.find(pos.col);
+    if (it != dependents_.end()) {
+        it->second.ForEach(pos.row, visit);
+    }
+}
+
+void RangeIndex::UpdateValue(const Cell &cell) {
+    const Position pos = cell.GetPosition();
+    auto it = trees_.find(pos.col);
+    if (it != trees_.end()) {
+        it->second.Set(pos.row, cell.GetAggregatedValue());
+    }
+}
+
+RangeStats RangeIndex::GetStats(Range range) const {
+    RangeStats stats;
+    for (int col = range.first.col; col <= range.last.col; ++col) {
+        auto it = trees_.find(col);
+        if (it != trees_.end()) {
+            stats.Merge(it->second.Get(range.first.row, range.last.row));
+        } else {
+            stats.Merge(ScanColumn(col, range.first.row, range.last.row));
+        }
+    }
+    return stats;
+}
+
+void RangeIndex::InsertRows(int before, int count) {
+    for (auto &[col, tree]: trees_) {
+        tree.Shift(before, count);
+    }
+}
+
+void RangeIndex::InsertCols(int before, int count) {
+    ShiftTrees(before, count);
+}
+
+void RangeIndex::DeleteRows(int first, int count) {
+    for (auto &[col, tree]: trees_) {
+        tree.Shift(first + count, -count);
+    }
+}
+
+void RangeIndex::DeleteCols(int first, int count) {
+    ShiftTrees(first + count, -count);
+}
+
+RangeStats RangeIndex::ScanColumn(int col, int firstRow, int lastRow) const {
+    RangeStats stats;
+    cells_.ForEachInColumn(col, [&](Position pos, const Cell &cell) {
+        if (pos.row >= firstRow && pos.row <= lastRow) {
+            stats.Add(cell.GetAggregatedValue());
+        }
+    });
+    return stats;
+}
+
+void RangeIndex::ShiftTrees(int first, int delta) {
+    std::unordered_map<int, ColumnTree> trees;
+    for (auto &[col, tree]: trees_) {
+        if (col < first + std::min(delta, 0)) {
+            trees.emplace(col, std::move(tree));
+        } else if (col >= first) {
+            trees.emplace(col + delta, std::move(tree));
+        }
+    }
+    trees_ = std::move(trees);
+}
+
+void RangeIndex::ColumnDependents::Add(int firstRow, int lastRow, Cell *cell) {
+    ForEachNode(firstRow, lastRow, [&](int node) { nodes_[node].push_back(cell); });
+    ++count_;
+}
+
+void RangeIndex::ColumnDependents::Remove(int firstRow, int lastRow, Cell *cell) {
+    bool removed = false;
+    ForEachNode(firstRow, lastRow, [&](int node) {
+        auto it = nodes_.find(node);
+        if (it == nodes_.end()) {
+            return;
+        }
+        auto &cells = it->second;
+        auto found = std::find(cells.begin(), cells.end(), cell);
+        if (found == cells.end()) {
+            return;
+        }
+        *found = cells.back();
+        cells.pop_back();
+        if (cells.empty()) {
+            nodes_.erase(it);
+        }
+        removed = true;
+    });
+    if (removed) {
+        --count_;
+    }
+}
+
+void RangeIndex::ColumnDependents::ForEach(int row, const std::function<void(Cell *)> &visit) const {
+    if (nodes_.empty()) {
+        return;
+    }
+    for (int node = kCapacity + row; node > 0; node /= 2) {
+        auto it = nodes_.find(node);
+        if (it != nodes_.end()) {
+            for (Cell *cell: it->second) {
+                visit(cell);
+            }
+        }
+    }
+}
+
+bool RangeIndex::ColumnDependents::IsEmpty() const {
+    return count_ == 0;
+}
+
+template<typename Visit>
+void RangeIndex::ColumnDependents::ForEachNode(int firstRow, int lastRow, Visit visit) {
+    for (int begin = kCapacity + firstRow, end = kCapacity + lastRow + 1; begin < end; begin /= 2, end /= 2) {
+        if (begin & 1) {
+            visit(begin++);
+        }
+        if (end & 1) {
+            visit(--end);
+        }
+    }
+}
+
+void RangeIndex::ColumnTree::Set(int row, const AggregatedValue &value) {
+    if (row >= capacity_) {
+        if (!value) {
+            return;
+        }
+        Grow(row);
+    }
+    size_t node = capacity_ + row;
+    nodes_[node] = RangeStats{};
+    nodes_[node].Add(value);
+    for (node /= 2; node > 0; node /= 2) {
+        nodes_[node] = nodes_[2 * node];
+        nodes_[node].Merge(nodes_[2 * node + 1]);
+    }
+}
+
+RangeStats RangeIndex::ColumnTree::Get(int firstRow, int lastRow) const {
+    // Ошибка берётся из первой по порядку ячейки, поэтому левую и правую части
+    // копим отдельно и объединяем в исходном порядке
+    RangeStats left;
+    RangeStats right;
+    size_t begin = capacity_ + std::min(firstRow, capacity_);
+    size_t end = capacity_ + std::min(lastRow + 1, capacity_);
+    for (; begin < end; begin /= 2, end /= 2) {
+        if (begin & 1) {
+            left.Merge(nodes_[begin++]);
+        }
+        if (end & 1) {
+            RangeStats stats = nodes_[--end];
+            stats.Merge(right);
+            right = stats;
+        }
+    }
+    left.Merge(right);
+    return left;
+}
+
+void RangeIndex::ColumnTree::Grow(int row) {
+    int capacity = std::max(capacity_, 64);
+    while (capacity <= row) {
+        capacity *= 2;
+    }
+
+    std::vector<RangeStats> nodes(2 * capacity);
+    std::copy(nodes_.begin() + capacity_, nodes_.end(), nodes.begin() + capacity);
+    capacity_ = capacity;
+    nodes_ = std::move(nodes);
+    Rebuild();
+}
+
+void RangeIndex::ColumnTree::Shift(int first, int delta) {
+    if (first >= capacity_) {
+        return;
+    }
+    // Дерево растёт, только если за край ушли бы непустые листья
+    auto isSet = [](const RangeStats &stats) { return stats.count > 0 || stats.error; };
+    if (delta > 0 && std::any_of(nodes_.begin() + capacity_ + std::max(first, capacity_ - delta),
+                                 nodes_.end(), isSet)) {
+        Grow(capacity_ - 1 + delta);
+    }
+    auto leaves = nodes_.begin() + capacity_;
+    if (delta > 0) {
+        const int moved = std::max(capacity_ - first - delta, 0);
+        if (moved > 0) {
+            std::move_backward(leaves + first, leaves + first + moved, leaves + capacity_);
+        }
+        std::fill(leaves + first, leaves + std::min(first + delta, capacity_), RangeStats{});
+    } else {
+        std::move(leaves + first, leaves + capacity_, leaves + first + delta);
+        std::fill(leaves + capacity_ + delta, leaves + capacity_, RangeStats{});
+    }
+    Rebuild();
+}
+
+void RangeIndex::ColumnTree::Rebuild() {
+    for (int node = capacity_ - 1; node > 0; --node) {
+        nodes_[node] = nodes_[2 * node];
+        nodes_[node].Merge(nodes_[2 * node + 1]);
+    }
+}
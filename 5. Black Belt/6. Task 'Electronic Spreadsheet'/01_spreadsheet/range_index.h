@@ -0,0 +1,108 @@
+#pragma once
+
+#include "cell.h"
+#include "cell_storage.h"
+#include "common.h"
+#include "range.h"
+
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+// Индекс диапазонов, на которые ссылаются формулы листа. Для каждого
+// затронутого столбца хранит формулы, чьи диапазоны его покрывают, и дерево
+// отрезков по строкам с суммой, минимумом, максимумом и числом значений.
+// Формула с диапазоном - одно ребро в графе зависимостей, а не по ребру на
+// ячейку; агрегат считается за O(столбцов * log строк), изменение ячейки
+// обновляет дерево за O(log строк). Столбец уходит из индекса вместе с
+// последней формулой, чей диапазон его покрывает.
+class RangeIndex {
+public:
+    explicit RangeIndex(const CellStorage &cells);
+
+    // Деревья для столбцов диапазона строятся здесь, поэтому при параллельном
+    // пересчёте формулы только читают индекс
+    void AddDependent(Cell *cell, Range range);
+
+    void RemoveDependent(Cell *cell, Range range);
+
+    // Формулы, чьи диапазоны покрывают pos, за O(log строк + их числа)
+    void ForEachDependent(Position pos, const std::function<void(Cell *)> &visit) const;
+
+    // Значение ячейки читается, только если её столбец попал в индекс
+    void UpdateValue(const Cell &cell);
+
+    // Столбец за столбцом, как и при разборе формулы без индекса: ошибка
+    // берётся из первой такой ячейки
+    RangeStats GetStats(Range range) const;
+
+    // Сдвигают деревья вслед за ячейками. Диапазоны формул, задетых правкой,
+    // остаются под старыми позициями, пока формулы не перерегистрируют их:
+    // убрать их по старым позициям можно и после сдвига
+    void InsertRows(int before, int count);
+
+    void InsertCols(int before, int count);
+
+    // Значения ячеек удаляемых строк (столбцов) должны быть уже сброшены
+    void DeleteRows(int first, int count);
+
+    void DeleteCols(int first, int count);
+
+private:
+    class ColumnTree {
+    public:
+        void Set(int row, const AggregatedValue &value);
+
+        RangeStats Get(int firstRow, int lastRow) const;
+
+        // Сдвигает на delta строки начиная с first, при delta < 0 строки
+        // [first + delta, first) пропадают
+        void Shift(int first, int delta);
+
+    private:
+        void Grow(int row);
+
+        void Rebuild();
+
+        // Листья лежат в nodes_[capacity_ + row], узел i объединяет 2i и 2i + 1
+        int capacity_ = 0;
+        std::vector<RangeStats> nodes_;
+    };
+
+    // Формулы, чьи диапазоны задевают один столбец. Отрезок строк
+    // раскладывается по узлам дерева отрезков над всеми строками листа, и
+    // формулы, покрывающие строку, лежат в узлах на пути от её листа к корню
+    class ColumnDependents {
+    public:
+        void Add(int firstRow, int lastRow, Cell *cell);
+
+        void Remove(int firstRow, int lastRow, Cell *cell);
+
+        void ForEach(int row, const std::function<void(Cell *)> &visit) const;
+
+        bool IsEmpty() const;
+
+    private:
+        static constexpr int kCapacity = Position::kMaxRows;
+        static_assert((kCapacity & (kCapacity - 1)) == 0, "число строк листа - степень двойки");
+
+        // Узлы, на которые раскладывается отрезок строк
+        template<typename Visit>
+        static void ForEachNode(int firstRow, int lastRow, Visit visit);
+
+        // Узел i объединяет 2i и 2i + 1, лист строки row - kCapacity + row.
+        // Хранятся только непустые узлы
+        std::unordered_map<int, std::vector<Cell *>> nodes_;
+        int count_ = 0;
+    };
+
+    RangeStats ScanColumn(int col, int firstRow, int lastRow) const;
+
+    // Переносит деревья столбцов начиная с first на delta, при delta < 0
+    // деревья столбцов [first + delta, first) пропадают
+    void ShiftTrees(int first, int delta);
+
+    const CellStorage &cells_;
+    std::unordered_map<int, ColumnDependents> dependents_;
+    std::unordered_map<int, ColumnTree> trees_;
+};
@@ -7,53 +7,75 @@
 #include <algorithm>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <optional>
+#include <stdexcept>
 
 using namespace std::literals;
 
 namespace {
-    template<class Range>
-    int ssize(const Range &range) {
-        return static_cast<int>(std::size(range));
-    }
-
-    // Вставляет в вектор перед указанным элементом заданное количество элементов,
-    // которые будут сконструированы по умолчанию. К сожалению,
-    // std::vector::insert() этого сделать не позволяет.
-    // Если вставка должна происходить в конец, то не делает ничего.
-    // Возвращает диапазон вставленных элементов.
-    template<class T>
-    auto InsertToVectorDefaultConstructed(std::vector <T> &v, int before,
-                                          int count) {
-        if (before >= ssize(v)) {
-            return std::pair(v.end(), v.end());
-        }
-        v.resize(v.size() + count);
-        auto first = v.begin() + before;
-        auto last = v.end() - count;
-        std::move_backward(first, last, v.end());
-        return std::pair(first, first + count);
-    }
+    // Кавычки действуют, только если quoted: тогда поле в кавычках может
+    // содержать разделитель и перевод строки, а кавычка внутри удваивается.
+    // Как и в RFC 4180, кавычка вне таких полей и текст после закрывающей
+    // кавычки - ошибка
+    std::vector<std::pair<Position, std::string>> ReadDelimited(
+            std::istream &input, char delimiter, bool quoted) {
+        const std::string data(std::istreambuf_iterator<char>(input), {});
+        std::vector<std::pair<Position, std::string>> cells;
+        Position pos{0, 0};
+        std::string field;
+        auto flush = [&] {
+            if (!field.empty()) {
+                cells.emplace_back(pos, std::move(field));
+                field.clear();
+            }
+        };
 
-    template<class T>
-    void SafeErase(std::vector <T> &v, int first, int count) {
-        if (first < ssize(v)) {
-            count = std::min(count, ssize(v) - first);
-            v.erase(v.begin() + first, v.begin() + first + count);
+        for (size_t i = 0; i < data.size(); ++i) {
+            const char c = data[i];
+            if (quoted && c == '"') {
+                if (!field.empty()) {
+                    throw std::invalid_argument("Quote inside an unquoted CSV field");
+                }
+                for (++i; i < data.size(); ++i) {
+                    if (data[i] != '"') {
+                        field += data[i];
+                    } else if (i + 1 < data.size() && data[i + 1] == '"') {
+                        field += data[++i];
+                    } else {
+                        break;
+                    }
+                }
+                if (i == data.size()) {
+                    throw std::invalid_argument("Unterminated quoted CSV field");
+                }
+                if (i + 1 < data.size() && data[i + 1] != delimiter &&
+                    data[i + 1] != '\n' && data[i + 1] != '\r') {
+                    throw std::invalid_argument("Text after a closing quote in CSV");
+                }
+            } else if (c == delimiter) {
+                flush();
+                ++pos.col;
+            } else if (c == '\n' || c == '\r') {
+                flush();
+                if (c == '\r' && i + 1 < data.size() && data[i + 1] == '\n') {
+                    ++i;
+                }
+                ++pos.row;
+                pos.col = 0;
+            } else {
+                field += c;
+            }
         }
+        flush();
+        return cells;
     }
 }
 
 Sheet::~Sheet() {
     // Сначала очистим ячейки во избежания возникновения висячих указателей в
     // процессе удаления. Критической необходимости в этом нет, но так безопаснее.
-    for (auto &row: cells_) {
-        for (auto &cell: row) {
-            if (cell) {
-                cell->Clear();
-            }
-        }
-    }
+    cells_.ForEach([](Position, Cell &cell) { cell.Clear(); });
 }
 
 void Sheet::SetCell(Position pos, std::string text) {
@@ -61,12 +83,46 @@ void Sheet::SetCell(Position pos, std::string text) {
         throw InvalidPositionException(
                 "Invalid position passed to Sheet::SetCell()");
     }
-    MaybeIncreaseSizeToIncludePosition(pos);
-    auto &cell = cells_[pos.row][pos.col];
-    if (!cell) {
-        cell = std::make_unique<Cell>(*this);
+    cells_.GetOrCreate(pos, *this).Set(std::move(text));
+}
+
+void Sheet::SetCells(std::vector<std::pair<Position, std::string>> cells) {
+    for (const auto &[pos, text]: cells) {
+        if (!pos.IsValid()) {
+            throw InvalidPositionException(
+                    "Invalid position passed to Sheet::SetCells()");
+        }
+    }
+
+    std::vector<Position> created;
+    std::vector<std::pair<Cell *, std::string>> texts;
+    texts.reserve(cells.size());
+    for (auto &[pos, text]: cells) {
+        Cell *cell = cells_.Get(pos);
+        if (!cell) {
+            cell = &cells_.GetOrCreate(pos, *this);
+            created.push_back(pos);
+        }
+        texts.emplace_back(cell, std::move(text));
+    }
+
+    try {
+        Cell::SetAll(std::move(texts), recalculationThreads_);
+    } catch (...) {
+        // Заведённые под пакет ячейки остались пустыми, ссылок на них нет
+        for (auto pos: created) {
+            cells_.Destroy(cells_.Extract(pos));
+        }
+        throw;
     }
-    cell->Set(std::move(text));
+}
+
+void Sheet::ImportCsv(std::istream &input) {
+    SetCells(ReadDelimited(input, ',', true));
+}
+
+void Sheet::ImportTsv(std::istream &input) {
+    SetCells(ReadDelimited(input, '\t', false));
 }
 
 const ICell *Sheet::GetCell(Position pos) const {
@@ -82,12 +138,10 @@ void Sheet::ClearCell(Position pos) {
         throw InvalidPositionException(
                 "Invalid position passed to Sheet::ClearCell()");
     }
-    if (pos.row < ssize(cells_) && pos.col < ssize(cells_[pos.row])) {
-        if (auto &cell = cells_[pos.row][pos.col]) {
-            cell->Clear();
-            if (!cell->IsReferenced()) {
-                cell.reset();
-            }
+    if (Cell *cell = cells_.Get(pos)) {
+        cell->Clear();
+        if (!cell->IsReferenced()) {
+            cells_.Destroy(cells_.Extract(pos));
         }
     }
 }
@@ -99,12 +153,16 @@ void Sheet::InsertRows(int before, int count) {
     if (before < 0 || count < 0) {
         throw std::out_of_range("Wrong arguments for InsertRows()");
     }
-    if (GetActualSize().rows + count >= Position::kMaxRows) {
+    if (count >= Position::kMaxRows ||
+        cells_.HasCellsInRows(Position::kMaxRows - count - 1, Position::kMaxRows - 1)) {
         throw TableTooBigException(
                 "Adding rows would push some cells out of allowed table bounds");
     }
-    InsertToVectorDefaultConstructed(cells_, before, count);
-    UpdateFormulas([=](IFormula &formula) {
+    // Ячейки остаются на своих местах в хранилище, меняется лишь нумерация
+    // строк, а формулы переписываются только те, что ссылаются за before
+    cells_.InsertRows(before, count);
+    rangeIndex_.InsertRows(before, count);
+    UpdateFormulas(formulasByLastRow_, before, [=](IFormula &formula) {
         return formula.HandleInsertedRows(before, count);
     });
 }
@@ -116,14 +174,14 @@ void Sheet::InsertCols(int before, int count) {
     if (before < 0 || count < 0) {
         throw std::out_of_range("Wrong arguments for InsertCols()");
     }
-    if (GetActualSize().cols + count >= Position::kMaxCols) {
+    if (count >= Position::kMaxCols ||
+        cells_.HasCellsInCols(Position::kMaxCols - count - 1, Position::kMaxCols - 1)) {
         throw TableTooBigException(
                 "Adding cols would push some cells out of allowed table bounds");
     }
-    for (auto &row: cells_) {
-        InsertToVectorDefaultConstructed(row, before, count);
-    }
-    UpdateFormulas([=](IFormula &formula) {
+    cells_.InsertCols(before, count);
+    rangeIndex_.InsertCols(before, count);
+    UpdateFormulas(formulasByLastCol_, before, [=](IFormula &formula) {
         return formula.HandleInsertedCols(before, count);
     });
 }
@@ -135,8 +193,12 @@ void Sheet::DeleteRows(int first, int count) {
     if (first < 0 || count < 0) {
         throw std::out_of_range("Wrong arguments for DeleteRows()");
     }
+    if (first >= Position::kMaxRows) {
+        return;
+    }
+    count = std::min(count, Position::kMaxRows - first);
 
-    std::vector <std::unique_ptr<Cell>> cellsToRemove;
+    std::vector<Cell *> cellsToRemove;
 
     // Прежде чем удалять ячейки, нужно убедиться, что у них нет ни входящих, ни
     // исходящих ссылок (иначе у нас появятся висячие указатели). Очистка ячеек
@@ -149,29 +211,28 @@ void Sheet::DeleteRows(int first, int count) {
     // таблицы уже должны быть в этот момент удалены. Но ячейки-то удалять пока
     // нельзя, мы с этого начали! Получается, что нужно на время извлечь ячейки из
     // таблицы, и удалить их в самом конце, после обновления формул.
-    for (int i = 0; i < count; ++i) {
-        int r = first + i;
-        if (r < ssize(cells_)) {
-            for (auto &cell: cells_[r]) {
-                if (cell) {
-                    cell->Clear();
-                    cellsToRemove.emplace_back(std::move(cell));
-                }
-            }
-        }
+    std::vector<Position> positionsToRemove;
+    cells_.ForEachInRange({{first, 0}, {first + count - 1, Position::kMaxCols - 1}},
+                          [&](Position pos, Cell &) { positionsToRemove.push_back(pos); });
+    for (auto pos: positionsToRemove) {
+        cells_.Get(pos)->Clear();
+        cellsToRemove.push_back(cells_.Extract(pos));
     }
 
     // Важно удалить элементы таблицы до того, как обновлять формулы, чтобы
     // обновлённые индексы указывали на правильные ячейки
-    SafeErase(cells_, first, count);
+    cells_.DeleteRows(first, count);
+    rangeIndex_.DeleteRows(first, count);
 
-    // Теперь обновим формулы
-    UpdateFormulas([=](IFormula &formula) {
+    // Теперь обновим формулы, задетые удалением
+    UpdateFormulas(formulasByLastRow_, first, [=](IFormula &formula) {
         return formula.HandleDeletedRows(first, count);
     });
 
-    // А вот теперь уже можно удалять ячейки, что и будет сделано неявно в
-    // деструкторе объекта cellsToRemove
+    // А вот теперь уже можно удалять ячейки
+    for (Cell *cell: cellsToRemove) {
+        cells_.Destroy(cell);
+    }
 }
 
 void Sheet::DeleteCols(int first, int count) {
@@ -181,47 +242,56 @@ void Sheet::DeleteCols(int first, int count) {
     if (first < 0 || count < 0) {
         throw std::out_of_range("Wrong arguments for DeleteCols()");
     }
+    if (first >= Position::kMaxCols) {
+        return;
+    }
+    count = std::min(count, Position::kMaxCols - first);
 
     // См. комментарии в теле DeleteRows(), здесь идея та же самая
-    std::vector <std::unique_ptr<Cell>> cellsToRemove;
-
-    for (auto &row: cells_) {
-        for (int i = 0; i < count; ++i) {
-            int c = first + i;
-            if (c < ssize(row)) {
-                if (auto &cell = row[c]) {
-                    cell->Clear();
-                    cellsToRemove.emplace_back(std::move(cell));
-                }
-            }
-        }
+    std::vector<Cell *> cellsToRemove;
+
+    std::vector<Position> positionsToRemove;
+    cells_.ForEachInRange({{0, first}, {Position::kMaxRows - 1, first + count - 1}},
+                          [&](Position pos, Cell &) { positionsToRemove.push_back(pos); });
+    for (auto pos: positionsToRemove) {
+        cells_.Get(pos)->Clear();
+        cellsToRemove.push_back(cells_.Extract(pos));
     }
 
-    for (auto &row: cells_) {
-        SafeErase(row, first, count);
-    }
+    cells_.DeleteCols(first, count);
+    rangeIndex_.DeleteCols(first, count);
 
-    UpdateFormulas([=](IFormula &formula) {
+    UpdateFormulas(formulasByLastCol_, first, [=](IFormula &formula) {
         return formula.HandleDeletedCols(first, count);
     });
+
+    for (Cell *cell: cellsToRemove) {
+        cells_.Destroy(cell);
+    }
 }
 
 Size Sheet::GetPrintableSize() const {
     Size size;
-    for (int row = 0; row < ssize(cells_); ++row) {
-        for (int col = ssize(cells_[row]) - 1; col >= 0; --col) {
-            if (const auto &cell = cells_[row][col]) {
-                if (!cell->GetText().empty()) {
-                    size.rows = std::max(size.rows, row + 1);
-                    size.cols = std::max(size.cols, col + 1);
-                    break;
-                }
-            }
+    cells_.ForEach([&size](Position pos, const Cell &cell) {
+        if (!cell.GetText().empty()) {
+            size.rows = std::max(size.rows, pos.row + 1);
+            size.cols = std::max(size.cols, pos.col + 1);
         }
-    }
+    });
     return size;
 }
 
+RangeStats Sheet::GetRangeStats(Range range) const {
+    return rangeIndex_.GetStats(range);
+}
+
+std::variant<double, FormulaError> Sheet::GetCellNumber(Position pos) const {
+    if (const Cell *cell = cells_.Get(pos)) {
+        return cell->GetNumber();
+    }
+    return 0.0;
+}
+
 void Sheet::PrintValues(std::ostream &output) const {
     PrintCells(output, [&](const ICell &cell) {
         std::visit([&](const auto &value) { output << value; }, cell.GetValue());
@@ -238,10 +308,7 @@ const Cell *Sheet::GetConcreteCell(Position pos) const {
         throw InvalidPositionException(
                 "Invalid position passed to Sheet::GetCell()");
     }
-    if (pos.row >= ssize(cells_) || pos.col >= ssize(cells_[pos.row])) {
-        return nullptr;
-    }
-    return cells_[pos.row][pos.col].get();
+    return cells_.Get(pos);
 }
 
 Cell *Sheet::GetConcreteCell(Position pos) {
@@ -249,9 +316,55 @@ Cell *Sheet::GetConcreteCell(Position pos) {
             static_cast<const Sheet &>(*this).GetConcreteCell(pos));
 }
 
-void Sheet::MaybeIncreaseSizeToIncludePosition(Position pos) {
-    cells_.resize(std::max(pos.row + 1, ssize(cells_)));
-    cells_[pos.row].resize(std::max(pos.col + 1, ssize(cells_[pos.row])));
+void Sheet::MarkDirty(Cell *cell) {
+    dirtyCells_.insert(cell);
+}
+
+void Sheet::MarkClean(Cell *cell) {
+    dirtyCells_.erase(cell);
+}
+
+void Sheet::Recalculate() {
+    // Забираем множество себе: во время пересчёта формулы читают значения
+    // ячеек, и повторный вход сюда должен видеть пустую очередь
+    auto dirty = std::move(dirtyCells_);
+    dirtyCells_.clear();
+    Cell::Recalculate(dirty, recalculationThreads_);
+}
+
+void Sheet::SetRecalculationThreads(size_t threads) {
+    recalculationThreads_ = std::max<size_t>(threads, 1);
+}
+
+RangeIndex &Sheet::GetRangeIndex() {
+    return rangeIndex_;
+}
+
+void Sheet::ForEachCellInRange(Range range, const std::function<void(Cell *)> &visit) const {
+    cells_.ForEachInRange(range, [&visit](Position, Cell &cell) { visit(&cell); });
+}
+
+Position Sheet::GetCellPosition(const Cell &cell) const {
+    return cells_.GetPosition(cell);
+}
+
+void Sheet::UpdateLastReference(Cell *cell, Position from, Position to) {
+    if (from.row >= 0) {
+        formulasByLastRow_.erase({from.row, cell});
+        formulasByLastCol_.erase({from.col, cell});
+    }
+    if (to.row >= 0) {
+        formulasByLastRow_.insert({to.row, cell});
+        formulasByLastCol_.insert({to.col, cell});
+    }
+}
+
+int64_t Sheet::TakeOrderBeforeAll() {
+    return --firstOrder_;
+}
+
+int64_t Sheet::TakeOrderAfterAll() {
+    return ++lastOrder_;
 }
 
 void Sheet::PrintCells(
@@ -263,10 +376,8 @@ void Sheet::PrintCells(
             if (col > 0) {
                 output << '\t';
             }
-            if (col < ssize(cells_[row])) {
-                if (const auto &cell = cells_[row][col]) {
-                    printCell(*cell);
-                }
+            if (const Cell *cell = cells_.Get({row, col})) {
+                printCell(*cell);
             }
         }
         output << '\n';
@@ -274,29 +385,14 @@ void Sheet::PrintCells(
 }
 
 void Sheet::UpdateFormulas(
+        const std::set<std::pair<int, Cell *>> &formulas, int first,
         const std::function<IFormula::HandlingResult(IFormula & )> &update) {
-    // TODO: keep track of current formulas to optimize search
-    for (auto &row: cells_) {
-        for (auto &cell: row) {
-            if (cell) {
-                cell->UpdateFormula(update);
-            }
-        }
-    }
-}
-
-Size Sheet::GetActualSize() const {
-    Size size;
-    for (int row = 0; row < ssize(cells_); ++row) {
-        for (int col = ssize(cells_[row]) - 1; col >= 0; --col) {
-            if (cells_[row][col]) {
-                size.rows = std::max(size.rows, row + 1);
-                size.cols = std::max(size.cols, col + 1);
-                break;
-            }
-        }
+    // Обновление формулы переставляет её в наборе, поэтому обходим копию
+    std::vector<Cell *> cells;
+    for (auto it = formulas.lower_bound({first, nullptr}); it != formulas.end(); ++it) {
+        cells.push_back(it->second);
     }
-    return size;
+    Cell::UpdateFormulas(cells, update);
 }
 
 std::unique_ptr <ISheet> CreateSheet() {
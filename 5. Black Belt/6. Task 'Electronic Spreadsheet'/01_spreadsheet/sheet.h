@@ -1,16 +1,39 @@
 #pragma once
 
 #include "cell.h"
+#include "cell_storage.h"
 #include "common.h"
+#include "range.h"
+#include "range_index.h"
 
+#include <cstdint>
 #include <functional>
-
-class Sheet : public ISheet {
+#include <iosfwd>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class Sheet : public ISheet, public IRangeStats, public ICellNumbers {
 public:
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
 
+    // То же, что SetCell для каждой пары по очереди, но ссылки проводятся по
+    // разу, а формулы разбираются в нескольких потоках, если они заданы. При
+    // ошибке лист остаётся прежним
+    void SetCells(std::vector<std::pair<Position, std::string>> cells);
+
+    // Загрузка таблицы: строка файла - строка листа, пустые поля пропускаются.
+    // CSV читается по RFC 4180, с полями в кавычках, и на нарушениях формата
+    // бросает std::invalid_argument, а TSV - в том виде, в каком его печатает
+    // PrintTexts
+    void ImportCsv(std::istream &input);
+
+    void ImportTsv(std::istream &input);
+
     const ICell *GetCell(Position pos) const override;
 
     ICell *GetCell(Position pos) override;
@@ -31,21 +54,58 @@ public:
 
     void PrintTexts(std::ostream &output) const override;
 
+    RangeStats GetRangeStats(Range range) const override;
+
+    std::variant<double, FormulaError> GetCellNumber(Position pos) const override;
+
     const Cell *GetConcreteCell(Position pos) const;
 
     Cell *GetConcreteCell(Position pos);
 
-private:
-    void MaybeIncreaseSizeToIncludePosition(Position pos);
+    // Формулы с устаревшим значением копятся здесь и пересчитываются все разом
+    // при первом чтении любой из них
+    void MarkDirty(Cell *cell);
+
+    void MarkClean(Cell *cell);
+
+    void Recalculate();
 
+    // Число потоков для пересчёта формул и разбора их при загрузке,
+    // 1 - последовательный режим
+    void SetRecalculationThreads(size_t threads);
+
+    RangeIndex &GetRangeIndex();
+
+    void ForEachCellInRange(Range range, const std::function<void(Cell *)> &visit) const;
+
+    Position GetCellPosition(const Cell &cell) const;
+
+    // Формула сообщает самые дальние строку и столбец, на которые ссылается,
+    // каждый раз, когда они меняются; {-1, -1} - ссылок нет
+    void UpdateLastReference(Cell *cell, Position from, Position to);
+
+    // Места в топологическом порядке ячеек до и после всех уже выданных
+    int64_t TakeOrderBeforeAll();
+
+    int64_t TakeOrderAfterAll();
+
+private:
     void PrintCells(std::ostream &output,
                     const std::function<void(const ICell &)> &printCell) const;
 
+    // Вставка и удаление строк (столбцов) начиная с first задевают только
+    // формулы, ссылающиеся на них или дальше
     void UpdateFormulas(
+            const std::set<std::pair<int, Cell *>> &formulas, int first,
             const std::function<IFormula::HandlingResult(IFormula & )> &update);
 
-    Size GetActualSize() const;
-
-    std::vector <std::vector<std::unique_ptr < Cell>>>
-    cells_;
+    CellStorage cells_;
+    RangeIndex rangeIndex_{cells_};
+    std::unordered_set<Cell *> dirtyCells_;
+    size_t recalculationThreads_ = 1;
+    int64_t firstOrder_ = 0;
+    int64_t lastOrder_ = 0;
+    // Формулы по самой дальней строке и самому дальнему столбцу их ссылок
+    std::set<std::pair<int, Cell *>> formulasByLastRow_;
+    std::set<std::pair<int, Cell *>> formulasByLastCol_;
 };
\ No newline at end of file
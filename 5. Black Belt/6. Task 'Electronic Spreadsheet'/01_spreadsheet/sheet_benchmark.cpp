@@ -0,0 +1,289 @@
+#include "common.h"
+#include "sheet.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+    class Timer {
+    public:
+        explicit Timer(std::string_view name) : name_(name) {}
+
+        ~Timer() {
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start_;
+            std::cout << name_ << ": " << elapsed.count() << " ms\n";
+        }
+
+    private:
+        std::string_view name_;
+        std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+    };
+
+    // Заполняет rows x cols ячеек числами, последний столбец - формулы от соседей
+    void FillDense(ISheet &sheet, int rows, int cols) {
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col + 1 < cols; ++col) {
+                sheet.SetCell({row, col}, std::to_string(row + col));
+            }
+            sheet.SetCell({row, cols - 1}, "=" + Position{row, 0}.ToString() + "+" +
+                                           Position{row, cols - 2}.ToString());
+        }
+    }
+
+    double SumValues(const ISheet &sheet, int rows, int cols) {
+        double sum = 0;
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                if (const auto *cell = sheet.GetCell({row, col})) {
+                    const auto value = cell->GetValue();
+                    if (const auto *number = std::get_if<double>(&value)) {
+                        sum += *number;
+                    }
+                }
+            }
+        }
+        return sum;
+    }
+
+    // Ячейки, разбросанные по всему листу: почти каждая попадает в свою плитку,
+    // так что время и память уходят на плитки, а не на сами ячейки
+    double ScatterCells(int count) {
+        std::mt19937 random(count);
+        std::uniform_int_distribution<int> row(0, Position::kMaxRows - 1);
+        std::uniform_int_distribution<int> col(0, Position::kMaxCols - 1);
+        std::vector<Position> positions;
+        for (int i = 0; i < count; ++i) {
+            positions.push_back({row(random), col(random)});
+        }
+
+        auto sheet = CreateSheet();
+        {
+            Timer timer("scattered SetCell");
+            for (int i = 0; i < count; ++i) {
+                sheet->SetCell(positions[i], "=" + std::to_string(i));
+            }
+        }
+        Timer timer("scattered GetCell + GetValue");
+        double sum = 0;
+        for (const Position &pos: positions) {
+            sum += std::get<double>(sheet->GetCell(pos)->GetValue());
+        }
+        return sum;
+    }
+
+    // Широкий лист: в каждой строке формула складывает 20 соседних ячеек и общую
+    // ячейку Z1, так что изменение Z1 делает устаревшими rows независимых формул
+    std::vector<ICell::Value> RecalculateWide(int rows, size_t threads) {
+        const int inputCols = 20;
+        const Position shared{0, 25};
+        Sheet sheet;
+        sheet.SetRecalculationThreads(threads);
+        for (int row = 0; row < rows; ++row) {
+            std::string formula = "=" + shared.ToString();
+            for (int col = 0; col < inputCols; ++col) {
+                sheet.SetCell({row, col}, std::to_string(row * col % 97));
+                formula += "+" + Position{row, col}.ToString();
+            }
+            sheet.SetCell({row, inputCols}, formula);
+        }
+        sheet.SetCell(shared, "1");
+        sheet.GetCell({0, inputCols})->GetValue();
+
+        sheet.SetCell(shared, "2");
+        std::vector<ICell::Value> values;
+        {
+            Timer timer(threads == 1 ? "wide recalculation, serial"
+                                     : "wide recalculation, parallel");
+            values.push_back(sheet.GetCell({0, inputCols})->GetValue());
+        }
+        for (int row = 1; row < rows; ++row) {
+            values.push_back(sheet.GetCell({row, inputCols})->GetValue());
+        }
+        return values;
+    }
+
+    // Формулы SUM(A1:Ai) над столбцом чисел: у каждой одно ребро на диапазон, а
+    // после изменения A1 все они пересчитываются по дереву отрезков столбца
+    double RecalculateRanges(int rows) {
+        auto sheet = CreateSheet();
+        for (int row = 0; row < rows; ++row) {
+            sheet->SetCell({row, 0}, std::to_string(row));
+            sheet->SetCell({row, 1}, "=SUM(A1:" + Position{row, 0}.ToString() + ")");
+        }
+        const Position last{rows - 1, 1};
+        {
+            Timer timer("range formulas, first evaluation");
+            sheet->GetCell(last)->GetValue();
+        }
+        Timer timer("range formulas, recalculation after A1 changes");
+        sheet->SetCell({0, 0}, "1");
+        return std::get<double>(sheet->GetCell(last)->GetValue());
+    }
+
+    // Цепочка Ai = A(i+1) + 1, заданная сверху вниз: каждая новая формула
+    // стоит в начале уже построенной цепочки зависимых, и проверка на цикл не
+    // должна обходить её целиком
+    double LoadChainTopDown(int rows) {
+        auto sheet = CreateSheet();
+        {
+            Timer timer("chain SetCell, top-down");
+            for (int row = 0; row + 1 < rows; ++row) {
+                sheet->SetCell({row, 0}, "=" + Position{row + 1, 0}.ToString() + "+1");
+            }
+            sheet->SetCell({rows - 1, 0}, "1");
+        }
+        return std::get<double>(sheet->GetCell({0, 0})->GetValue());
+    }
+
+    // Формулы читают текстовые ячейки по нескольку раз, а изменение общей
+    // ячейки Z1 делает их все устаревшими: число из текста берётся готовым
+    double ReadTextCells(int rows) {
+        const Position shared{0, 25};
+        auto sheet = CreateSheet();
+        for (int row = 0; row < rows; ++row) {
+            const std::string text = Position{row, 0}.ToString();
+            sheet->SetCell({row, 0}, "  " + std::to_string(row) + ".25");
+            sheet->SetCell({row, 1}, "=" + shared.ToString() + "+" + text + "*2+" + text + "/4-" + text);
+        }
+        Timer timer("formulas over text cells, 10 recalculations");
+        double sum = 0;
+        for (int i = 0; i < 10; ++i) {
+            sheet->SetCell(shared, std::to_string(i));
+            for (int row = 0; row < rows; ++row) {
+                sum += std::get<double>(sheet->GetCell({row, 1})->GetValue());
+            }
+        }
+        return sum;
+    }
+
+    // Лист формул от соседей снизу и справа в виде TSV: загрузка пакетом
+    // против SetCell по одной ячейке, итог должен совпасть
+    bool ImportFormulas(int rows, int cols, size_t threads) {
+        std::string tsv;
+        std::vector<std::pair<Position, std::string>> cells;
+        for (int row = 0; row < rows; ++row) {
+            for (int col = 0; col < cols; ++col) {
+                std::string text = std::to_string(row + col);
+                if (row + 1 < rows && col + 1 < cols) {
+                    text = "=" + Position{row + 1, col}.ToString() + "+" +
+                           Position{row, col + 1}.ToString() + "/2";
+                }
+                tsv += (col > 0 ? "\t" : "") + text;
+                cells.emplace_back(Position{row, col}, std::move(text));
+            }
+            tsv += '\n';
+        }
+
+        Sheet sequential;
+        {
+            Timer timer("import baseline, SetCell per cell");
+            for (auto &[pos, text]: cells) {
+                sequential.SetCell(pos, std::move(text));
+            }
+        }
+        Sheet imported;
+        imported.SetRecalculationThreads(threads);
+        {
+            Timer timer("ImportTsv");
+            std::istringstream input(tsv);
+            imported.ImportTsv(input);
+        }
+
+        std::ostringstream sequentialTexts;
+        std::ostringstream importedTexts;
+        sequential.PrintTexts(sequentialTexts);
+        imported.PrintTexts(importedTexts);
+        std::ostringstream sequentialValues;
+        std::ostringstream importedValues;
+        sequential.PrintValues(sequentialValues);
+        imported.PrintValues(importedValues);
+        return sequentialTexts.str() == importedTexts.str() &&
+               sequentialValues.str() == importedValues.str();
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    int rows = 1000;
+    int cols = 1000;
+    if (argc == 3) {
+        rows = std::stoi(argv[1]);
+        cols = std::stoi(argv[2]);
+    } else if (argc != 1) {
+        std::cerr << "Usage: sheet_benchmark [rows cols]\n";
+        return 5;
+    }
+
+    std::cout << rows << "x" << cols << " cells\n";
+    auto sheet = CreateSheet();
+    {
+        Timer timer("SetCell");
+        FillDense(*sheet, rows, cols);
+    }
+    double sum;
+    {
+        Timer timer("GetCell + GetValue");
+        sum = SumValues(*sheet, rows, cols);
+    }
+    {
+        Timer timer("InsertRows(0, 1)");
+        sheet->InsertRows(0, 1);
+    }
+    {
+        Timer timer("DeleteCols(0, 1)");
+        sheet->DeleteCols(0, 1);
+    }
+    {
+        Timer timer("GetPrintableSize");
+        auto size = sheet->GetPrintableSize();
+        std::cout << "printable size " << size.rows << "x" << size.cols << "\n";
+    }
+
+    // Одна далёкая ячейка не должна заводить всю таблицу до неё
+    auto sparse = CreateSheet();
+    {
+        Timer timer("sparse SetCell ZZ10000 and XFD16384");
+        sparse->SetCell(Position::FromString("ZZ10000"), "1");
+        sparse->SetCell(Position::FromString("XFD16384"), "=ZZ10000*2");
+    }
+    {
+        Timer timer("sparse GetPrintableSize");
+        auto size = sparse->GetPrintableSize();
+        std::cout << "printable size " << size.rows << "x" << size.cols << "\n";
+    }
+
+    std::cout << "scattered: " << rows * 100 << " cells\n";
+    const double scatterSum = ScatterCells(rows * 100);
+
+    const size_t threads = std::max(std::thread::hardware_concurrency(), 2u);
+    std::cout << "wide sheet: " << rows << " formulas, " << threads << " threads\n";
+    const auto serial = RecalculateWide(rows, 1);
+    const bool identical = serial == RecalculateWide(rows, threads);
+    if (!identical) {
+        std::cerr << "parallel recalculation differs from serial\n";
+    }
+
+    std::cout << "range sheet: " << rows << " formulas\n";
+    const double rangeSum = RecalculateRanges(rows);
+
+    std::cout << "chain: " << rows << " formulas\n";
+    const double chainTop = LoadChainTopDown(rows);
+
+    std::cout << "text sheet: " << rows << " formulas\n";
+    const double textSum = ReadTextCells(rows);
+
+    // Разбор в лишних потоках на занятых ядрах только мешает
+    const size_t importThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::cout << "import: " << rows << "x20 cells, " << importThreads << " threads\n";
+    const bool imported = ImportFormulas(rows, 20, importThreads);
+    if (!imported) {
+        std::cerr << "imported sheet differs from the one set cell by cell\n";
+    }
+
+    return sum > 0 && scatterSum > 0 && identical && rangeSum > 0 && chainTop == rows && textSum > 0 && imported ? 0 : 1;
+}